@@ -0,0 +1,36 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* shared by the tools in bench/, built with -DSANGE_BENCH=ON */
+enum{
+	/* 20 ms at 48 khz stereo, what a player encodes per packet */
+	BENCH_RATE = 48000,
+	BENCH_CHANNELS = 2,
+	BENCH_FRAME = 960
+};
+
+static inline uint64_t bench_now(){
+	timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1'000'000'000 + now.tv_nsec;
+}
+
+/* thread cpu time, so the numbers mean cost per stream rather than wall time */
+static inline uint64_t bench_cpu(){
+	timespec now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+	return (uint64_t)now.tv_sec * 1'000'000'000 + now.tv_nsec;
+}
+
+/* ns per operation, with how many streams of 20 ms packets one core would keep up with */
+static inline void bench_report(const char* name, uint64_t ns, long ops){
+	double per_op = (double)ns / ops;
+
+	printf("%-40s %10.0f ns/packet %10.0f streams/core\n", name, per_op, 20'000'000 / per_op);
+}
\ No newline at end of file
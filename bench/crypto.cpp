@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+#include "bench.h"
+
+/*
+ * cost of sealing one rtp packet with each voice encryption mode, the same calls wrapper.cpp makes
+ * usage: build/Release/sange_bench_crypto [packets]
+ */
+enum{
+	RTP_HEADER = 12,
+	/* opus at 64, 128 and 510 kbps for 20 ms */
+	SIZES = 3
+};
+
+static const int sizes[SIZES] = {160, 320, 1275};
+
+static uint8_t key[32];
+static uint8_t header[RTP_HEADER];
+static uint8_t payload[1275];
+static uint8_t out[RTP_HEADER + 1275 + 64];
+
+static void bench_xsalsa20(int size, long packets){
+	uint8_t nonce[crypto_secretbox_NONCEBYTES] = {0};
+	uint64_t start = bench_cpu();
+	char name[64];
+
+	for(long i = 0; i < packets; i++){
+		/* the default mode uses the rtp header as the nonce */
+		memcpy(nonce, header, RTP_HEADER);
+		nonce[RTP_HEADER] = i;
+		crypto_secretbox_easy(out + RTP_HEADER, payload, size, nonce, key);
+	}
+
+	snprintf(name, sizeof(name), "xsalsa20_poly1305 %d bytes", size);
+	bench_report(name, bench_cpu() - start, packets);
+}
+
+static void bench_aes256gcm(int size, long packets){
+	crypto_aead_aes256gcm_state state;
+	uint8_t nonce[crypto_aead_aes256gcm_NPUBBYTES] = {0};
+	uint64_t start;
+	char name[64];
+
+	if(!crypto_aead_aes256gcm_is_available()){
+		printf("aead_aes256_gcm: no aes-ni on this cpu\n");
+
+		return;
+	}
+
+	crypto_aead_aes256gcm_beforenm(&state, key);
+	start = bench_cpu();
+
+	for(long i = 0; i < packets; i++){
+		memcpy(nonce, &i, sizeof(uint32_t));
+		crypto_aead_aes256gcm_encrypt_afternm(out + RTP_HEADER, nullptr, payload, size, header, RTP_HEADER, nullptr, nonce, &state);
+	}
+
+	snprintf(name, sizeof(name), "aead_aes256_gcm %d bytes", size);
+	bench_report(name, bench_cpu() - start, packets);
+}
+
+static void bench_xchacha20(int size, long packets){
+	uint8_t nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES] = {0};
+	uint64_t start = bench_cpu();
+	char name[64];
+
+	for(long i = 0; i < packets; i++){
+		memcpy(nonce, &i, sizeof(uint32_t));
+		crypto_aead_xchacha20poly1305_ietf_encrypt(out + RTP_HEADER, nullptr, payload, size, header, RTP_HEADER, nullptr, nonce, key);
+	}
+
+	snprintf(name, sizeof(name), "aead_xchacha20_poly1305 %d bytes", size);
+	bench_report(name, bench_cpu() - start, packets);
+}
+
+int main(int argc, char** argv){
+	long packets = argc > 1 ? atol(argv[1]) : 200000;
+
+	if(sodium_init() < 0)
+		return 1;
+	randombytes_buf(key, sizeof(key));
+	randombytes_buf(header, sizeof(header));
+	randombytes_buf(payload, sizeof(payload));
+
+	for(int size : sizes){
+		bench_xsalsa20(size, packets);
+		bench_aes256gcm(size, packets);
+		bench_xchacha20(size, packets);
+	}
+
+	return 0;
+}
\ No newline at end of file
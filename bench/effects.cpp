@@ -0,0 +1,86 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../src/dsp.h"
+#include "bench.h"
+#include "graph.h"
+
+/*
+ * cpu per stream of the native volume and tremolo against the volume= and tremolo= filters they replace
+ * usage: build/Release/sange_bench_effects [packets]
+ */
+struct Setting{
+	const char* name;
+	const char* chain;
+	float volume;
+	float depth;
+	float rate;
+};
+
+static const Setting settings[] = {
+	{"volume", "volume=0.5", 0.5, 0, 0},
+	{"tremolo", "tremolo=f=5:d=0.5", 1, 0.5, 5},
+	{"volume + tremolo", "volume=0.5,tremolo=f=5:d=0.5", 0.5, 0.5, 5}
+};
+
+static std::vector<float> input;
+static std::vector<float> samples;
+
+static void bench_native(const Setting& setting, long packets){
+	AudioEffects effects;
+	uint64_t start = bench_cpu();
+	char name[64];
+
+	for(long i = 0; i < packets; i++){
+		memcpy(samples.data(), input.data(), input.size() * sizeof(float));
+		effects.update(setting.volume, setting.depth, setting.rate, BENCH_RATE);
+		effects.process(samples.data(), BENCH_FRAME, BENCH_CHANNELS, BENCH_RATE);
+	}
+
+	snprintf(name, sizeof(name), "native %s", setting.name);
+	bench_report(name, bench_cpu() - start, packets);
+}
+
+static void bench_filter(const Setting& setting, long packets){
+	BenchGraph graph;
+	uint64_t start;
+	char name[64];
+
+	if(graph.open(setting.chain, BENCH_RATE, BENCH_CHANNELS, BENCH_FRAME) < 0){
+		printf("%s: could not open the filter\n", setting.chain);
+
+		return;
+	}
+
+	start = bench_cpu();
+
+	for(long i = 0; i < packets; i++){
+		memcpy(samples.data(), input.data(), input.size() * sizeof(float));
+
+		if(graph.run(samples.data(), BENCH_FRAME, BENCH_FRAME) < 0)
+			break;
+	}
+
+	snprintf(name, sizeof(name), "%s", setting.chain);
+	bench_report(name, bench_cpu() - start, packets);
+}
+
+int main(int argc, char** argv){
+	long packets = argc > 1 ? atol(argv[1]) : 50000;
+
+	input.resize(BENCH_FRAME * BENCH_CHANNELS);
+	samples.resize(input.size());
+
+	for(int i = 0; i < BENCH_FRAME; i++)
+		for(int ch = 0; ch < BENCH_CHANNELS; ch++)
+			input[i * BENCH_CHANNELS + ch] = 0.5 * sin(2 * M_PI * 440 * i / BENCH_RATE);
+	printf("dsp kernels: %s\n", dsp_kernels().name);
+
+	for(const Setting& setting : settings){
+		bench_native(setting, packets);
+		bench_filter(setting, packets);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/encoder.h"
+#include "bench.h"
+
+/*
+ * cpu per stream of encoding a 20 ms packet through the direct encoder against the avcodec libopus wrapper it replaced,
+ * with plain opus_encode_float as the floor both are measured against
+ * usage: build/Release/sange_bench_encoder [packets]
+ */
+enum{
+	BITRATE = 64000,
+	COMPLEXITY = 10,
+	/* same size the players' pool hands out */
+	POOL_BUFFER_SIZE = 8192,
+	/* one second of input, so the encoder doesn't see the same packet over and over */
+	INPUT_PACKETS = 50
+};
+
+static float input[INPUT_PACKETS][BENCH_FRAME * BENCH_CHANNELS];
+static BufferPool pool(POOL_BUFFER_SIZE);
+
+static int get_encode_buffer(AVCodecContext* ctx, AVPacket* pkt, int flags){
+	if((size_t)pkt -> size + AV_INPUT_BUFFER_PADDING_SIZE <= pool.get_size()){
+		pkt -> buf = pool.get();
+
+		if(pkt -> buf){
+			pkt -> data = pkt -> buf -> data;
+
+			memset(pkt -> data + pkt -> size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+			return 0;
+		}
+	}
+
+	return avcodec_default_get_encode_buffer(ctx, pkt, flags);
+}
+
+/* the frame the player hands over, refilled with the next packet of input */
+static int fill(AVFrame* frame, long i){
+	int err;
+
+	if((err = av_frame_make_writable(frame)) < 0)
+		return err;
+	memcpy(frame -> data[0], input[i % INPUT_PACKETS], sizeof(input[0]));
+
+	frame -> pts = i * BENCH_FRAME;
+
+	return 0;
+}
+
+static double bench_opus(AVFrame* frame, long packets){
+	OpusEncoder* encoder;
+	unsigned char data[1275 * 3 + 7];
+	uint64_t start, ns;
+	int err;
+
+	encoder = opus_encoder_create(BENCH_RATE, BENCH_CHANNELS, OPUS_APPLICATION_AUDIO, &err);
+
+	if(!encoder){
+		printf("opus_encode_float: could not open the encoder\n");
+
+		return 0;
+	}
+
+	opus_encoder_ctl(encoder, OPUS_SET_VBR(1));
+	opus_encoder_ctl(encoder, OPUS_SET_BITRATE(BITRATE));
+	opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(COMPLEXITY));
+	opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
+
+	start = bench_cpu();
+
+	for(long i = 0; i < packets; i++){
+		if(fill(frame, i) < 0 || opus_encode_float(encoder, (const float*)frame -> data[0], BENCH_FRAME, data, sizeof(data)) < 0)
+			break;
+	}
+
+	ns = bench_cpu() - start;
+
+	bench_report("opus_encode_float", ns, packets);
+	opus_encoder_destroy(encoder);
+
+	return (double)ns / packets;
+}
+
+static double bench_direct(AVFrame* frame, AVPacket* pkt, long packets){
+	DirectEncoder direct;
+	uint64_t start, ns;
+
+	if(direct.open(BENCH_RATE, BENCH_CHANNELS, BENCH_FRAME, BITRATE, COMPLEXITY, OPUS_SIGNAL_MUSIC) < 0){
+		printf("direct: could not open the encoder\n");
+
+		return 0;
+	}
+
+	start = bench_cpu();
+
+	for(long i = 0; i < packets; i++){
+		if(fill(frame, i) < 0 || direct.encode(frame, pkt, &pool) < 0)
+			break;
+		av_packet_unref(pkt);
+	}
+
+	ns = bench_cpu() - start;
+
+	bench_report("direct", ns, packets);
+
+	return (double)ns / packets;
+}
+
+static double bench_avcodec(AVFrame* frame, AVPacket* pkt, long packets){
+	const AVCodec* encoder = avcodec_find_encoder_by_name("libopus");
+	AVCodecContext* encoderctx = nullptr;
+	uint64_t start, ns = 0;
+	int err;
+
+	if(encoder)
+		encoderctx = avcodec_alloc_context3(encoder);
+	if(!encoderctx){
+		printf("libopus: encoder not available\n");
+
+		return 0;
+	}
+
+	/* the setup the player used before the direct encoder */
+	encoderctx -> bit_rate = BITRATE;
+	encoderctx -> sample_rate = BENCH_RATE;
+	encoderctx -> channels = BENCH_CHANNELS;
+	encoderctx -> sample_fmt = AV_SAMPLE_FMT_FLT;
+	encoderctx -> channel_layout = av_get_default_channel_layout(BENCH_CHANNELS);
+	encoderctx -> compression_level = COMPLEXITY;
+
+	if(encoder -> capabilities & AV_CODEC_CAP_DR1)
+		encoderctx -> get_encode_buffer = get_encode_buffer;
+	if(avcodec_open2(encoderctx, encoder, nullptr) < 0 || encoderctx -> frame_size != BENCH_FRAME){
+		printf("libopus: could not open the encoder\n");
+
+		goto end;
+	}
+
+	start = bench_cpu();
+
+	for(long i = 0; i < packets; i++){
+		if(fill(frame, i) < 0 || avcodec_send_frame(encoderctx, frame) < 0)
+			break;
+		while((err = avcodec_receive_packet(encoderctx, pkt)) >= 0)
+			av_packet_unref(pkt);
+		if(err != AVERROR(EAGAIN))
+			break;
+	}
+
+	ns = bench_cpu() - start;
+
+	bench_report("avcodec libopus", ns, packets);
+
+	end:
+
+	avcodec_free_context(&encoderctx);
+
+	return (double)ns / packets;
+}
+
+int main(int argc, char** argv){
+	long packets = argc > 1 ? atol(argv[1]) : 20000;
+	AVFrame* frame = av_frame_alloc();
+	AVPacket* pkt = av_packet_alloc();
+	double bare, direct, avcodec;
+
+	if(!frame || !pkt)
+		return 1;
+	frame -> format = AV_SAMPLE_FMT_FLT;
+	frame -> channels = BENCH_CHANNELS;
+	frame -> channel_layout = av_get_default_channel_layout(BENCH_CHANNELS);
+	frame -> sample_rate = BENCH_RATE;
+	frame -> nb_samples = BENCH_FRAME;
+
+	if(av_frame_get_buffer(frame, 0) < 0)
+		return 1;
+	/* a chord with a slow tremolo, closer to music than a steady tone */
+	for(int p = 0; p < INPUT_PACKETS; p++){
+		for(int i = 0; i < BENCH_FRAME; i++){
+			double t = (double)(p * BENCH_FRAME + i) / BENCH_RATE;
+			double level = 0.3 * (1 + 0.5 * sin(2 * M_PI * 2 * t));
+
+			input[p][i * BENCH_CHANNELS] = level * (sin(2 * M_PI * 220 * t) + 0.5 * sin(2 * M_PI * 330 * t));
+			input[p][i * BENCH_CHANNELS + 1] = level * (sin(2 * M_PI * 277 * t) + 0.5 * sin(2 * M_PI * 440 * t));
+		}
+	}
+
+	bare = bench_opus(frame, packets);
+	direct = bench_direct(frame, pkt, packets);
+	avcodec = bench_avcodec(frame, pkt, packets);
+
+	/* what each path spends per packet on top of libopus itself */
+	if(bare > 0){
+		if(direct > 0)
+			printf("%-40s %10.0f ns/packet\n", "direct overhead", direct - bare);
+		if(avcodec > 0)
+			printf("%-40s %10.0f ns/packet\n", "avcodec overhead", avcodec - bare);
+	}
+
+	av_packet_free(&pkt);
+	av_frame_free(&frame);
+
+	return 0;
+}
\ No newline at end of file
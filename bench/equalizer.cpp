@@ -0,0 +1,92 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../src/dsp.h"
+#include "bench.h"
+#include "graph.h"
+
+/*
+ * cpu per stream of the native 15 band equalizer against firequalizer with the same bands, as the player used to build it
+ * usage: build/Release/sange_bench_equalizer [packets]
+ */
+enum{
+	BANDS = 15
+};
+
+/* iso 15 band centres, with a curve that touches every band */
+static const double bands[BANDS] = {25, 40, 63, 100, 160, 250, 400, 630, 1000, 1600, 2500, 4000, 6300, 10000, 16000};
+static const double gains[BANDS] = {6, 4, 2, 0, -2, -4, -6, -3, 0, 3, 6, 3, 0, -3, -6};
+
+static std::vector<float> input;
+static std::vector<float> samples;
+
+static void bench_native(const Equalizer* eqs, long packets){
+	EqualizerBank bank;
+	uint64_t start;
+
+	bank.set(eqs, BANDS);
+	/* the first block designs the cascade */
+	memcpy(samples.data(), input.data(), input.size() * sizeof(float));
+	bank.process(samples.data(), BENCH_FRAME, BENCH_CHANNELS, BENCH_RATE);
+
+	start = bench_cpu();
+
+	for(long i = 0; i < packets; i++){
+		memcpy(samples.data(), input.data(), input.size() * sizeof(float));
+		bank.process(samples.data(), BENCH_FRAME, BENCH_CHANNELS, BENCH_RATE);
+	}
+
+	bench_report("native 15 band equalizer", bench_cpu() - start, packets);
+}
+
+static void bench_filter(const Equalizer* eqs, long packets){
+	BenchGraph graph;
+	std::string chain = "firequalizer=gain_entry='";
+	uint64_t start;
+
+	for(int i = 0; i < BANDS; i++){
+		chain += "entry(" + std::to_string(eqs[i].band) + "," + std::to_string(eqs[i].gain) + ")";
+		chain += i == BANDS - 1 ? "'" : ";";
+	}
+
+	if(graph.open(chain.c_str(), BENCH_RATE, BENCH_CHANNELS, BENCH_FRAME) < 0){
+		printf("firequalizer: could not open the filter\n");
+
+		return;
+	}
+
+	start = bench_cpu();
+
+	for(long i = 0; i < packets; i++){
+		memcpy(samples.data(), input.data(), input.size() * sizeof(float));
+
+		if(graph.run(samples.data(), BENCH_FRAME, BENCH_FRAME) < 0)
+			break;
+	}
+
+	bench_report("firequalizer 15 entries", bench_cpu() - start, packets);
+}
+
+int main(int argc, char** argv){
+	long packets = argc > 1 ? atol(argv[1]) : 20000;
+	Equalizer eqs[BANDS];
+
+	for(int i = 0; i < BANDS; i++)
+		eqs[i] = {bands[i], gains[i]};
+	input.resize(BENCH_FRAME * BENCH_CHANNELS);
+	samples.resize(input.size());
+
+	/* noise, so every band has something to do */
+	srand(1);
+
+	for(float& sample : input)
+		sample = (float)rand() / RAND_MAX - 0.5;
+	printf("dsp kernels: %s\n", dsp_kernels().name);
+
+	bench_native(eqs, packets);
+	bench_filter(eqs, packets);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <string.h>
+#include "graph.h"
+
+BenchGraph::BenchGraph(){
+	graph = nullptr;
+	src = nullptr;
+	sink = nullptr;
+	pool = nullptr;
+	in = nullptr;
+	out = nullptr;
+	sample_rate = 0;
+	channels = 0;
+	pts = 0;
+}
+
+BenchGraph::~BenchGraph(){
+	close();
+}
+
+int BenchGraph::open(const char* chain, int rate, int ch, int frame_size){
+	AVFilterInOut *outputs = nullptr, *inputs = nullptr;
+	char args[256];
+	int ret;
+
+	close();
+
+	sample_rate = rate;
+	channels = ch;
+	graph = avfilter_graph_alloc();
+	in = av_frame_alloc();
+	out = av_frame_alloc();
+	pool = av_buffer_pool_init((size_t)frame_size * channels * sizeof(float), nullptr);
+
+	if(!graph || !in || !out || !pool){
+		ret = AVERROR(ENOMEM);
+
+		goto fail;
+	}
+
+	graph -> nb_threads = 1;
+
+	snprintf(args, sizeof(args), "sample_rate=%d:sample_fmt=%d:channels=%d:channel_layout=0x%" PRIx64,
+		sample_rate, AV_SAMPLE_FMT_FLT, channels, (uint64_t)av_get_default_channel_layout(channels));
+	if((ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("abuffer"), nullptr, args, nullptr, graph)) < 0)
+		goto fail;
+	if((ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name("abuffersink"), nullptr, nullptr, nullptr, graph)) < 0)
+		goto fail;
+	outputs = avfilter_inout_alloc();
+	inputs = avfilter_inout_alloc();
+
+	if(!outputs || !inputs){
+		ret = AVERROR(ENOMEM);
+
+		goto fail;
+	}
+
+	outputs -> name = av_strdup("in");
+	outputs -> filter_ctx = src;
+	inputs -> name = av_strdup("out");
+	inputs -> filter_ctx = sink;
+
+	if((ret = avfilter_graph_parse_ptr(graph, chain, &inputs, &outputs, nullptr)) < 0)
+		goto fail;
+	if((ret = avfilter_graph_config(graph, nullptr)) < 0)
+		goto fail;
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+
+	return 0;
+
+	fail:
+
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+	close();
+
+	return ret;
+}
+
+void BenchGraph::close(){
+	avfilter_graph_free(&graph);
+	av_frame_free(&in);
+	av_frame_free(&out);
+	av_buffer_pool_uninit(&pool);
+
+	src = nullptr;
+	sink = nullptr;
+	pts = 0;
+}
+
+int BenchGraph::run(float* samples, int frames, int capacity){
+	int received = 0, ret;
+
+	in -> buf[0] = av_buffer_pool_get(pool);
+
+	if(!in -> buf[0])
+		return AVERROR(ENOMEM);
+	in -> data[0] = in -> buf[0] -> data;
+	in -> extended_data = in -> data;
+	in -> linesize[0] = frames * channels * sizeof(float);
+	in -> format = AV_SAMPLE_FMT_FLT;
+	in -> channels = channels;
+	in -> channel_layout = av_get_default_channel_layout(channels);
+	in -> sample_rate = sample_rate;
+	in -> nb_samples = frames;
+	in -> pts = pts;
+
+	pts += frames;
+
+	memcpy(in -> data[0], samples, (size_t)frames * channels * sizeof(float));
+
+	if((ret = av_buffersrc_add_frame(src, in)) < 0)
+		return ret;
+	while(av_buffersink_get_frame(sink, out) >= 0){
+		int n = out -> nb_samples;
+
+		if(received + n > capacity)
+			n = capacity - received;
+		memcpy(samples + (size_t)received * channels, out -> data[0], (size_t)n * channels * sizeof(float));
+		received += n;
+
+		av_frame_unref(out);
+	}
+
+	return received;
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+#include "../src/ffmpeg.h"
+
+/* a filter chain between an abuffer and an abuffersink, fed 20 ms float frames the way the player's graph is */
+class BenchGraph{
+private:
+	AVFilterGraph* graph;
+	AVFilterContext* src;
+	AVFilterContext* sink;
+	AVBufferPool* pool; /* input frames, like the decoder's */
+	AVFrame* in;
+	AVFrame* out;
+
+	int sample_rate;
+	int channels;
+	int64_t pts;
+public:
+	BenchGraph();
+	~BenchGraph();
+
+	int open(const char* chain, int sample_rate, int channels, int frame_size);
+	void close();
+
+	/* pushes one frame through, output is written to samples, returns the frames received */
+	int run(float* samples, int frames, int capacity);
+};
\ No newline at end of file
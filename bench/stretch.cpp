@@ -0,0 +1,188 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../src/dsp.h"
+#include "bench.h"
+#include "graph.h"
+
+/*
+ * quality and cpu per stream of the native time stretch against asetrate, atempo and the resample back to the output rate
+ * quality is the snr of each 20 ms output window against the best fitting pair of tones at the pitch the rate asks for
+ * usage: build/Release/sange_bench_stretch [packets]
+ */
+enum{
+	/* input tones, apart so splices that smear one into the other show */
+	TONES = 2,
+	/* let the filters settle before judging */
+	SKIP_FRAMES = BENCH_RATE / 5,
+	MAX_OUTPUT = BENCH_FRAME * 4
+};
+
+static const double tones[TONES] = {440, 1250};
+
+struct Setting{
+	float rate;
+	float tempo;
+};
+
+static const Setting settings[] = {{1, 1.25}, {1, 0.8}, {1.25, 1}, {0.8, 1}, {1.1, 1.2}};
+
+static std::vector<float> output; /* first channel, for the quality measure */
+
+static void make_input(float* samples, long packet){
+	for(int i = 0; i < BENCH_FRAME; i++){
+		double t = (double)(packet * BENCH_FRAME + i) / BENCH_RATE, v = 0;
+
+		for(double f : tones)
+			v += 0.25 * sin(2 * M_PI * f * t);
+		for(int ch = 0; ch < BENCH_CHANNELS; ch++)
+			samples[i * BENCH_CHANNELS + ch] = v;
+	}
+}
+
+static void keep(const float* samples, int frames){
+	for(int i = 0; i < frames; i++)
+		output.push_back(samples[i * BENCH_CHANNELS]);
+}
+
+/* least squares fit of a sine and cosine per tone, what is left over is noise */
+static double window_snr(const float* x, int n, double rate){
+	double basis[TONES * 2][BENCH_FRAME], a[TONES * 2][TONES * 2 + 1], signal = 0, residual = 0;
+	int m = TONES * 2;
+
+	for(int k = 0; k < TONES; k++){
+		for(int i = 0; i < n; i++){
+			basis[k * 2][i] = sin(2 * M_PI * tones[k] * rate * i / BENCH_RATE);
+			basis[k * 2 + 1][i] = cos(2 * M_PI * tones[k] * rate * i / BENCH_RATE);
+		}
+	}
+
+	for(int r = 0; r < m; r++){
+		for(int c = 0; c < m; c++){
+			a[r][c] = 0;
+
+			for(int i = 0; i < n; i++)
+				a[r][c] += basis[r][i] * basis[c][i];
+		}
+
+		a[r][m] = 0;
+
+		for(int i = 0; i < n; i++)
+			a[r][m] += basis[r][i] * x[i];
+	}
+
+	for(int p = 0; p < m; p++){
+		for(int r = p + 1; r < m; r++){
+			double f = a[r][p] / a[p][p];
+
+			for(int c = p; c <= m; c++)
+				a[r][c] -= f * a[p][c];
+		}
+	}
+
+	for(int p = m - 1; p >= 0; p--){
+		for(int c = p + 1; c < m; c++)
+			a[p][m] -= a[p][c] * a[c][m];
+		a[p][m] /= a[p][p];
+	}
+
+	for(int i = 0; i < n; i++){
+		double fit = 0;
+
+		for(int k = 0; k < m; k++)
+			fit += a[k][m] * basis[k][i];
+		signal += fit * fit;
+		residual += (x[i] - fit) * (x[i] - fit);
+	}
+
+	return 10 * log10(signal / (residual + 1e-20));
+}
+
+static double quality(double rate){
+	double total = 0;
+	int windows = 0;
+
+	for(size_t i = SKIP_FRAMES; i + BENCH_FRAME <= output.size(); i += BENCH_FRAME){
+		total += window_snr(&output[i], BENCH_FRAME, rate);
+		windows++;
+	}
+
+	return windows ? total / windows : 0;
+}
+
+static void report(const char* what, const Setting& setting, uint64_t ns, long packets){
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s rate %.2f tempo %.2f", what, setting.rate, setting.tempo);
+	bench_report(name, ns, packets);
+	printf("%-40s %10.1f db snr\n", "", quality(setting.rate));
+}
+
+static void bench_native(const Setting& setting, long packets){
+	TimeStretch stretch;
+	float input[BENCH_FRAME * BENCH_CHANNELS], out[BENCH_FRAME * BENCH_CHANNELS];
+	uint64_t ns = 0, start;
+
+	output.clear();
+
+	for(long i = 0; i < packets; i++){
+		make_input(input, i);
+		start = bench_cpu();
+
+		if(stretch.write(input, BENCH_FRAME, BENCH_CHANNELS, BENCH_RATE, setting.rate, setting.tempo) < 0)
+			return;
+		while(stretch.available() >= BENCH_FRAME){
+			stretch.read(out, BENCH_FRAME);
+			ns += bench_cpu() - start;
+			keep(out, BENCH_FRAME);
+			start = bench_cpu();
+		}
+
+		ns += bench_cpu() - start;
+	}
+
+	report("native", setting, ns, packets);
+}
+
+static void bench_filter(const Setting& setting, long packets){
+	BenchGraph graph;
+	float samples[MAX_OUTPUT * BENCH_CHANNELS];
+	uint64_t ns = 0, start;
+	char chain[128];
+	int frames;
+
+	snprintf(chain, sizeof(chain), "asetrate=%d,atempo=%f,aresample=%d", (int)(setting.rate * BENCH_RATE), setting.tempo, BENCH_RATE);
+
+	if(graph.open(chain, BENCH_RATE, BENCH_CHANNELS, BENCH_FRAME) < 0){
+		printf("%s: could not open the filters\n", chain);
+
+		return;
+	}
+
+	output.clear();
+
+	for(long i = 0; i < packets; i++){
+		make_input(samples, i);
+		start = bench_cpu();
+		frames = graph.run(samples, BENCH_FRAME, MAX_OUTPUT);
+		ns += bench_cpu() - start;
+
+		if(frames < 0)
+			return;
+		keep(samples, frames);
+	}
+
+	report("filters", setting, ns, packets);
+}
+
+int main(int argc, char** argv){
+	long packets = argc > 1 ? atol(argv[1]) : 1000;
+
+	for(const Setting& setting : settings){
+		bench_native(setting, packets);
+		bench_filter(setting, packets);
+	}
+
+	return 0;
+}
\ No newline at end of file
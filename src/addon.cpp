@@ -1,10 +1,15 @@
 #include <napi.h>
+#include <sodium/core.h>
 #include "wrapper.h"
 #include "ffmpeg.h"
 
 Napi::Object init(Napi::Env env, Napi::Object exports){
 	avformat_network_init();
 
+	/* detects cpu features, e.g. aes-ni for aes256-gcm */
+	if(sodium_init() < 0)
+		throw Napi::Error::New(env, "Could not initialize libsodium");
+
 #ifdef SANGE_DEBUG
 	av_log_set_level(AV_LOG_TRACE);
 #else
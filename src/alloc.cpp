@@ -0,0 +1,42 @@
+#include <dlfcn.h>
+#include "alloc.h"
+
+#ifdef SANGE_DEBUG
+typedef void (*track_func)(bool track);
+typedef void (*stats_func)(ulong* allocs, ulong* bytes, ulong* libav, bool* split);
+
+static track_func hook_track(){
+	static track_func func = (track_func)dlsym(RTLD_DEFAULT, "sange_alloc_track");
+
+	return func;
+}
+
+static stats_func hook_stats(){
+	static stats_func func = (stats_func)dlsym(RTLD_DEFAULT, "sange_alloc_stats");
+
+	return func;
+}
+
+void AllocCounter::track_thread(){
+	track_func track = hook_track();
+
+	if(track)
+		track(true);
+}
+
+bool AllocCounter::get_stats(AllocStats& stats){
+	stats_func get = hook_stats();
+
+	if(!get)
+		return false;
+	get(&stats.allocations, &stats.bytes, &stats.libav, &stats.split);
+
+	return true;
+}
+#else
+void AllocCounter::track_thread(){}
+
+bool AllocCounter::get_stats(AllocStats&){
+	return false;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+#include <sys/types.h>
+
+struct AllocStats{
+	ulong allocations;
+	ulong bytes;
+
+	/* of the allocations, the ones libav's own code made, directly or through libavutil */
+	ulong libav;
+	bool split; /* false when libavutil is not a shared library and cannot be told apart */
+};
+
+/* heap allocations on the player threads, counted when a debug build runs with the allocation hook preloaded */
+class AllocCounter{
+public:
+	/* count the calling thread's allocations */
+	static void track_thread();
+
+	/* false when the hook is not loaded */
+	static bool get_stats(AllocStats& stats);
+};
\ No newline at end of file
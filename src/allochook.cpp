@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <link.h>
+#include <execinfo.h>
+#include <atomic>
+#include <sys/types.h>
+
+/*
+ * preloaded into debug runs by test/allocations.js, the addon itself is loaded too late to see libav's allocations
+ * counts heap allocations made on threads that opted in through sange_alloc_track
+ * an allocation made through libavutil (av_malloc, av_buffer_alloc, av_packet_alloc...) belongs to whoever called into libavutil,
+ * allocations coming from libav's own code (demuxers, decoders, filters) are counted apart, anything else is sange's
+ */
+extern "C"{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t n, size_t size);
+	void* __libc_realloc(void* ptr, size_t size);
+	void* __libc_memalign(size_t align, size_t size);
+}
+
+enum{
+	MAX_RANGES = 32,
+	MAX_FRAMES = 32
+};
+
+struct CodeRange{
+	uintptr_t start;
+	uintptr_t end;
+
+	bool avutil;
+};
+
+static __thread bool tracked __attribute__((tls_model("initial-exec"))) = false;
+static __thread bool walking __attribute__((tls_model("initial-exec"))) = false;
+
+static std::atomic<ulong> allocations(0);
+static std::atomic<ulong> bytes(0);
+static std::atomic<ulong> libav(0);
+
+/* the code of every libav and libsw library, found when the first thread is tracked */
+static CodeRange ranges[MAX_RANGES];
+static std::atomic<int> range_count(0);
+static std::atomic<bool> avutil_found(false);
+
+static int find_libav(dl_phdr_info* info, size_t, void* data){
+	const char* name = info -> dlpi_name ? strrchr(info -> dlpi_name, '/') : nullptr;
+	int& found = *(int*)data;
+
+	name = name ? name + 1 : info -> dlpi_name;
+
+	if(!name || (strncmp(name, "libav", 5) && strncmp(name, "libsw", 5)))
+		return 0;
+	for(int i = 0; i < info -> dlpi_phnum && found < MAX_RANGES; i++){
+		const ElfW(Phdr)& phdr = info -> dlpi_phdr[i];
+
+		if(phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X))
+			continue;
+		CodeRange& range = ranges[found++];
+
+		range.start = info -> dlpi_addr + phdr.p_vaddr;
+		range.end = range.start + phdr.p_memsz;
+		range.avutil = !strncmp(name, "libavutil", 9);
+
+		if(range.avutil)
+			avutil_found = true;
+	}
+
+	return 0;
+}
+
+static const CodeRange* find_range(uintptr_t addr){
+	int count = range_count.load(std::memory_order_acquire);
+
+	for(int i = 0; i < count; i++)
+		if(addr >= ranges[i].start && addr < ranges[i].end)
+			return &ranges[i];
+	return nullptr;
+}
+
+/* true when the allocation came from libav's own code rather than from a call sange made into libavutil */
+static bool from_libav(uintptr_t caller){
+	const CodeRange* range = find_range(caller);
+	void* frames[MAX_FRAMES];
+	int depth, i = 0;
+
+	if(!range || !range -> avutil)
+		return range != nullptr;
+	/* called through libavutil, look at the frame that called into it */
+	walking = true;
+	depth = backtrace(frames, MAX_FRAMES);
+	walking = false;
+
+	/* skip the hook's own frames, then libavutil's */
+	while(i < depth && (!(range = find_range((uintptr_t)frames[i])) || !range -> avutil))
+		i++;
+	while(i < depth && (range = find_range((uintptr_t)frames[i])) && range -> avutil)
+		i++;
+	/* the stack could not be followed past libavutil, count it as sange's rather than hide it */
+	if(i == depth)
+		return false;
+	return range != nullptr;
+}
+
+static void count(size_t size, void* caller){
+	if(!tracked || walking)
+		return;
+	allocations++;
+	bytes += size;
+
+	if(from_libav((uintptr_t)caller))
+		libav++;
+}
+
+static void* aligned(size_t align, size_t size, void* caller){
+	count(size, caller);
+
+	return __libc_memalign(align, size);
+}
+
+extern "C"{
+	void sange_alloc_track(bool track){
+		if(track && !range_count){
+			static std::atomic<bool> searching(false);
+			void* frame;
+			int found = 0;
+
+			if(!searching.exchange(true)){
+				dl_iterate_phdr(find_libav, &found);
+				range_count.store(found, std::memory_order_release);
+			}
+
+			/* the first backtrace loads the unwinder, which allocates */
+			backtrace(&frame, 1);
+		}
+
+		tracked = track;
+	}
+
+	void sange_alloc_stats(ulong* allocs, ulong* total, ulong* from_libav, bool* split){
+		*allocs = allocations;
+		*total = bytes;
+		*from_libav = libav;
+		*split = avutil_found;
+	}
+
+	void* malloc(size_t size){
+		count(size, __builtin_return_address(0));
+
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t n, size_t size){
+		count(n * size, __builtin_return_address(0));
+
+		return __libc_calloc(n, size);
+	}
+
+	void* realloc(void* ptr, size_t size){
+		count(size, __builtin_return_address(0));
+
+		return __libc_realloc(ptr, size);
+	}
+
+	void* memalign(size_t align, size_t size){
+		return aligned(align, size, __builtin_return_address(0));
+	}
+
+	void* aligned_alloc(size_t align, size_t size){
+		return aligned(align, size, __builtin_return_address(0));
+	}
+
+	int posix_memalign(void** ptr, size_t align, size_t size){
+		void* mem;
+
+		if(!align || (align & (align - 1)) || align % sizeof(void*))
+			return EINVAL;
+		/* av_malloc lands here */
+		mem = aligned(align, size, __builtin_return_address(0));
+
+		if(!mem)
+			return ENOMEM;
+		*ptr = mem;
+
+		return 0;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,805 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sodium/crypto_generichash.h>
+#include "cache.h"
+
+enum{
+	CACHE_VERSION = 1,
+	KEY_BYTES = 16
+};
+
+static const char CACHE_MAGIC[4] = {'S', 'N', 'G', 'C'};
+static const char CACHE_SUFFIX[] = ".sange";
+
+CacheReader::CacheReader(){
+	data = nullptr;
+	size = 0;
+	ref = nullptr;
+	header = nullptr;
+	index = nullptr;
+	packet = 0;
+}
+
+CacheReader::~CacheReader(){
+	close();
+}
+
+int CacheReader::validate(const CacheFormat& format){
+	header = (const CacheHeader*)data;
+
+	if(size < sizeof(CacheHeader))
+		goto invalid;
+	if(memcmp(header -> magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || header -> version != CACHE_VERSION)
+		goto invalid;
+	if(header -> channels != (uint32_t)format.channels || header -> sample_rate != (uint32_t)format.sample_rate ||
+		header -> bitrate != (uint32_t)format.bitrate || header -> frame_size != (uint32_t)format.frame_size)
+		goto invalid;
+	/* a zero offset means the writer never finished */
+	if(header -> index_offset < sizeof(CacheHeader) || header -> index_offset > size || header -> index_offset % alignof(CacheIndexEntry))
+		goto invalid;
+	if(header -> packets > (size - header -> index_offset) / sizeof(CacheIndexEntry))
+		goto invalid;
+	index = (const CacheIndexEntry*)(data + header -> index_offset);
+	packet = 0;
+
+	return 0;
+
+	invalid:
+
+	close();
+
+	return AVERROR_INVALIDDATA;
+}
+
+int CacheReader::open(const std::string& path, const CacheFormat& format){
+	struct stat st;
+	void* map;
+	int fd, err;
+
+	close();
+
+	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		return AVERROR(errno);
+	if(fstat(fd, &st) < 0){
+		::close(fd);
+
+		return AVERROR(errno);
+	}
+
+	if(st.st_size < (off_t)sizeof(CacheHeader)){
+		::close(fd);
+
+		return AVERROR_INVALIDDATA;
+	}
+
+	map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	::close(fd);
+
+	if(map == MAP_FAILED)
+		return AVERROR(errno);
+	data = (uint8_t*)map;
+	size = st.st_size;
+
+	if((err = validate(format)) < 0)
+		return err;
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+int CacheReader::open(AVBufferRef* buffer, const CacheFormat& format){
+	close();
+
+	ref = av_buffer_ref(buffer);
+
+	if(!ref)
+		return AVERROR(ENOMEM);
+	data = ref -> data;
+	size = ref -> size;
+
+	return validate(format);
+}
+
+void CacheReader::close(){
+	if(ref)
+		av_buffer_unref(&ref);
+	else if(data)
+		munmap(data, size);
+	data = nullptr;
+	size = 0;
+	header = nullptr;
+	index = nullptr;
+	packet = 0;
+}
+
+bool CacheReader::is_open(){
+	return data != nullptr;
+}
+
+int CacheReader::read(AVPacket* pkt, BufferPool* pool, uint64_t& sample){
+	CacheRecord record;
+	uint64_t offset;
+
+	if(packet >= header -> packets)
+		return AVERROR_EOF;
+	offset = index[packet].offset;
+
+	if(offset < sizeof(CacheHeader) || offset > header -> index_offset - sizeof(CacheRecord))
+		return AVERROR_INVALIDDATA;
+	memcpy(&record, data + offset, sizeof(record));
+
+	offset += sizeof(record);
+
+	if(record.size > header -> index_offset - offset)
+		return AVERROR_INVALIDDATA;
+	av_packet_unref(pkt);
+
+	if(record.size + AV_INPUT_BUFFER_PADDING_SIZE <= pool -> get_size())
+		pkt -> buf = pool -> get();
+	if(!pkt -> buf){
+		pkt -> buf = av_buffer_alloc(record.size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+		if(!pkt -> buf)
+			return AVERROR(ENOMEM);
+	}
+
+	pkt -> data = pkt -> buf -> data;
+	pkt -> size = record.size;
+	pkt -> duration = record.duration;
+	pkt -> pts = index[packet].sample;
+	pkt -> dts = pkt -> pts;
+
+	memcpy(pkt -> data, data + offset, record.size);
+	memset(pkt -> data + record.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+	sample = index[packet].sample;
+	packet++;
+
+	return 0;
+}
+
+void CacheReader::seek(uint64_t sample){
+	const CacheIndexEntry* end = index + header -> packets;
+	const CacheIndexEntry* it = std::upper_bound(index, end, sample, [](uint64_t sample, const CacheIndexEntry& entry){
+		return sample < entry.sample;
+	});
+
+	/* the packet containing the sample */
+	packet = it == index ? 0 : it - index - 1;
+}
+
+uint64_t CacheReader::get_samples(){
+	return header -> samples;
+}
+
+CacheWriter::CacheWriter(){
+	file = nullptr;
+	image = nullptr;
+	recording = false;
+	offset = 0;
+	limit = 0;
+}
+
+CacheWriter::~CacheWriter(){
+	abort();
+}
+
+bool CacheWriter::is_open(){
+	return recording;
+}
+
+int CacheWriter::append(const void* data, size_t size){
+	if(file)
+		return fwrite(data, 1, size, file) == size ? 0 : AVERROR(EIO);
+	if(!image || offset + size > image -> size){
+		size_t capacity = image ? image -> size * 2 : 64 * 1024;
+
+		if(capacity < offset + size)
+			capacity = offset + size;
+		if(av_buffer_realloc(&image, capacity) < 0)
+			return AVERROR(ENOMEM);
+	}
+
+	memcpy(image -> data + offset, data, size);
+
+	return 0;
+}
+
+int CacheWriter::write(AVPacket* packet){
+	CacheRecord record;
+	CacheIndexEntry entry;
+	int err;
+
+	record.size = packet -> size;
+	record.duration = packet -> duration > 0 ? packet -> duration : 0;
+
+	if(limit && offset + sizeof(record) + record.size + (index.size() + 1) * sizeof(entry) > limit)
+		return AVERROR(ENOSPC);
+	entry.sample = header.samples;
+	entry.offset = offset;
+
+	try{
+		index.push_back(entry);
+	}catch(std::bad_alloc& e){
+		return AVERROR(ENOMEM);
+	}
+
+	if((err = append(&record, sizeof(record))) < 0)
+		return err;
+	offset += sizeof(record);
+
+	if((err = append(packet -> data, record.size)) < 0)
+		return err;
+	offset += record.size;
+	header.samples += record.duration;
+	header.packets++;
+
+	return 0;
+}
+
+void CacheWriter::abort(){
+	if(!recording)
+		return;
+	if(file){
+		fclose(file);
+		unlink(path.c_str());
+	}
+
+	av_buffer_unref(&image);
+
+	file = nullptr;
+	recording = false;
+	index.clear();
+	index.shrink_to_fit();
+}
+
+PacketCache::PacketCache(){
+	max_size = 0;
+	disk_size = 0;
+	memory_size = 0;
+	memory_limit = 0;
+	hits = 0;
+	disk_hits = 0;
+	misses = 0;
+}
+
+PacketCache::~PacketCache(){
+	for(MemoryEntry& entry : lru)
+		av_buffer_unref(&entry.image);
+}
+
+std::string PacketCache::get_path(const std::string& key){
+	return dir + "/" + key + CACHE_SUFFIX;
+}
+
+int PacketCache::configure(const std::string& d, size_t max){
+	int err = 0;
+
+	if(!d.empty() && mkdir(d.c_str(), 0755) < 0 && errno != EEXIST)
+		return AVERROR(errno);
+	mutex.lock();
+
+	try{
+		disk_lru.clear();
+		disk.clear();
+		disk_size = 0;
+		dir = d;
+		max_size = max;
+
+		if(!dir.empty()){
+			scan();
+			evict();
+		}
+	}catch(std::bad_alloc& e){
+		err = AVERROR(ENOMEM);
+	}
+
+	mutex.unlock();
+
+	return err;
+}
+
+void PacketCache::set_memory_limit(size_t limit){
+	mutex.lock();
+	memory_limit = limit;
+	evict_memory();
+	mutex.unlock();
+}
+
+bool PacketCache::is_enabled(){
+	bool enabled;
+
+	mutex.lock();
+	enabled = !dir.empty() || memory_limit;
+	mutex.unlock();
+
+	return enabled;
+}
+
+PacketCacheStats PacketCache::get_stats(){
+	PacketCacheStats stats;
+
+	mutex.lock();
+	stats.memory_size = memory_size;
+	stats.memory_limit = memory_limit;
+	stats.hits = hits;
+	stats.disk_hits = disk_hits;
+	stats.misses = misses;
+
+	try{
+		for(MemoryEntry& entry : lru)
+			stats.entries.push_back({entry.key, (size_t)entry.image -> size, av_buffer_get_ref_count(entry.image) - 1});
+	}catch(...){
+		mutex.unlock();
+
+		throw;
+	}
+
+	mutex.unlock();
+
+	return stats;
+}
+
+std::string PacketCache::make_key(const std::string& source, const CacheFormat& format){
+	static const char hex[] = "0123456789abcdef";
+
+	crypto_generichash_state state;
+	uint8_t hash[KEY_BYTES];
+	std::string key;
+
+	crypto_generichash_init(&state, nullptr, 0, sizeof(hash));
+	crypto_generichash_update(&state, (const uint8_t*)source.data(), source.size());
+	crypto_generichash_update(&state, (const uint8_t*)&format, sizeof(format));
+	crypto_generichash_final(&state, hash, sizeof(hash));
+
+	for(uint8_t byte : hash){
+		key += hex[byte >> 4];
+		key += hex[byte & 0xf];
+	}
+
+	return key;
+}
+
+AVBufferRef* PacketCache::load(const std::string& path, size_t limit){
+	AVBufferRef* buffer = nullptr;
+	struct stat st;
+	size_t done = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		return nullptr;
+	if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(CacheHeader) || (size_t)st.st_size > limit)
+		goto end;
+	buffer = av_buffer_alloc(st.st_size);
+
+	if(!buffer)
+		goto end;
+	while(done < (size_t)st.st_size){
+		ret = read(fd, buffer -> data + done, st.st_size - done);
+
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0){
+			av_buffer_unref(&buffer);
+
+			break;
+		}
+
+		done += ret;
+	}
+
+	end:
+
+	close(fd);
+
+	return buffer;
+}
+
+void PacketCache::insert_memory(const std::string& key, AVBufferRef* image){
+	bool inserted = false;
+
+	if((size_t)image -> size > memory_limit || memory.count(key)){
+		av_buffer_unref(&image);
+
+		return;
+	}
+
+	try{
+		lru.push_front({key, image});
+		inserted = true;
+		memory[key] = lru.begin();
+	}catch(std::bad_alloc& e){
+		if(inserted)
+			lru.pop_front();
+		av_buffer_unref(&image);
+
+		return;
+	}
+
+	memory_size += image -> size;
+	evict_memory();
+}
+
+void PacketCache::evict_memory(){
+	auto it = lru.end();
+
+	while(memory_size > memory_limit && it != lru.begin()){
+		--it;
+
+		/* pinned by a player, stays until it is released */
+		if(av_buffer_get_ref_count(it -> image) > 1)
+			continue;
+		memory_size -= it -> image -> size;
+		memory.erase(it -> key);
+		av_buffer_unref(&it -> image);
+		it = lru.erase(it);
+	}
+}
+
+int PacketCache::lookup(const std::string& key, const CacheFormat& format, CacheReader& reader){
+	AVBufferRef* image = nullptr;
+	std::string path;
+	size_t limit;
+	int err;
+
+	mutex.lock();
+
+	limit = memory_limit;
+
+	auto it = memory.find(key);
+
+	if(it != memory.end()){
+		lru.splice(lru.begin(), lru, it -> second);
+		image = av_buffer_ref(it -> second -> image);
+		hits++;
+	}else{
+		try{
+			if(!dir.empty())
+				path = get_path(key);
+		}catch(std::bad_alloc& e){}
+
+		if(path.empty())
+			misses++;
+	}
+
+	mutex.unlock();
+
+	if(image){
+		/* shared with every other player of this track */
+		err = reader.open(image, format);
+		av_buffer_unref(&image);
+
+		return err;
+	}
+
+	if(path.empty())
+		return AVERROR(ENOENT);
+	image = limit ? load(path, limit) : nullptr;
+
+	if(image && !reader.open(image, format)){
+		/* hot enough to be played again, keep it in memory */
+		mutex.lock();
+		insert_memory(key, image);
+		disk_hits++;
+		mutex.unlock();
+
+		err = 0;
+	}else{
+		av_buffer_unref(&image);
+
+		err = reader.open(path, format);
+
+		mutex.lock();
+
+		if(err)
+			misses++;
+		else
+			disk_hits++;
+		mutex.unlock();
+	}
+
+	if(!err){
+		/* mtime is the lru clock across restarts */
+		utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+		mutex.lock();
+
+		try{
+			touch_disk(key, path);
+		}catch(std::bad_alloc& e){}
+
+		mutex.unlock();
+	}
+
+	return err;
+}
+
+int PacketCache::begin(const std::string& key, const CacheFormat& format, CacheWriter& writer){
+	std::vector<char> name;
+	int fd, err = 0;
+
+	abort(writer);
+	mutex.lock();
+
+	try{
+		if((dir.empty() && !memory_limit) || writing.count(key))
+			/* disabled, or another player is already recording it */
+			err = AVERROR(EBUSY);
+		else{
+			if(!dir.empty()){
+				std::string tmp = dir + "/." + key + ".XXXXXX";
+
+				name.assign(tmp.begin(), tmp.end());
+				name.push_back(0);
+			}
+
+			writer.key = key;
+			writer.path.clear();
+			writer.limit = dir.empty() ? memory_limit : max_size;
+			writing.insert(key);
+		}
+	}catch(std::bad_alloc& e){
+		err = AVERROR(ENOMEM);
+	}
+
+	mutex.unlock();
+
+	if(err)
+		return err;
+	if(!name.empty()){
+		/* every writer has its own file, the finished one is renamed into place */
+		fd = mkstemp(name.data());
+
+		if(fd < 0){
+			err = AVERROR(errno);
+
+			goto fail;
+		}
+
+		writer.file = fdopen(fd, "wb");
+
+		if(!writer.file){
+			err = AVERROR(errno);
+			close(fd);
+			unlink(name.data());
+
+			goto fail;
+		}
+
+		try{
+			writer.path = name.data();
+		}catch(std::bad_alloc& e){
+			err = AVERROR(ENOMEM);
+			fclose(writer.file);
+			unlink(name.data());
+			writer.file = nullptr;
+
+			goto fail;
+		}
+	}
+
+	memset(&writer.header, 0, sizeof(writer.header));
+	memcpy(writer.header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+
+	writer.header.version = CACHE_VERSION;
+	writer.header.channels = format.channels;
+	writer.header.sample_rate = format.sample_rate;
+	writer.header.bitrate = format.bitrate;
+	writer.header.frame_size = format.frame_size;
+	writer.recording = true;
+	writer.offset = 0;
+	writer.index.clear();
+
+	/* placeholder until commit */
+	if(writer.append(&writer.header, sizeof(writer.header)) < 0){
+		abort(writer);
+
+		return AVERROR(EIO);
+	}
+
+	writer.offset = sizeof(CacheHeader);
+
+	return 0;
+
+	fail:
+
+	mutex.lock();
+	writing.erase(key);
+	mutex.unlock();
+
+	return err;
+}
+
+int PacketCache::commit(CacheWriter& writer){
+	static const uint8_t padding[alignof(CacheIndexEntry)] = {0};
+
+	size_t pad, size;
+	int err = 0;
+
+	if(!writer.is_open())
+		return AVERROR(EINVAL);
+	pad = (alignof(CacheIndexEntry) - writer.offset % alignof(CacheIndexEntry)) % alignof(CacheIndexEntry);
+	size = writer.offset + pad + writer.index.size() * sizeof(CacheIndexEntry);
+
+	writer.header.index_offset = writer.offset + pad;
+
+	if(writer.append(padding, pad) < 0)
+		goto fail;
+	writer.offset += pad;
+
+	if(writer.append(writer.index.data(), writer.index.size() * sizeof(CacheIndexEntry)) < 0)
+		goto fail;
+	if(writer.file){
+		if(fseek(writer.file, 0, SEEK_SET) || fwrite(&writer.header, sizeof(writer.header), 1, writer.file) != 1 || fflush(writer.file))
+			goto fail;
+		fclose(writer.file);
+
+		writer.file = nullptr;
+	}else{
+		memcpy(writer.image -> data, &writer.header, sizeof(writer.header));
+
+		if(av_buffer_realloc(&writer.image, size) < 0)
+			goto fail;
+	}
+
+	writer.recording = false;
+	writer.index.clear();
+	writer.index.shrink_to_fit();
+
+	mutex.lock();
+
+	if(writer.image){
+		insert_memory(writer.key, writer.image);
+
+		writer.image = nullptr;
+	}else{
+		try{
+			if(dir.empty() || rename(writer.path.c_str(), get_path(writer.key).c_str()) < 0){
+				err = AVERROR(errno);
+				unlink(writer.path.c_str());
+			}else{
+				index_disk(writer.key, size);
+				evict();
+			}
+		}catch(std::bad_alloc& e){
+			err = AVERROR(ENOMEM);
+			unlink(writer.path.c_str());
+		}
+	}
+
+	writing.erase(writer.key);
+	mutex.unlock();
+
+	return err;
+
+	fail:
+
+	abort(writer);
+
+	return AVERROR(EIO);
+}
+
+void PacketCache::abort(CacheWriter& writer){
+	if(!writer.is_open())
+		return;
+	writer.abort();
+
+	mutex.lock();
+	writing.erase(writer.key);
+	mutex.unlock();
+}
+
+void PacketCache::scan(){
+	struct File{
+		std::string key;
+		time_t mtime;
+		off_t size;
+	};
+
+	std::vector<File> files;
+	struct stat st;
+	dirent* ent;
+	DIR* d;
+
+	size_t suffix = sizeof(CACHE_SUFFIX) - 1;
+	time_t now = time(nullptr);
+
+	d = opendir(dir.c_str());
+
+	if(!d)
+		return;
+	while((ent = readdir(d))){
+		std::string name = ent -> d_name;
+
+		if(name == "." || name == "..")
+			continue;
+		std::string path = dir + "/" + name;
+
+		if(stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+		if(name[0] == '.'){
+			/* temporary file of a writer that never finished */
+			if(now - st.st_mtime > STALE_TEMP)
+				unlink(path.c_str());
+			continue;
+		}
+
+		if(name.size() <= suffix || name.compare(name.size() - suffix, suffix, CACHE_SUFFIX))
+			continue;
+		try{
+			files.push_back({name.substr(0, name.size() - suffix), st.st_mtime, st.st_size});
+		}catch(std::bad_alloc& e){
+			closedir(d);
+
+			throw;
+		}
+	}
+
+	closedir(d);
+
+	std::sort(files.begin(), files.end(), [](const File& a, const File& b){
+		return a.mtime < b.mtime;
+	});
+
+	/* the newest ends up in front */
+	for(File& file : files)
+		index_disk(file.key, file.size);
+}
+
+void PacketCache::index_disk(const std::string& key, size_t size){
+	auto it = disk.find(key);
+
+	if(it != disk.end()){
+		disk_size -= it -> second -> size;
+		it -> second -> size = size;
+		disk_lru.splice(disk_lru.begin(), disk_lru, it -> second);
+	}else{
+		disk_lru.push_front({key, size});
+
+		try{
+			disk[key] = disk_lru.begin();
+		}catch(std::bad_alloc& e){
+			disk_lru.pop_front();
+
+			throw;
+		}
+	}
+
+	disk_size += size;
+}
+
+void PacketCache::touch_disk(const std::string& key, const std::string& path){
+	struct stat st;
+
+	auto it = disk.find(key);
+
+	if(it != disk.end())
+		disk_lru.splice(disk_lru.begin(), disk_lru, it -> second);
+	else if(!stat(path.c_str(), &st))
+		/* written by another process sharing the directory */
+		index_disk(key, st.st_size);
+}
+
+void PacketCache::evict(){
+	/* least recently used first, readers keep their mapping after the unlink */
+	while(max_size && disk_size > max_size && !disk_lru.empty()){
+		DiskEntry& entry = disk_lru.back();
+
+		unlink(get_path(entry.key).c_str());
+		disk_size -= entry.size;
+		disk.erase(entry.key);
+		disk_lru.pop_back();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,186 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <list>
+#include <unordered_map>
+#include <sys/types.h>
+#include "ffmpeg.h"
+#include "thread.h"
+#include "pool.h"
+
+/*
+ * cache file layout, native byte order:
+ * header, then one record (size, duration, data) per packet, then the seek index
+ * the header is written last, so a file with a zero index offset is incomplete
+ */
+struct CacheHeader{
+	char magic[4];
+	uint32_t version;
+	uint32_t channels;
+	uint32_t sample_rate;
+	uint32_t bitrate;
+	uint32_t frame_size; /* samples per encoded frame, the source's own packets keep theirs */
+	uint64_t packets;
+	uint64_t samples;
+	uint64_t index_offset;
+};
+
+struct CacheRecord{
+	uint32_t size;
+	uint32_t duration;
+};
+
+struct CacheIndexEntry{
+	uint64_t sample;
+	uint64_t offset;
+};
+
+struct CacheFormat{
+	int channels;
+	int sample_rate;
+	int bitrate;
+	int frame_size;
+};
+
+/* plays back a complete cache file from an mmap or a shared in-memory copy */
+class CacheReader{
+private:
+	uint8_t* data;
+	size_t size;
+
+	AVBufferRef* ref; /* set when reading from memory */
+
+	const CacheHeader* header;
+	const CacheIndexEntry* index;
+
+	uint64_t packet;
+
+	int validate(const CacheFormat& format);
+public:
+	CacheReader();
+	~CacheReader();
+
+	int open(const std::string& path, const CacheFormat& format);
+	int open(AVBufferRef* buffer, const CacheFormat& format);
+	void close();
+	bool is_open();
+
+	int read(AVPacket* packet, BufferPool* pool, uint64_t& sample);
+	void seek(uint64_t sample);
+
+	uint64_t get_samples();
+};
+
+/* records packets into a private temporary file, or memory without a cache directory, until committed */
+class CacheWriter{
+private:
+	FILE* file;
+
+	AVBufferRef* image;
+	bool recording;
+
+	std::string key;
+	std::string path;
+
+	CacheHeader header;
+	std::vector<CacheIndexEntry> index;
+
+	uint64_t offset;
+	size_t limit;
+
+	int append(const void* data, size_t size);
+
+	friend class PacketCache;
+public:
+	CacheWriter();
+	~CacheWriter();
+
+	bool is_open();
+
+	int write(AVPacket* packet);
+	void abort();
+};
+
+struct MemoryCacheEntry{
+	std::string key;
+	size_t size;
+	int pins; /* players currently reading it */
+};
+
+struct PacketCacheStats{
+	size_t memory_size;
+	size_t memory_limit;
+	ulong hits; /* served from memory */
+	ulong disk_hits;
+	ulong misses;
+
+	std::vector<MemoryCacheEntry> entries; /* most recently used first */
+};
+
+class PacketCache{
+private:
+	enum{
+		/* temporary files left behind by a crash are removed after this many seconds */
+		STALE_TEMP = 3600
+	};
+
+	struct MemoryEntry{
+		std::string key;
+		AVBufferRef* image; /* immutable, every reader holds a ref */
+	};
+
+	struct DiskEntry{
+		std::string key;
+		size_t size;
+	};
+
+	Mutex mutex;
+
+	std::string dir;
+	size_t max_size;
+
+	/* keys being recorded by a player in this process */
+	std::set<std::string> writing;
+
+	/* memory tier, front is the most recently used */
+	std::list<MemoryEntry> lru;
+	std::unordered_map<std::string, std::list<MemoryEntry>::iterator> memory;
+	size_t memory_size;
+	size_t memory_limit;
+
+	/* disk tier, front is the most recently used, read from the directory once when configured */
+	std::list<DiskEntry> disk_lru;
+	std::unordered_map<std::string, std::list<DiskEntry>::iterator> disk;
+	size_t disk_size;
+
+	ulong hits;
+	ulong disk_hits;
+	ulong misses;
+
+	std::string get_path(const std::string& key);
+	void scan();
+	void index_disk(const std::string& key, size_t size);
+	void touch_disk(const std::string& key, const std::string& path);
+	void evict();
+	void evict_memory();
+	void insert_memory(const std::string& key, AVBufferRef* image);
+	AVBufferRef* load(const std::string& path, size_t limit);
+public:
+	PacketCache();
+	~PacketCache();
+
+	int configure(const std::string& dir, size_t max_size);
+	void set_memory_limit(size_t limit);
+	bool is_enabled();
+	PacketCacheStats get_stats();
+
+	static std::string make_key(const std::string& source, const CacheFormat& format);
+
+	int lookup(const std::string& key, const CacheFormat& format, CacheReader& reader);
+	int begin(const std::string& key, const CacheFormat& format, CacheWriter& writer);
+	int commit(CacheWriter& writer);
+	void abort(CacheWriter& writer);
+};
\ No newline at end of file
@@ -0,0 +1,920 @@
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <opus/opus.h>
+#include "demuxer.h"
+
+enum{
+	EBML_ID_HEADER = 0x1A45DFA3,
+	EBML_ID_SEGMENT = 0x18538067,
+	EBML_ID_TRACKS = 0x1654AE6B,
+	EBML_ID_TRACK_ENTRY = 0xAE,
+	EBML_ID_TRACK_NUMBER = 0xD7,
+	EBML_ID_TRACK_TIMECODE_SCALE = 0x23314F,
+	EBML_ID_CODEC_ID = 0x86,
+	EBML_ID_CODEC_DELAY = 0x56AA,
+	EBML_ID_CONTENT_ENCODINGS = 0x6D80,
+	EBML_ID_CLUSTER = 0x1F43B675,
+	EBML_ID_TIMECODE = 0xE7,
+	EBML_ID_BLOCK_GROUP = 0xA0,
+	EBML_ID_BLOCK = 0xA1,
+	EBML_ID_DISCARD_PADDING = 0x75A2,
+	EBML_ID_SIMPLE_BLOCK = 0xA3
+};
+
+enum{
+	OGG_CAPTURE = 0x4F676753, /* "OggS" */
+	OGG_CONTINUED = 0x01,
+	OGG_BOS = 0x02,
+	OGG_EOS = 0x04
+};
+
+enum{
+	LACING_NONE,
+	LACING_XIPH,
+	LACING_FIXED,
+	LACING_EBML
+};
+
+/* float 1.0 as stored in 4 and 8 bytes */
+static const int64_t FLOAT_ONE = 0x3F800000;
+static const int64_t DOUBLE_ONE = 0x3FF0000000000000;
+
+/* a size from inside a block, unknown sizes are not allowed there */
+static int read_vint(const uint8_t*& data, int& size, int64_t& value){
+	int length;
+
+	if(size < 1)
+		return AVERROR_INVALIDDATA;
+	for(length = 1; length <= 8 && !(data[0] & (0x100 >> length)); length++);
+
+	if(length > 8 || length > size)
+		return AVERROR_INVALIDDATA;
+	value = data[0] & (0xFF >> length);
+
+	for(int i = 1; i < length; i++)
+		value = value << 8 | data[i];
+	data += length;
+	size -= length;
+
+	return length;
+}
+
+OpusDemuxer::OpusDemuxer(){
+	ctx = nullptr;
+	pb = nullptr;
+	stream = nullptr;
+	pool = nullptr;
+	container = CONTAINER_WEBM;
+	slice = 0;
+	slice_pts = 0;
+	data_start = 0;
+	next_pts = 0;
+	skip_until = AV_NOPTS_VALUE;
+	pre_skip = 0;
+	trim_start = false;
+	track = 0;
+	timecode_scale = 1000000;
+	codec_delay = 0;
+	cluster_time = -1;
+	drain_pos = -1;
+	serial = 0;
+	serial_known = false;
+	partial_valid = false;
+	pts_known = false;
+}
+
+bool OpusDemuxer::supported(AVFormatContext* ctx, AVStream* stream){
+	if(!ctx -> iformat || !ctx -> pb || !(ctx -> pb -> seekable & AVIO_SEEKABLE_NORMAL))
+		return false;
+	if(stream -> codecpar -> codec_id != AV_CODEC_ID_OPUS)
+		return false;
+	if(!strcmp(ctx -> iformat -> name, "ogg"))
+		/* multiplexed pages are left to libavformat */
+		return ctx -> nb_streams == 1;
+	return !strncmp(ctx -> iformat -> name, "matroska", 8);
+}
+
+int OpusDemuxer::io_error(){
+	if(pb -> error)
+		return pb -> error;
+	return avio_feof(pb) ? AVERROR_EOF : 0;
+}
+
+/* bytes libavformat already read into the io buffer, null if going there costs a request */
+const uint8_t* OpusDemuxer::buffered(int64_t pos, int size){
+	int64_t start = pb -> pos - (pb -> buf_end - pb -> buffer);
+
+	if(pos < start || pos + size > pb -> pos)
+		return nullptr;
+	return pb -> buffer + (pos - start);
+}
+
+int OpusDemuxer::skip(int64_t size){
+	int64_t ret = avio_skip(pb, size);
+
+	return ret < 0 ? (int)ret : 0;
+}
+
+int OpusDemuxer::skip_buffered(int64_t size){
+	if(!buffered(avio_tell(pb) + size, 0))
+		return AVERROR_PATCHWELCOME;
+	return skip(size);
+}
+
+int OpusDemuxer::read_id(uint32_t& id){
+	int byte = avio_r8(pb), length;
+
+	if(avio_feof(pb))
+		return io_error();
+	/* ids keep their length marker */
+	for(length = 1; length <= 4 && !(byte & (0x100 >> length)); length++);
+
+	if(length > 4)
+		return AVERROR_INVALIDDATA;
+	id = byte;
+
+	while(--length)
+		id = id << 8 | avio_r8(pb);
+	return io_error();
+}
+
+int OpusDemuxer::read_size(int64_t& size){
+	int byte = avio_r8(pb), length;
+	uint64_t value;
+	bool unknown;
+
+	if(avio_feof(pb))
+		return io_error();
+	for(length = 1; length <= 8 && !(byte & (0x100 >> length)); length++);
+
+	if(length > 8)
+		return AVERROR_INVALIDDATA;
+	value = byte & (0xFF >> length);
+	unknown = value == (uint64_t)(0xFF >> length);
+
+	for(int i = 1; i < length; i++){
+		byte = avio_r8(pb);
+		value = value << 8 | byte;
+		unknown = unknown && byte == 0xFF;
+	}
+
+	/* all ones is an unknown size, only segments and clusters are streamed like that */
+	size = unknown ? -1 : value;
+
+	return io_error();
+}
+
+int OpusDemuxer::read_child(uint32_t& id, int64_t& size){
+	int err;
+
+	if((err = read_id(id)) < 0 || (err = read_size(size)) < 0)
+		return err;
+	return size < 0 ? AVERROR_PATCHWELCOME : 0;
+}
+
+/* an element in the header, which is only read while it sits in the io buffer */
+int OpusDemuxer::read_head(uint32_t& id, int64_t& size){
+	int err;
+
+	/* the longest id and size */
+	if(!buffered(avio_tell(pb), 12))
+		return AVERROR_PATCHWELCOME;
+	if((err = read_id(id)) < 0 || (err = read_size(size)) < 0)
+		return err;
+	return 0;
+}
+
+int OpusDemuxer::read_uint(int64_t size, int64_t& value){
+	if(size < 0 || size > 8)
+		return AVERROR_INVALIDDATA;
+	value = 0;
+
+	while(size--)
+		value = value << 8 | avio_r8(pb);
+	return io_error();
+}
+
+AVBufferRef* OpusDemuxer::alloc(int size){
+	AVBufferRef* buf = nullptr;
+
+	if((size_t)size + AV_INPUT_BUFFER_PADDING_SIZE <= pool -> get_size())
+		buf = pool -> get();
+	if(!buf)
+		buf = av_buffer_alloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
+	if(buf)
+		memset(buf -> data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+	return buf;
+}
+
+int OpusDemuxer::push_slice(AVBufferRef** buf, uint8_t* data, int size, bool last){
+	DemuxSlice s;
+
+	/* the buffer's last packet takes over its reference instead of allocating another */
+	if(last){
+		s.buf = *buf;
+		*buf = nullptr;
+	}else
+		s.buf = av_buffer_ref(*buf);
+	s.data = data;
+	s.size = size;
+	s.discard = 0;
+
+	if(!s.buf)
+		return AVERROR(ENOMEM);
+	try{
+		slices.push_back(s);
+	}catch(std::bad_alloc& e){
+		av_buffer_unref(&s.buf);
+
+		return AVERROR(ENOMEM);
+	}
+
+	return 0;
+}
+
+int64_t OpusDemuxer::packet_duration(const uint8_t* data, int size){
+	int samples = opus_packet_get_nb_samples(data, size, 48000);
+
+	if(samples < 0)
+		return -1;
+	return av_rescale_q(samples, av_make_q(1, 48000), stream -> time_base);
+}
+
+void OpusDemuxer::reset(){
+	for(DemuxSlice& s : slices)
+		av_buffer_unref(&s.buf);
+	slices.clear();
+	slice = 0;
+	cluster_time = -1;
+	partial_valid = false;
+}
+
+int OpusDemuxer::open_webm(){
+	int64_t size, pos, end, child_end, value, number, delay, count;
+	const AVIndexEntry* entry;
+	uint32_t id;
+	char codec[16];
+	bool usual, found = false;
+	int err;
+
+	/* the header is walked again where libavformat left it in the io buffer, fetching it again costs a request */
+	if(!buffered(0, 0) || avio_seek(pb, 0, SEEK_SET) < 0)
+		return AVERROR_PATCHWELCOME;
+	if((err = read_head(id, size)) < 0)
+		return err;
+	if(id != EBML_ID_HEADER || size < 0)
+		return AVERROR_INVALIDDATA;
+	if((err = skip_buffered(size)) < 0 || (err = read_head(id, size)) < 0)
+		return err;
+	if(id != EBML_ID_SEGMENT)
+		return AVERROR_INVALIDDATA;
+	for(;;){
+		pos = avio_tell(pb);
+
+		if((err = read_head(id, size)) < 0)
+			return err;
+		if(id == EBML_ID_CLUSTER)
+			break;
+		if(size < 0)
+			return AVERROR_PATCHWELCOME;
+		if(id != EBML_ID_TRACKS){
+			if((err = skip_buffered(size)) < 0)
+				return err;
+			continue;
+		}
+
+		if(!buffered(avio_tell(pb), size))
+			return AVERROR_PATCHWELCOME;
+		end = avio_tell(pb) + size;
+
+		while(avio_tell(pb) < end){
+			if((err = read_child(id, size)) < 0)
+				return err;
+			child_end = avio_tell(pb) + size;
+
+			if(child_end > end)
+				return AVERROR_INVALIDDATA;
+			if(id != EBML_ID_TRACK_ENTRY){
+				if((err = skip(size)) < 0)
+					return err;
+				continue;
+			}
+
+			number = -1;
+			delay = 0;
+			usual = true;
+			codec[0] = 0;
+
+			while(avio_tell(pb) < child_end){
+				if((err = read_child(id, size)) < 0)
+					return err;
+				if(avio_tell(pb) + size > child_end)
+					return AVERROR_INVALIDDATA;
+				if(id == EBML_ID_TRACK_NUMBER)
+					err = read_uint(size, number);
+				else if(id == EBML_ID_CODEC_DELAY)
+					err = read_uint(size, delay);
+				else if(id == EBML_ID_CODEC_ID && size < (int64_t)sizeof(codec)){
+					if(avio_read(pb, (unsigned char*)codec, size) != size)
+						return io_error() ? io_error() : AVERROR_INVALIDDATA;
+					codec[size] = 0;
+				}else if(id == EBML_ID_TRACK_TIMECODE_SCALE){
+					if((err = read_uint(size, value)) < 0)
+						return err;
+					usual = usual && value == (size == 4 ? FLOAT_ONE : DOUBLE_ONE);
+				}else{
+					/* compressed or encrypted blocks */
+					if(id == EBML_ID_CONTENT_ENCODINGS)
+						usual = false;
+					err = skip(size);
+				}
+
+				if(err < 0)
+					return err;
+			}
+
+			/* libavformat numbers its matroska streams by track number */
+			if(number != stream -> id)
+				continue;
+			if(!usual || strcmp(codec, "A_OPUS"))
+				return AVERROR_PATCHWELCOME;
+			track = number;
+			codec_delay = delay;
+			found = true;
+		}
+	}
+
+	/* libavformat's time base for the track is the timecode scale */
+	timecode_scale = av_rescale(NS, stream -> time_base.num, stream -> time_base.den);
+
+	if(!found || timecode_scale <= 0)
+		return AVERROR_PATCHWELCOME;
+	/* the cues libavformat indexed, cues after the clusters only get there on its first seek */
+	count = avformat_index_get_entries_count(stream);
+
+	try{
+		for(int64_t i = 0; i < count; i++){
+			entry = avformat_index_get_entry(stream, i);
+			cues.push_back({av_rescale_q(entry -> timestamp, stream -> time_base, av_make_q(1, NS)), entry -> pos});
+		}
+	}catch(std::bad_alloc& e){
+		return AVERROR(ENOMEM);
+	}
+
+	/* the first cluster is read again by read_webm, still from the io buffer */
+	data_start = pos;
+
+	if(avio_seek(pb, data_start, SEEK_SET) < 0)
+		return io_error() ? io_error() : AVERROR(EIO);
+	return 0;
+}
+
+int OpusDemuxer::read_block(int64_t size){
+	int64_t start = avio_tell(pb), number, value, pts, sizes[256];
+	const uint8_t* data;
+	AVBufferRef* buf;
+	int err, count, lacing, left, total;
+	int16_t time;
+
+	if((err = read_size(number)) < 0)
+		return err;
+	time = avio_rb16(pb);
+	lacing = (avio_r8(pb) >> 1) & 3;
+
+	if((err = io_error()) < 0)
+		return err;
+	size -= avio_tell(pb) - start;
+
+	if(number != (int64_t)track)
+		return skip(size);
+	if(size <= 0)
+		return AVERROR_INVALIDDATA;
+	if(size > MAX_BLOCK_SIZE)
+		return AVERROR_PATCHWELCOME;
+	if(cluster_time < 0)
+		return AVERROR_INVALIDDATA;
+	buf = alloc(size);
+
+	if(!buf)
+		return AVERROR(ENOMEM);
+	if(avio_read(pb, buf -> data, size) != size){
+		av_buffer_unref(&buf);
+
+		return io_error() ? io_error() : AVERROR_INVALIDDATA;
+	}
+
+	pts = (cluster_time + time) * timecode_scale - codec_delay;
+	slice_pts = av_rescale_q(pts, av_make_q(1, NS), stream -> time_base);
+	data = buf -> data;
+	left = size;
+
+	if(lacing == LACING_NONE){
+		err = push_slice(&buf, buf -> data, size, true);
+		av_buffer_unref(&buf);
+
+		return err;
+	}
+
+	/* frames laced into one block share its buffer */
+	count = data[0] + 1;
+	data++;
+	left--;
+	total = 0;
+	err = 0;
+
+	for(int i = 0; i < count - 1 && !err; i++){
+		switch(lacing){
+			case LACING_XIPH:
+				sizes[i] = 0;
+
+				do{
+					if(!left){
+						err = AVERROR_INVALIDDATA;
+
+						break;
+					}
+
+					sizes[i] += *data;
+					left--;
+				}while(*data++ == 255);
+
+				break;
+			case LACING_EBML:
+				if((err = read_vint(data, left, value)) < 0)
+					break;
+				/* sizes after the first are signed differences */
+				if(i)
+					value = sizes[i - 1] + value - ((1ll << (7 * err - 1)) - 1);
+				sizes[i] = value;
+				err = 0;
+
+				break;
+			case LACING_FIXED:
+				if(left % count)
+					err = AVERROR_INVALIDDATA;
+				sizes[i] = left / count;
+
+				break;
+		}
+
+		if(!err && sizes[i] < 0)
+			err = AVERROR_INVALIDDATA;
+		total += sizes[i];
+	}
+
+	if(!err && total > left)
+		err = AVERROR_INVALIDDATA;
+	sizes[count - 1] = left - total;
+
+	for(int i = 0; i < count && !err; i++){
+		err = push_slice(&buf, (uint8_t*)data, sizes[i], i == count - 1);
+		data += sizes[i];
+	}
+
+	av_buffer_unref(&buf);
+
+	return err;
+}
+
+/* the rest of a block group, for the padding to discard from the end of its block */
+int OpusDemuxer::read_group(int64_t end){
+	int64_t size, value;
+	uint32_t id;
+	int err;
+
+	while(avio_tell(pb) < end){
+		if((err = read_child(id, size)) < 0)
+			return err;
+		if(avio_tell(pb) + size > end)
+			return AVERROR_INVALIDDATA;
+		if(id != EBML_ID_DISCARD_PADDING){
+			if((err = skip(size)) < 0)
+				return err;
+			continue;
+		}
+
+		if((err = read_uint(size, value)) < 0)
+			return err;
+		/* signed ns, nothing is discarded when negative */
+		if(size > 0 && size < 8 && (value >> (size * 8 - 1)))
+			value = 0;
+		if(value > 0)
+			slices.back().discard = av_rescale(value, 48000, NS);
+	}
+
+	return 0;
+}
+
+int OpusDemuxer::read_webm(){
+	int64_t size, group_end = -1;
+	uint32_t id;
+	int err;
+
+	for(;;){
+		if((err = read_id(id)) < 0 || (err = read_size(size)) < 0)
+			return err;
+		switch(id){
+			case EBML_ID_CLUSTER:
+				cluster_time = -1;
+
+				/* children are read in line, an unknown size cluster ends where the next one starts */
+				continue;
+			case EBML_ID_BLOCK_GROUP:
+				group_end = size < 0 ? -1 : avio_tell(pb) + size;
+
+				continue;
+			case EBML_ID_TIMECODE:
+				if((err = read_uint(size, cluster_time)) < 0)
+					return err;
+				continue;
+			case EBML_ID_SIMPLE_BLOCK:
+			case EBML_ID_BLOCK:
+				if(size < 0)
+					return AVERROR_INVALIDDATA;
+				if((err = read_block(size)) < 0)
+					return err;
+				if(slices.empty())
+					continue;
+				/* the padding follows the block in its group */
+				if(id == EBML_ID_BLOCK && group_end >= 0 && (err = read_group(group_end)) < 0)
+					return err;
+				return 0;
+			case EBML_ID_HEADER:
+			case EBML_ID_SEGMENT:
+				/* chained segments */
+				return AVERROR_PATCHWELCOME;
+		}
+
+		if(size < 0)
+			return AVERROR_PATCHWELCOME;
+		if((err = skip(size)) < 0)
+			return err;
+	}
+}
+
+int OpusDemuxer::seek_webm(int64_t timestamp){
+	int64_t ns = av_rescale_q(timestamp, stream -> time_base, av_make_q(1, NS)) + codec_delay, pos = data_start;
+
+	if(cues.empty())
+		/* reading up to the target would fetch everything before it, libavformat loads the cues instead */
+		return AVERROR_PATCHWELCOME;
+	auto it = std::upper_bound(cues.begin(), cues.end(), ns, [](int64_t time, const CuePoint& cue){
+		return time < cue.time;
+	});
+
+	if(it != cues.begin())
+		pos = (it - 1) -> pos;
+
+	if(avio_seek(pb, pos, SEEK_SET) < 0)
+		return io_error() ? io_error() : AVERROR(EIO);
+	reset();
+	next_pts = timestamp;
+	skip_until = timestamp;
+	trim_start = timestamp <= 0;
+
+	return 0;
+}
+
+int OpusDemuxer::read_page_header(OggPage& page, int64_t limit){
+	uint32_t capture = 0;
+
+	/* resyncs on the capture pattern like any ogg reader */
+	for(int64_t scanned = 0; capture != OGG_CAPTURE; scanned++){
+		if(scanned >= limit + 4)
+			return AVERROR_INVALIDDATA;
+		capture = capture << 8 | avio_r8(pb);
+
+		if(avio_feof(pb))
+			return io_error();
+	}
+
+	page.pos = avio_tell(pb) - 4;
+
+	if(avio_r8(pb))
+		return AVERROR_INVALIDDATA;
+	page.flags = avio_r8(pb);
+	page.granule = avio_rl64(pb);
+	page.serial = avio_rl32(pb);
+	/* sequence number and crc, libavformat does not check them either */
+	avio_rl32(pb);
+	avio_rl32(pb);
+	page.segments = avio_r8(pb);
+	page.size = 0;
+
+	for(int i = 0; i < page.segments; i++){
+		page.lacing[i] = avio_r8(pb);
+		page.size += page.lacing[i];
+	}
+
+	return io_error();
+}
+
+int OpusDemuxer::read_page(OggPage& page){
+	int err;
+
+	if((err = read_page_header(page, MAX_SYNC_SCAN)) < 0)
+		return err;
+	if(!serial_known){
+		serial = page.serial;
+		serial_known = true;
+	}
+
+	if(page.serial != serial || (page.flags & OGG_BOS))
+		/* chained or multiplexed streams */
+		return AVERROR_PATCHWELCOME;
+	return 0;
+}
+
+int OpusDemuxer::open_ogg(){
+	/* libavformat is past the headers and holds the first audio page it read, the first packet tells where it was */
+	data_start = -1;
+	drain_pos = avio_tell(pb);
+
+	return 0;
+}
+
+int OpusDemuxer::drain_ogg(AVPacket* pkt){
+	int err;
+
+	if((err = av_read_frame(ctx, pkt)) < 0)
+		return err;
+	if(avio_tell(pb) != drain_pos && buffered(drain_pos, 0)){
+		/* it read a page of its own, which is read again from the io buffer */
+		av_packet_unref(pkt);
+
+		if(avio_seek(pb, drain_pos, SEEK_SET) < 0)
+			return io_error() ? io_error() : AVERROR(EIO);
+		if(data_start < 0)
+			data_start = drain_pos;
+		drain_pos = -1;
+
+		return AVERROR(EAGAIN);
+	}
+
+	/* the page is already gone from the buffer, try at the next one */
+	drain_pos = avio_tell(pb);
+
+	if(data_start < 0 && pkt -> pos >= 0)
+		data_start = pkt -> pos;
+	if(pkt -> pts != AV_NOPTS_VALUE){
+		next_pts = pkt -> pts + pkt -> duration;
+		pts_known = true;
+	}
+
+	/* libavformat trims the start of what it hands out itself */
+	trim_start = false;
+
+	return 0;
+}
+
+int OpusDemuxer::read_ogg(){
+	OggPage page;
+	AVBufferRef* buf, *joined;
+	uint8_t* data;
+	int64_t duration, end_pts, total = 0;
+	int err = 0, begin = 0, end = 0;
+	bool continued;
+
+	if((err = read_page(page)) < 0)
+		return err;
+	buf = alloc(page.size);
+
+	if(!buf)
+		return AVERROR(ENOMEM);
+	if(avio_read(pb, buf -> data, page.size) != page.size){
+		av_buffer_unref(&buf);
+
+		return io_error() ? io_error() : AVERROR_INVALIDDATA;
+	}
+
+	data = buf -> data;
+	continued = page.flags & OGG_CONTINUED;
+
+	if(!continued)
+		partial_valid = false;
+	for(int i = 0; i < page.segments && !err; i++){
+		end += page.lacing[i];
+
+		if(page.lacing[i] == 255 && i < page.segments - 1)
+			continue;
+		if(page.lacing[i] == 255){
+			/* continues on the next page */
+			try{
+				if(!continued)
+					partial.assign(data + begin, data + end);
+				else if(partial_valid)
+					partial.insert(partial.end(), data + begin, data + end);
+				partial_valid = !continued || partial_valid;
+			}catch(std::bad_alloc& e){
+				err = AVERROR(ENOMEM);
+			}
+
+			break;
+		}
+
+		if(continued && partial_valid){
+			/* the only copy, packets across pages are rare */
+			joined = alloc(partial.size() + end - begin);
+
+			if(joined){
+				memcpy(joined -> data, partial.data(), partial.size());
+				memcpy(joined -> data + partial.size(), data + begin, end - begin);
+
+				err = push_slice(&joined, joined -> data, partial.size() + end - begin, true);
+				av_buffer_unref(&joined);
+			}else
+				err = AVERROR(ENOMEM);
+		}else if(!continued && end > begin)
+			/* otherwise the start was before a seek */
+			err = push_slice(&buf, data + begin, end - begin, false);
+		continued = false;
+		partial_valid = false;
+		begin = end;
+	}
+
+	av_buffer_unref(&buf);
+
+	if(err)
+		return err;
+	if(page.granule == -1 || slices.empty()){
+		slice_pts = next_pts;
+
+		return 0;
+	}
+
+	/* the granule is the end of the page's last packet */
+	for(DemuxSlice& s : slices){
+		if((duration = packet_duration(s.data, s.size)) < 0)
+			return AVERROR_INVALIDDATA;
+		total += duration;
+	}
+
+	end_pts = av_rescale_q(page.granule, av_make_q(1, 48000), stream -> time_base);
+
+	if((page.flags & OGG_EOS) && pts_known && next_pts + total > end_pts){
+		/* on the last page it can end inside the last packet, the rest is padding */
+		slice_pts = next_pts;
+		slices.back().discard = av_rescale_q(next_pts + total - end_pts, stream -> time_base, av_make_q(1, 48000));
+	}else
+		slice_pts = end_pts - total;
+	pts_known = true;
+
+	return 0;
+}
+
+int OpusDemuxer::seek_ogg(int64_t timestamp){
+	int64_t lo = data_start, hi = avio_size(pb), mid;
+	OggPage page;
+	bool found;
+	int err;
+
+	if(data_start < 0)
+		/* still on libavformat's read ahead */
+		return AVERROR_PATCHWELCOME;
+	drain_pos = -1;
+
+	/* bisect on the granules, then read forward from the last page before the target */
+	while(hi - lo > OGG_SEEK_RANGE){
+		mid = lo + (hi - lo) / 2;
+		found = false;
+
+		if(avio_seek(pb, mid, SEEK_SET) < 0)
+			return io_error() ? io_error() : AVERROR(EIO);
+		while(!(err = read_page_header(page, hi - avio_tell(pb))) && page.pos < hi){
+			if((!serial_known || page.serial == serial) && page.granule != -1){
+				found = true;
+
+				break;
+			}
+
+			if((err = skip(page.size)) < 0)
+				break;
+		}
+
+		if(err == AVERROR_EXIT)
+			return err;
+		if(found && av_rescale_q(page.granule, av_make_q(1, 48000), stream -> time_base) < timestamp)
+			lo = page.pos;
+		else
+			hi = mid;
+	}
+
+	if(avio_seek(pb, lo, SEEK_SET) < 0)
+		return io_error() ? io_error() : AVERROR(EIO);
+	reset();
+	next_pts = timestamp;
+	skip_until = timestamp;
+	trim_start = timestamp <= 0;
+	pts_known = false;
+
+	return 0;
+}
+
+int OpusDemuxer::open(AVFormatContext* c, AVStream* st, BufferPool* p){
+	int64_t pos;
+	int err;
+
+	ctx = c;
+	pb = ctx -> pb;
+	stream = st;
+	pool = p;
+	container = strcmp(ctx -> iformat -> name, "ogg") ? CONTAINER_WEBM : CONTAINER_OGG;
+
+	pos = avio_tell(pb);
+	err = container == CONTAINER_WEBM ? open_webm() : open_ogg();
+
+	if(err < 0){
+		/* it only moved inside the io buffer, libavformat carries on from where it was */
+		avio_seek(pb, pos, SEEK_SET);
+
+		return err;
+	}
+
+	/* what libavformat would attach to the first packet, the codec delay for webm and the header's pre-skip for ogg */
+	if(container == CONTAINER_WEBM && codec_delay > 0)
+		pre_skip = av_rescale(codec_delay, 48000, NS);
+	else if(stream -> codecpar -> extradata_size >= 19 && !memcmp(stream -> codecpar -> extradata, "OpusHead", 8))
+		pre_skip = AV_RL16(stream -> codecpar -> extradata + 10);
+	next_pts = 0;
+	trim_start = true;
+
+	return 0;
+}
+
+int OpusDemuxer::read(AVPacket* pkt){
+	int64_t pts, duration;
+	uint8_t* side;
+	int err;
+
+	if(drain_pos >= 0 && (err = drain_ogg(pkt)) != AVERROR(EAGAIN))
+		return err;
+	for(;;){
+		while(slice < slices.size()){
+			DemuxSlice& s = slices[slice++];
+
+			if((duration = packet_duration(s.data, s.size)) < 0)
+				return AVERROR_INVALIDDATA;
+			pts = slice_pts;
+			slice_pts += duration;
+			next_pts = slice_pts;
+
+			if(skip_until != AV_NOPTS_VALUE){
+				if(slice_pts <= skip_until){
+					av_buffer_unref(&s.buf);
+
+					continue;
+				}
+
+				skip_until = AV_NOPTS_VALUE;
+			}
+
+			av_packet_unref(pkt);
+
+			pkt -> buf = s.buf;
+			pkt -> data = s.data;
+			pkt -> size = s.size;
+			pkt -> pts = pts;
+			pkt -> dts = pts;
+			pkt -> duration = duration;
+			pkt -> stream_index = stream -> index;
+			pkt -> flags |= AV_PKT_FLAG_KEY;
+			s.buf = nullptr;
+
+			/* the decoder drops the pre-roll and the padding, the same as from libavformat */
+			if((trim_start && pre_skip > 0) || s.discard > 0){
+				side = av_packet_new_side_data(pkt, AV_PKT_DATA_SKIP_SAMPLES, 10);
+
+				if(!side)
+					return AVERROR(ENOMEM);
+				AV_WL32(side, trim_start ? pre_skip : 0);
+				AV_WL32(side + 4, s.discard);
+			}
+
+			trim_start = false;
+
+			return 0;
+		}
+
+		for(DemuxSlice& s : slices)
+			av_buffer_unref(&s.buf);
+		slices.clear();
+		slice = 0;
+		err = container == CONTAINER_WEBM ? read_webm() : read_ogg();
+
+		if(err < 0)
+			return err;
+	}
+}
+
+int OpusDemuxer::seek(int64_t timestamp){
+	return container == CONTAINER_WEBM ? seek_webm(timestamp) : seek_ogg(timestamp);
+}
+
+int64_t OpusDemuxer::get_time(){
+	return next_pts;
+}
+
+OpusDemuxer::~OpusDemuxer(){
+	reset();
+}
\ No newline at end of file
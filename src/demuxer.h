@@ -0,0 +1,125 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "ffmpeg.h"
+#include "pool.h"
+
+/* a packet waiting to be read, a slice of a block or page buffer */
+struct DemuxSlice{
+	AVBufferRef* buf;
+	uint8_t* data;
+	int size;
+
+	int64_t discard; /* 48 khz samples of padding at the end */
+};
+
+/*
+ * reads opus packets from webm and ogg straight off the input's io context, after libavformat opened it
+ * returns AVERROR_PATCHWELCOME on anything it does not handle, libavformat takes over from there
+ */
+class OpusDemuxer{
+private:
+	enum{
+		CONTAINER_WEBM,
+		CONTAINER_OGG
+	};
+
+	enum{
+		/* a sane upper bound on one opus block, it holds at most 120 ms */
+		MAX_BLOCK_SIZE = 1 << 16,
+		/* bytes scanned for the next ogg page */
+		MAX_SYNC_SCAN = 1 << 16,
+		/* ogg seeks bisect down to this range, then read forward */
+		OGG_SEEK_RANGE = 1 << 16,
+		/* webm timestamps are in ns times the timecode scale */
+		NS = 1000000000
+	};
+
+	struct CuePoint{
+		int64_t time; /* ns */
+		int64_t pos; /* absolute */
+	};
+
+	struct OggPage{
+		int64_t pos;
+		int flags;
+		int64_t granule;
+		uint32_t serial;
+		int segments;
+		uint8_t lacing[255];
+		int size;
+	};
+
+	AVFormatContext* ctx;
+	AVIOContext* pb;
+	AVStream* stream;
+	BufferPool* pool;
+
+	int container;
+
+	std::vector<DemuxSlice> slices; /* packets read ahead from one block or page */
+	size_t slice; /* next slice to hand out */
+	int64_t slice_pts; /* pts of the next slice */
+
+	int64_t data_start; /* first cluster or audio page */
+	int64_t next_pts; /* end of the last packet */
+	int64_t skip_until; /* packets ending before this are dropped after a seek */
+
+	int64_t pre_skip; /* 48 khz samples of pre-roll at the start */
+	bool trim_start; /* the next packet is the first of the stream, and carries the pre-skip */
+
+	/* webm */
+	uint64_t track;
+	int64_t timecode_scale;
+	int64_t codec_delay; /* ns */
+	int64_t cluster_time;
+	std::vector<CuePoint> cues; /* from libavformat's index, empty if it had not loaded them by open */
+
+	/* ogg */
+	int64_t drain_pos; /* libavformat hands out what it read ahead until it reads past here, -1 when done */
+	uint32_t serial;
+	bool serial_known;
+	std::vector<uint8_t> partial; /* packet continued on the next page */
+	bool partial_valid;
+	bool pts_known; /* next_pts continues from a page's granule, not from a seek target */
+
+	int io_error();
+	const uint8_t* buffered(int64_t pos, int size);
+	int skip(int64_t size);
+	int skip_buffered(int64_t size);
+	int read_id(uint32_t& id);
+	int read_size(int64_t& size);
+	int read_child(uint32_t& id, int64_t& size);
+	int read_head(uint32_t& id, int64_t& size);
+	int read_uint(int64_t size, int64_t& value);
+	int read_block(int64_t size);
+	int read_group(int64_t end);
+	int open_webm();
+	int read_webm();
+	int seek_webm(int64_t timestamp);
+
+	int read_page_header(OggPage& page, int64_t limit);
+	int read_page(OggPage& page);
+	int open_ogg();
+	int drain_ogg(AVPacket* pkt);
+	int read_ogg();
+	int seek_ogg(int64_t timestamp);
+
+	AVBufferRef* alloc(int size);
+	int push_slice(AVBufferRef** buf, uint8_t* data, int size, bool last);
+	int64_t packet_duration(const uint8_t* data, int size);
+	void reset();
+public:
+	OpusDemuxer();
+	~OpusDemuxer();
+
+	/* webm or ogg with an opus stream, on a seekable input */
+	static bool supported(AVFormatContext* ctx, AVStream* stream);
+
+	int open(AVFormatContext* ctx, AVStream* stream, BufferPool* pool);
+	int read(AVPacket* pkt);
+	int seek(int64_t timestamp);
+
+	/* end of the last packet read, in the stream's time base */
+	int64_t get_time();
+};
\ No newline at end of file
@@ -0,0 +1,800 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include "dsp.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DSP_X86
+#endif
+
+static void scale_c(float* samples, size_t count, float gain){
+	for(size_t i = 0; i < count; i++)
+		samples[i] *= gain;
+}
+
+static void multiply_c(float* samples, const float* gains, size_t count){
+	for(size_t i = 0; i < count; i++)
+		samples[i] *= gains[i];
+}
+
+static void mix_c(float* samples, const float* source, size_t count, float gain){
+	for(size_t i = 0; i < count; i++)
+		samples[i] += source[i] * gain;
+}
+
+static void biquad_c(float* samples, int frames, int channels, const Biquad* sections, size_t count, float* state){
+	for(size_t k = 0; k < count; k++){
+		const Biquad& q = sections[k];
+		float* s1 = state + k * 2 * channels;
+		float* s2 = s1 + channels;
+
+		/* transposed direct form ii */
+		for(int i = 0; i < frames; i++){
+			for(int ch = 0; ch < channels; ch++){
+				float x = samples[i * channels + ch], y = q.b0 * x + s1[ch];
+
+				s1[ch] = q.b1 * x - q.a1 * y + s2[ch];
+				s2[ch] = q.b2 * x - q.a2 * y;
+				samples[i * channels + ch] = y;
+			}
+		}
+	}
+}
+
+#ifdef DSP_X86
+/* two stereo sections share a register, the second runs one frame behind the first */
+static void biquad_pair_sse(float* samples, int frames, const Biquad& q, const Biquad& r, float* state){
+	const __m128 b0 = _mm_setr_ps(q.b0, q.b0, r.b0, r.b0),
+		b1 = _mm_setr_ps(q.b1, q.b1, r.b1, r.b1),
+		b2 = _mm_setr_ps(q.b2, q.b2, r.b2, r.b2),
+		a1 = _mm_setr_ps(q.a1, q.a1, r.a1, r.a1),
+		a2 = _mm_setr_ps(q.a2, q.a2, r.a2, r.a2),
+		first = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, 0, 0));
+	__m128 s1 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)state), (const __m64*)(state + 4)),
+		s2 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(state + 2)), (const __m64*)(state + 6)),
+		x, y = _mm_setzero_ps(), n1, n2;
+
+	for(int i = 0; i <= frames; i++){
+		x = _mm_movelh_ps(i < frames ? _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(samples + i * 2)) : _mm_setzero_ps(), y);
+		y = _mm_add_ps(_mm_mul_ps(b0, x), s1);
+		n1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), s2);
+		n2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+
+		/* the second section has no input on the first frame, the first has none after the last */
+		if(i == 0){
+			n1 = _mm_or_ps(_mm_and_ps(first, n1), _mm_andnot_ps(first, s1));
+			n2 = _mm_or_ps(_mm_and_ps(first, n2), _mm_andnot_ps(first, s2));
+		}else{
+			if(i == frames){
+				n1 = _mm_or_ps(_mm_and_ps(first, s1), _mm_andnot_ps(first, n1));
+				n2 = _mm_or_ps(_mm_and_ps(first, s2), _mm_andnot_ps(first, n2));
+			}
+
+			_mm_storeh_pi((__m64*)(samples + (i - 1) * 2), y);
+		}
+
+		s1 = n1;
+		s2 = n2;
+	}
+
+	_mm_storel_pi((__m64*)state, s1);
+	_mm_storeh_pi((__m64*)(state + 4), s1);
+	_mm_storel_pi((__m64*)(state + 2), s2);
+	_mm_storeh_pi((__m64*)(state + 6), s2);
+}
+
+static void biquad_sse(float* samples, int frames, int channels, const Biquad* sections, size_t count, float* state){
+	size_t k = 0;
+
+	if(channels != 2 || frames <= 0){
+		biquad_c(samples, frames, channels, sections, count, state);
+
+		return;
+	}
+
+	for(; k + 2 <= count; k += 2)
+		biquad_pair_sse(samples, frames, sections[k], sections[k + 1], state + k * 4);
+	if(k < count)
+		biquad_c(samples, frames, channels, sections + k, count - k, state + k * 4);
+}
+
+static void scale_sse(float* samples, size_t count, float gain){
+	__m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4)
+		_mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+	scale_c(samples + i, count - i, gain);
+}
+
+static void multiply_sse(float* samples, const float* gains, size_t count){
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4)
+		_mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_loadu_ps(gains + i)));
+	multiply_c(samples + i, gains + i, count - i);
+}
+
+static void mix_sse(float* samples, const float* source, size_t count, float gain){
+	__m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4)
+		_mm_storeu_ps(samples + i, _mm_add_ps(_mm_loadu_ps(samples + i), _mm_mul_ps(_mm_loadu_ps(source + i), g)));
+	mix_c(samples + i, source + i, count - i, gain);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(float* samples, size_t count, float gain){
+	__m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 16 <= count; i += 16){
+		_mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), g));
+		_mm256_storeu_ps(samples + i + 8, _mm256_mul_ps(_mm256_loadu_ps(samples + i + 8), g));
+	}
+
+	scale_sse(samples + i, count - i, gain);
+}
+
+__attribute__((target("avx2")))
+static void multiply_avx2(float* samples, const float* gains, size_t count){
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), _mm256_loadu_ps(gains + i)));
+	multiply_sse(samples + i, gains + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void mix_avx2(float* samples, const float* source, size_t count, float gain){
+	__m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(samples + i, _mm256_add_ps(_mm256_loadu_ps(samples + i), _mm256_mul_ps(_mm256_loadu_ps(source + i), g)));
+	mix_sse(samples + i, source + i, count - i, gain);
+}
+#endif
+
+static DspKernels select_kernels(){
+#ifdef DSP_X86
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2"))
+		return {scale_avx2, multiply_avx2, mix_avx2, biquad_sse, "avx2"};
+	return {scale_sse, multiply_sse, mix_sse, biquad_sse, "sse"};
+#else
+	return {scale_c, multiply_c, mix_c, biquad_c, "c"};
+#endif
+}
+
+const DspKernels& dsp_kernels(){
+	static const DspKernels kernels = select_kernels();
+
+	return kernels;
+}
+
+AudioEffects::AudioEffects(){
+	reset();
+}
+
+void AudioEffects::reset(){
+	gain = 1;
+	target = 1;
+	step = 0;
+	ramp = 0;
+	depth = 0;
+	depth_target = 0;
+	depth_step = 0;
+	rate = 0;
+	rate_target = 0;
+	rate_step = 0;
+	phase = 0;
+	initialized = false;
+}
+
+void AudioEffects::update(float volume, float d, float r, int sample_rate){
+	/* turning the rate off fades the depth out at the old rate */
+	if(r == 0)
+		d = 0;
+	if(!initialized){
+		/* no ramp into the first frame */
+		gain = volume;
+		target = volume;
+		depth = d;
+		depth_target = d;
+		rate = r;
+		rate_target = r;
+		initialized = true;
+
+		return;
+	}
+
+	if(r == 0)
+		r = rate_target;
+	else if(depth == 0 && depth_step == 0)
+		/* nothing audible to glide from */
+		rate = r;
+	if(volume == target && d == depth_target && r == rate_target)
+		return;
+	target = volume;
+	depth_target = d;
+	rate_target = r;
+	ramp = (long)sample_rate * RAMP_MS / 1000;
+
+	if(ramp < 1)
+		ramp = 1;
+	step = (target - gain) / ramp;
+	depth_step = (depth_target - depth) / ramp;
+	rate_step = (rate_target - rate) / ramp;
+}
+
+bool AudioEffects::idle(){
+	return !ramp && gain == 1 && (depth == 0 || rate == 0);
+}
+
+int AudioEffects::process(float* samples, int frames, int channels, int sample_rate){
+	const DspKernels& kernels = dsp_kernels();
+	bool tremolo = rate != 0 && (depth != 0 || depth_target != 0);
+	size_t count = (size_t)frames * channels;
+
+	if(!ramp && !tremolo){
+		if(gain != 1)
+			kernels.scale(samples, count, gain);
+		return 0;
+	}
+
+	try{
+		if(gains.size() < count)
+			gains.resize(count);
+	}catch(std::bad_alloc& e){
+		return -1;
+	}
+
+	/* tremolo follows af_tremolo: 1 - depth / 2 + depth / 2 * cos, starting at full gain */
+	double w = 2 * M_PI * rate / sample_rate,
+		c = cos(2 * M_PI * phase),
+		s = sin(2 * M_PI * phase),
+		cw = cos(w),
+		sw = sin(w),
+		t;
+	float g, half = depth / 2;
+
+	for(int i = 0; i < frames; i++){
+		if(ramp){
+			gain += step;
+			depth += depth_step;
+
+			if(rate_step != 0)
+				rate += rate_step;
+			if(!--ramp){
+				gain = target;
+				depth = depth_target;
+				rate = rate_target;
+				depth_step = 0;
+				rate_step = 0;
+			}
+
+			half = depth / 2;
+
+			if(tremolo && (rate_step != 0 || !ramp)){
+				/* the rate glides, so does the rotation */
+				w = 2 * M_PI * rate / sample_rate;
+				cw = cos(w);
+				sw = sin(w);
+			}
+		}
+
+		g = gain;
+
+		if(tremolo){
+			g *= 1 - half + half * c;
+
+			/* rotate instead of calling cos every sample */
+			t = c * cw - s * sw;
+			s = s * cw + c * sw;
+			c = t;
+		}
+
+		for(int ch = 0; ch < channels; ch++)
+			gains[(size_t)i * channels + ch] = g;
+	}
+
+	if(tremolo){
+		/* carry on from where the rotation ended, the rate may have changed on the way */
+		phase = atan2(s, c) / (2 * M_PI);
+		phase -= floor(phase);
+	}
+
+	kernels.multiply(samples, gains.data(), count);
+
+	return 0;
+}
+
+EqualizerBank::EqualizerBank(){
+	sample_rate = 0;
+	channels = 0;
+	fade = 0;
+	fade_length = 0;
+	active = false;
+	dirty = false;
+}
+
+int EqualizerBank::set(const Equalizer* eqs, size_t length){
+	try{
+		bands.assign(eqs, eqs + length);
+	}catch(std::bad_alloc& e){
+		return -1;
+	}
+
+	if(!dirty){
+		/* what is playing now fades out, settings that never played are replaced outright */
+		old_sections.swap(sections);
+		old_state.swap(state);
+
+		if(!active)
+			old_sections.clear();
+	}
+
+	std::sort(bands.begin(), bands.end(), [](const Equalizer& a, const Equalizer& b){
+		return a.band < b.band;
+	});
+
+	active = false;
+
+	for(const Equalizer& eq : bands)
+		if(eq.gain != 0)
+			active = true;
+	dirty = true;
+
+	return 0;
+}
+
+int EqualizerBank::design(){
+	size_t count = 0, n = bands.size();
+	double nyquist = sample_rate / 2.0;
+
+	try{
+		sections.resize(n);
+	}catch(std::bad_alloc& e){
+		return -1;
+	}
+
+	for(size_t i = 0; i < n; i++){
+		double f = bands[i].band;
+
+		if(f <= 0 || f >= nyquist * 0.95)
+			continue;
+		/* width follows the spacing to the neighbouring bands */
+		double lo = i > 0 ? bands[i - 1].band : 0,
+			hi = i + 1 < n ? bands[i + 1].band : 0,
+			octaves;
+		if(lo > 0 && hi > 0)
+			octaves = log2(hi / lo) / 2;
+		else if(lo > 0)
+			octaves = log2(f / lo);
+		else if(hi > 0)
+			octaves = log2(hi / f);
+		else
+			octaves = 1;
+		if(octaves < 0.1)
+			octaves = 0.1;
+		double bw = pow(2, octaves),
+			q = sqrt(bw) / (bw - 1),
+			a = pow(10, bands[i].gain / 40),
+			w = 2 * M_PI * f / sample_rate,
+			alpha = sin(w) / (2 * q),
+			cw = cos(w),
+			a0 = 1 + alpha / a;
+		Biquad& s = sections[count++];
+
+		s.b0 = (1 + alpha * a) / a0;
+		s.b1 = -2 * cw / a0;
+		s.b2 = (1 - alpha * a) / a0;
+		s.a1 = s.b1;
+		s.a2 = (1 - alpha / a) / a0;
+	}
+
+	size_t size = count * 2 * channels;
+
+	sections.resize(count);
+
+	if(state.size() != size){
+		/* layout changed, history no longer lines up */
+		try{
+			state.assign(size, 0);
+		}catch(std::bad_alloc& e){
+			sections.clear();
+
+			return -1;
+		}
+	}
+
+	dirty = false;
+
+	return 0;
+}
+
+void EqualizerBank::reset(){
+	std::fill(state.begin(), state.end(), 0);
+
+	fade = 0;
+}
+
+bool EqualizerBank::idle(){
+	return !active && !dirty && !fade;
+}
+
+int EqualizerBank::process(float* samples, int frames, int ch, int rate){
+	bool crossfade, changed;
+	int n;
+
+	if(idle())
+		return 0;
+	if(dirty || ch != channels || rate != sample_rate){
+		/* a new format has no old output to fade from */
+		changed = dirty;
+		crossfade = dirty && ch == channels && rate == sample_rate;
+		channels = ch;
+		sample_rate = rate;
+
+		if(design() < 0)
+			return -1;
+		fade = 0;
+
+		if(crossfade){
+			/* start the new cascade from the old history so low bands do not ring in */
+			if(!old_sections.empty() && old_state.size() == state.size())
+				std::copy(old_state.begin(), old_state.end(), state.begin());
+			else
+				std::fill(state.begin(), state.end(), 0);
+			fade_length = std::max((long)rate * FADE_MS / 1000, 1L);
+			fade = fade_length;
+		}else if(changed)
+			std::fill(state.begin(), state.end(), 0);
+	}
+
+	n = std::min((long)frames, fade);
+
+	if(n){
+		try{
+			dry.assign(samples, samples + (size_t)n * channels);
+		}catch(std::bad_alloc& e){
+			/* cut over instead */
+			fade = n = 0;
+		}
+	}
+
+	if(n && !old_sections.empty())
+		dsp_kernels().biquad(dry.data(), n, channels, old_sections.data(), old_sections.size(), old_state.data());
+	if(active && !sections.empty())
+		dsp_kernels().biquad(samples, frames, channels, sections.data(), sections.size(), state.data());
+	for(int i = 0; i < n; i++){
+		float w = (float)(fade - i) / fade_length;
+
+		for(int c = 0; c < channels; c++)
+			samples[i * channels + c] += (dry[i * channels + c] - samples[i * channels + c]) * w;
+	}
+
+	fade -= n;
+
+	return 0;
+}
+
+SampleFifo::SampleFifo(){
+	head = 0;
+	tail = 0;
+	channels = 0;
+}
+
+int SampleFifo::init(int ch, size_t frames){
+	channels = ch;
+	head = 0;
+	tail = 0;
+
+	try{
+		data.resize(frames * channels);
+	}catch(std::bad_alloc& e){
+		return -1;
+	}
+
+	return 0;
+}
+
+void SampleFifo::clear(){
+	head = 0;
+	tail = 0;
+}
+
+size_t SampleFifo::size(){
+	return tail - head;
+}
+
+float* SampleFifo::get(size_t frame){
+	return data.data() + (head + frame) * channels;
+}
+
+float* SampleFifo::reserve(size_t frames){
+	size_t live = tail - head;
+
+	if((tail + frames) * channels <= data.size())
+		return data.data() + tail * channels;
+	if((live + frames) * channels > data.size()){
+		/* only when a write is longer than configured for */
+		std::vector<float> larger;
+
+		try{
+			larger.resize(std::max((live + frames) * channels, data.size() * 2));
+		}catch(std::bad_alloc& e){
+			return nullptr;
+		}
+
+		memcpy(larger.data(), data.data() + head * channels, live * channels * sizeof(float));
+		data.swap(larger);
+	}else
+		memmove(data.data(), data.data() + head * channels, live * channels * sizeof(float));
+	head = 0;
+	tail = live;
+
+	return data.data() + tail * channels;
+}
+
+void SampleFifo::commit(size_t frames){
+	tail += frames;
+}
+
+void SampleFifo::drop(size_t frames){
+	head += std::min(frames, tail - head);
+
+	if(head == tail)
+		head = tail = 0;
+}
+
+TimeStretch::TimeStretch(){
+	channels = 0;
+	sample_rate = 0;
+	segment = 0;
+	search = 0;
+	cutoff = 0;
+
+	reset();
+}
+
+void TimeStretch::reset(){
+	input.clear();
+	stretched.clear();
+	output.clear();
+	std::fill(overlap.begin(), overlap.end(), 0);
+
+	input_offset = 0;
+	next = 0;
+	previous = 0;
+	started = false;
+	position = 0;
+}
+
+int TimeStretch::configure(int ch, int rate){
+	size_t write;
+
+	channels = ch;
+	sample_rate = rate;
+	segment = (rate * SEGMENT_MS / 1000) & ~1;
+	search = rate * SEARCH_MS / 1000;
+	write = (size_t)rate * WRITE_MS / 1000;
+
+	/* a write, the search and the next segments for the input, twice that stretched, twice again resampled */
+	if(input.init(channels, write + 2 * (segment + search)) < 0 ||
+		stretched.init(channels, 2 * write + 2 * segment + TAPS) < 0 ||
+		output.init(channels, 4 * write + 2 * segment) < 0){
+		channels = 0;
+
+		return -1;
+	}
+
+	reset();
+
+	try{
+		overlap.assign((size_t)segment / 2 * channels, 0);
+		window.resize(segment);
+		table.resize((PHASES + 1) * TAPS);
+	}catch(std::bad_alloc& e){
+		channels = 0;
+
+		return -1;
+	}
+
+	/* hann, sums to one at half overlap */
+	for(int i = 0; i < segment; i++)
+		window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / segment);
+	cutoff = 0;
+
+	return 0;
+}
+
+void TimeStretch::design(float fc){
+	cutoff = fc;
+
+	/* windowed sinc, one extra phase so interpolation never reads past the end */
+	for(int p = 0; p <= PHASES; p++){
+		for(int k = 0; k < TAPS; k++){
+			double x = k - (TAPS / 2 - 1) - (double)p / PHASES,
+				w = 0.5 + 0.5 * cos(M_PI * x / (TAPS / 2)),
+				h = x == 0 ? fc : sin(M_PI * fc * x) / (M_PI * x);
+			table[p * TAPS + k] = h * w;
+		}
+	}
+}
+
+long TimeStretch::find_segment(long nominal){
+	long natural = previous + segment / 2, best = nominal, lo = nominal - search, hi = nominal + search;
+	int half = segment / 2;
+	double best_score = -INFINITY;
+
+	if(!started || nominal == natural)
+		return nominal;
+	if(lo < input_offset)
+		lo = input_offset;
+	const float* target = input.get(natural - input_offset);
+
+	/* normalized correlation against the natural continuation of the last segment, on a channel sum */
+	for(long c = lo; c <= hi; c += 2){
+		const float* candidate = input.get(c - input_offset);
+		double dot = 0, energy = 0;
+
+		for(int i = 0; i < half; i += CORRELATION_STRIDE){
+			float a = 0, b = 0;
+
+			for(int ch = 0; ch < channels; ch++){
+				a += candidate[i * channels + ch];
+				b += target[i * channels + ch];
+			}
+
+			dot += a * b;
+			energy += a * a;
+		}
+
+		double score = energy > 0 ? dot / sqrt(energy) : 0;
+
+		if(score > best_score){
+			best_score = score;
+			best = c;
+		}
+	}
+
+	return best;
+}
+
+int TimeStretch::stretch(float tempo){
+	int half = segment / 2;
+
+	while(true){
+		long nominal = (long)next, frames = input.size();
+
+		/* enough input for the search and the natural continuation */
+		if(nominal + search + segment > input_offset + frames || previous + half + segment > input_offset + frames)
+			break;
+		long pos = find_segment(nominal);
+		const float* seg = input.get(pos - input_offset);
+		float* out = stretched.reserve(half);
+
+		if(!out)
+			return -1;
+		for(int i = 0; i < half; i++){
+			for(int ch = 0; ch < channels; ch++){
+				out[i * channels + ch] = overlap[i * channels + ch] + seg[i * channels + ch] * window[i];
+				overlap[i * channels + ch] = seg[(i + half) * channels + ch] * window[i + half];
+			}
+		}
+
+		stretched.commit(half);
+		previous = pos;
+		next += half * tempo;
+		started = true;
+	}
+
+	/* drop input nothing will look at again */
+	long keep = std::min((long)next - search, previous + half);
+
+	if(keep > input_offset){
+		size_t drop = std::min((size_t)(keep - input_offset), input.size());
+
+		input.drop(drop);
+		input_offset += drop;
+	}
+
+	return 0;
+}
+
+int TimeStretch::resample(float rate){
+	float fc = rate > 1 ? 0.95 / rate : 0.95;
+	long frames = stretched.size();
+	const float* in = stretched.get(0);
+	float* out;
+
+	if(rate == 1 && position == (long)position){
+		/* nothing to interpolate */
+		size_t from = (size_t)position, count = frames > (long)from ? frames - from : 0;
+
+		if(count){
+			if(!(out = output.reserve(count)))
+				return -1;
+			memcpy(out, in + from * channels, count * channels * sizeof(float));
+			output.commit(count);
+		}
+
+		position = frames;
+	}else{
+		/* every read position left with its taps in the stretched samples */
+		size_t count = position + TAPS / 2 < frames ? (size_t)ceil((frames - TAPS / 2 - position) / rate) + 1 : 0, made = 0;
+
+		if(fc != cutoff)
+			design(fc);
+		if(count && !(out = output.reserve(count)))
+			return -1;
+		/* the first tap sits TAPS / 2 - 1 frames behind the read position */
+		while(position + TAPS / 2 < frames && made < count){
+			long i = (long)position;
+			double phase = (position - i) * PHASES;
+			int p = phase;
+			float mix = phase - p;
+			const float* h0 = &table[p * TAPS], *h1 = h0 + TAPS;
+
+			for(int ch = 0; ch < channels; ch++){
+				float sum = 0;
+
+				for(int k = 0; k < TAPS; k++){
+					long j = i - (TAPS / 2 - 1) + k;
+
+					if(j >= 0)
+						sum += in[j * channels + ch] * (h0[k] + (h1[k] - h0[k]) * mix);
+				}
+
+				out[made * channels + ch] = sum;
+			}
+
+			made++;
+			position += rate;
+		}
+
+		output.commit(made);
+	}
+
+	/* keep the history the filter still needs */
+	long keep = (long)position - TAPS;
+
+	if(keep > 0){
+		if(keep > frames)
+			keep = frames;
+		stretched.drop(keep);
+		position -= keep;
+	}
+
+	return 0;
+}
+
+int TimeStretch::write(const float* samples, int frames, int ch, int rate, float speed, float tempo){
+	float* in;
+
+	if((ch != channels || rate != sample_rate) && configure(ch, rate) < 0)
+		return -1;
+	if(!(in = input.reserve(frames)))
+		return -1;
+	memcpy(in, samples, (size_t)frames * channels * sizeof(float));
+	input.commit(frames);
+
+	if(stretch(tempo) < 0 || resample(speed) < 0)
+		return -1;
+	return 0;
+}
+
+int TimeStretch::available(){
+	return channels ? output.size() : 0;
+}
+
+void TimeStretch::read(float* samples, int frames){
+	memcpy(samples, output.get(0), (size_t)frames * channels * sizeof(float));
+	output.drop(frames);
+}
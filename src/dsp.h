@@ -0,0 +1,177 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+struct Equalizer{
+	double band; /* hz */
+	double gain; /* db */
+};
+
+/* normalized so a0 is 1 */
+struct Biquad{
+	float b0;
+	float b1;
+	float b2;
+	float a1;
+	float a2;
+};
+
+/* vectorized kernels, picked once for the running cpu */
+struct DspKernels{
+	void (*scale)(float* samples, size_t count, float gain);
+	void (*multiply)(float* samples, const float* gains, size_t count);
+	/* samples += source * gain */
+	void (*mix)(float* samples, const float* source, size_t count, float gain);
+	/* state is s1 then s2 for every channel, per section */
+	void (*biquad)(float* samples, int frames, int channels, const Biquad* sections, size_t count, float* state);
+
+	const char* name;
+};
+
+const DspKernels& dsp_kernels();
+
+/* volume and tremolo with ramps between settings, applied to interleaved float samples */
+class AudioEffects{
+private:
+	enum{
+		/* ms to move between two settings */
+		RAMP_MS = 10
+	};
+
+	std::vector<float> gains;
+
+	float gain;
+	float target;
+	float step;
+	long ramp; /* frames left in the current ramp, shared by volume and tremolo */
+
+	float depth;
+	float depth_target;
+	float depth_step;
+
+	float rate;
+	float rate_target;
+	float rate_step;
+
+	double phase; /* tremolo position in cycles */
+
+	bool initialized;
+public:
+	AudioEffects();
+
+	void reset();
+	void update(float volume, float depth, float rate, int sample_rate);
+	bool idle();
+	int process(float* samples, int frames, int channels, int sample_rate);
+};
+
+/* cascade of peaking biquads, one per equalizer band */
+class EqualizerBank{
+private:
+	enum{
+		/* ms to crossfade from the previous settings */
+		FADE_MS = 10
+	};
+
+	std::vector<Equalizer> bands;
+	std::vector<Biquad> sections;
+	std::vector<float> state;
+
+	/* the previous settings, run alongside while fading out */
+	std::vector<Biquad> old_sections;
+	std::vector<float> old_state;
+	std::vector<float> dry;
+
+	int sample_rate;
+	int channels;
+
+	long fade; /* frames left in the crossfade */
+	long fade_length;
+
+	bool active; /* any band with gain */
+	bool dirty;
+
+	int design();
+public:
+	EqualizerBank();
+
+	int set(const Equalizer* eqs, size_t length);
+	void reset();
+	bool idle();
+	int process(float* samples, int frames, int channels, int sample_rate);
+};
+
+/* fifo of interleaved frames, compacted in place when the end is reached so every read stays contiguous */
+class SampleFifo{
+private:
+	std::vector<float> data;
+
+	size_t head; /* first frame */
+	size_t tail; /* one past the last frame */
+	int channels;
+public:
+	SampleFifo();
+
+	/* the only allocation, unless a write outgrows it */
+	int init(int channels, size_t frames);
+	void clear();
+
+	size_t size();
+	float* get(size_t frame);
+
+	/* room for frames after the last, null when out of memory */
+	float* reserve(size_t frames);
+	void commit(size_t frames);
+	void drop(size_t frames);
+};
+
+/* tempo by wsola then rate by a polyphase resampler, one pass over interleaved float samples */
+class TimeStretch{
+private:
+	enum{
+		/* wsola segment, search range and correlation stride in ms and samples */
+		SEGMENT_MS = 20,
+		SEARCH_MS = 5,
+		CORRELATION_STRIDE = 4,
+
+		/* resampler table */
+		PHASES = 64,
+		TAPS = 16,
+
+		/* decoded frames up to this long at a rate and tempo of at least 0.5 fit the fifos sized by configure */
+		WRITE_MS = 120
+	};
+
+	SampleFifo input; /* not yet stretched */
+	SampleFifo stretched; /* not yet resampled */
+	SampleFifo output;
+	std::vector<float> overlap;
+	std::vector<float> window;
+	std::vector<float> table;
+
+	int channels;
+	int sample_rate;
+	int segment;
+	int search;
+
+	long input_offset; /* absolute position of input[0] */
+	double next; /* nominal position of the next segment */
+	long previous; /* where the last segment was taken from */
+	bool started;
+
+	double position; /* resampler read position in stretched */
+	float cutoff;
+
+	int configure(int channels, int sample_rate);
+	void design(float cutoff);
+	long find_segment(long nominal);
+	int stretch(float tempo);
+	int resample(float rate);
+public:
+	TimeStretch();
+
+	void reset();
+	int write(const float* samples, int frames, int channels, int sample_rate, float rate, float tempo);
+	int available();
+	void read(float* samples, int frames);
+};
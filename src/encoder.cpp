@@ -0,0 +1,137 @@
+#include <string.h>
+#include <new>
+#include "encoder.h"
+
+DirectEncoder::DirectEncoder(){
+	encoder = nullptr;
+	sample_rate = 0;
+	channels = 0;
+	frame_size = 0;
+	next_pts = 0;
+}
+
+DirectEncoder::~DirectEncoder(){
+	close();
+}
+
+int DirectEncoder::error(int err){
+	switch(err){
+		case OPUS_BAD_ARG:
+			return AVERROR(EINVAL);
+		case OPUS_ALLOC_FAIL:
+			return AVERROR(ENOMEM);
+	}
+
+	return AVERROR_EXTERNAL;
+}
+
+int DirectEncoder::open(int rate, int ch, int size, int bitrate, int complexity, int signal){
+	int err;
+
+	close();
+
+	encoder = opus_encoder_create(rate, ch, OPUS_APPLICATION_AUDIO, &err);
+
+	if(!encoder)
+		return error(err);
+	sample_rate = rate;
+	channels = ch;
+	frame_size = size;
+	next_pts = 0;
+
+	/* same defaults the avcodec wrapper used: vbr at the highest complexity */
+	if((err = opus_encoder_ctl(encoder, OPUS_SET_VBR(1))) != OPUS_OK){
+		err = error(err);
+
+		goto fail;
+	}
+
+	if((err = set_bitrate(bitrate)) < 0 || (err = set_complexity(complexity)) < 0 || (err = set_signal(signal)) < 0)
+		goto fail;
+	return 0;
+
+	fail:
+
+	close();
+
+	return err;
+}
+
+void DirectEncoder::close(){
+	if(encoder)
+		opus_encoder_destroy(encoder);
+	encoder = nullptr;
+}
+
+bool DirectEncoder::is_open(){
+	return encoder != nullptr;
+}
+
+int DirectEncoder::set_bitrate(int bitrate){
+	int err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate > 0 ? bitrate : OPUS_AUTO));
+
+	return err == OPUS_OK ? 0 : error(err);
+}
+
+int DirectEncoder::set_complexity(int complexity){
+	int err = opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity));
+
+	return err == OPUS_OK ? 0 : error(err);
+}
+
+int DirectEncoder::set_signal(int signal){
+	int err = opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(signal));
+
+	return err == OPUS_OK ? 0 : error(err);
+}
+
+int DirectEncoder::get_frame_size(){
+	return frame_size;
+}
+
+int DirectEncoder::encode(const AVFrame* frame, AVPacket* pkt, BufferPool* pool){
+	const float* samples = (const float*)frame -> data[0];
+	AVBufferRef* buf = nullptr;
+	int size, ret;
+
+	if(frame -> nb_samples > frame_size)
+		return AVERROR(EINVAL);
+	if(frame -> nb_samples < frame_size){
+		try{
+			padded.assign((size_t)frame_size * channels, 0);
+		}catch(std::bad_alloc& e){
+			return AVERROR(ENOMEM);
+		}
+
+		memcpy(padded.data(), samples, (size_t)frame -> nb_samples * channels * sizeof(float));
+		samples = padded.data();
+	}
+
+	if(MAX_PACKET_SIZE + AV_INPUT_BUFFER_PADDING_SIZE <= pool -> get_size())
+		buf = pool -> get();
+	if(!buf)
+		buf = av_buffer_alloc(MAX_PACKET_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
+	if(!buf)
+		return AVERROR(ENOMEM);
+	size = buf -> size - AV_INPUT_BUFFER_PADDING_SIZE;
+	ret = opus_encode_float(encoder, samples, frame_size, buf -> data, size < MAX_PACKET_SIZE ? size : MAX_PACKET_SIZE);
+
+	if(ret < 0){
+		av_buffer_unref(&buf);
+
+		return error(ret);
+	}
+
+	memset(buf -> data + ret, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+	pkt -> buf = buf;
+	pkt -> data = buf -> data;
+	pkt -> size = ret;
+	pkt -> pts = frame -> pts != AV_NOPTS_VALUE ? frame -> pts : next_pts;
+	pkt -> dts = pkt -> pts;
+	pkt -> duration = frame_size;
+
+	next_pts = pkt -> pts + frame_size;
+
+	return 0;
+}
\ No newline at end of file
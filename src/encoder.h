@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <opus/opus.h>
+#include "ffmpeg.h"
+#include "pool.h"
+
+/* libopus without the avcodec wrapper, settings apply to the live encoder */
+class DirectEncoder{
+private:
+	enum{
+		/* largest packet libopus produces for up to 60 ms */
+		MAX_PACKET_SIZE = 1275 * 3 + 7
+	};
+
+	OpusEncoder* encoder;
+	std::vector<float> padded; /* short final frames are filled up with silence */
+
+	int sample_rate;
+	int channels;
+	int frame_size;
+
+	int64_t next_pts;
+
+	static int error(int err);
+public:
+	DirectEncoder();
+	~DirectEncoder();
+
+	int open(int sample_rate, int channels, int frame_size, int bitrate, int complexity, int signal);
+	void close();
+	bool is_open();
+
+	int set_bitrate(int bitrate);
+	int set_complexity(int complexity);
+	int set_signal(int signal);
+
+	int get_frame_size();
+	int encode(const AVFrame* frame, AVPacket* pkt, BufferPool* pool);
+};
\ No newline at end of file
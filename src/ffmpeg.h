@@ -4,6 +4,7 @@ extern "C" {
 
 #include <libavutil/channel_layout.h>
 #include <libavutil/dict.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/opt.h>
 #include <libavutil/samplefmt.h>
 #include <libavformat/avformat.h>
@@ -0,0 +1,137 @@
+#include <time.h>
+#include <unistd.h>
+#include "governor.h"
+
+/* encoder complexity per level, the last level also turns optional effects off */
+static const int complexities[] = {10, 8, 6, 4, 2, 0, 0};
+
+enum{
+	LEVELS = sizeof(complexities) / sizeof(complexities[0])
+};
+
+/* thresholds for stepping down, and for counting a window as calm */
+static const double MISS_HIGH = 0.01;
+static const double LOAD_HIGH = 0.85;
+static const double LOAD_LOW = 0.6;
+
+Governor::Governor(): enabled(false), level(0), packets(0), late_packets(0), cpu_ns(0), window_start(0){
+	calm_windows = 0;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	transitions = 0;
+	lowered = 0;
+	raised = 0;
+	last_miss_rate = 0;
+	last_cpu_load = 0;
+
+	if(cpus <= 0)
+		cpus = 1;
+}
+
+uint64_t Governor::now_ns(){
+	timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1'000'000'000 + now.tv_nsec;
+}
+
+void Governor::set_enabled(bool e){
+	mutex.lock();
+	enabled = e;
+
+	if(!e && level){
+		level = 0;
+		transitions++;
+		raised++;
+	}
+
+	calm_windows = 0;
+	mutex.unlock();
+}
+
+void Governor::report(bool late, uint64_t ns){
+	uint64_t now, start;
+
+	packets++;
+	cpu_ns += ns;
+
+	if(late)
+		late_packets++;
+	now = now_ns();
+	start = window_start.load(std::memory_order_relaxed);
+
+	if(now - start < WINDOW_NS)
+		return;
+	mutex.lock();
+
+	/* another player may have rolled the window meanwhile */
+	if(window_start == start)
+		roll(now);
+	mutex.unlock();
+}
+
+void Governor::roll(uint64_t now){
+	uint64_t elapsed = now - window_start;
+	ulong total = packets.exchange(0), late = late_packets.exchange(0);
+	uint64_t cpu = cpu_ns.exchange(0);
+	bool first = !window_start;
+
+	window_start = now;
+
+	if(first)
+		return;
+	last_miss_rate = total ? (double)late / total : 0;
+	last_cpu_load = (double)cpu / ((double)elapsed * cpus);
+
+	if(!enabled || !total)
+		return;
+	int current = level;
+
+	if(last_miss_rate > MISS_HIGH || last_cpu_load > LOAD_HIGH){
+		calm_windows = 0;
+
+		if(current + 1 < LEVELS){
+			level = current + 1;
+			transitions++;
+			lowered++;
+		}
+	}else if(!late && last_cpu_load < LOAD_LOW){
+		if(++calm_windows >= RAISE_WINDOWS && current > 0){
+			calm_windows = 0;
+			level = current - 1;
+			transitions++;
+			raised++;
+		}
+	}else
+		calm_windows = 0;
+}
+
+int Governor::get_level(){
+	return level;
+}
+
+int Governor::get_complexity(){
+	return complexities[level];
+}
+
+bool Governor::effects_allowed(){
+	return level < LEVELS - 1;
+}
+
+GovernorStats Governor::get_stats(){
+	GovernorStats stats;
+
+	mutex.lock();
+	stats.enabled = enabled;
+	stats.level = level;
+	stats.complexity = complexities[stats.level];
+	stats.effects = stats.level < LEVELS - 1;
+	stats.transitions = transitions;
+	stats.lowered = lowered;
+	stats.raised = raised;
+	stats.miss_rate = last_miss_rate;
+	stats.cpu_load = last_cpu_load;
+	mutex.unlock();
+
+	return stats;
+}
\ No newline at end of file
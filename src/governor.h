@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <sys/types.h>
+#include "thread.h"
+
+struct GovernorStats{
+	bool enabled;
+	int level; /* 0 is full quality */
+	int complexity; /* highest encoder complexity allowed */
+	bool effects; /* tremolo and the equalizer allowed */
+
+	ulong transitions;
+	ulong lowered;
+	ulong raised;
+
+	/* over the last full second */
+	double miss_rate; /* late packets / packets */
+	double cpu_load; /* read and encode time / (wall time * cpus) */
+};
+
+/* lowers encoder complexity across all players when they fall behind, raises it again once there is headroom */
+class Governor{
+private:
+	enum{
+		WINDOW_NS = 1'000'000'000,
+		/* quiet windows in a row before stepping back up */
+		RAISE_WINDOWS = 5
+	};
+
+	Mutex mutex;
+
+	std::atomic<bool> enabled;
+	std::atomic<int> level;
+
+	std::atomic<ulong> packets;
+	std::atomic<ulong> late_packets;
+	std::atomic<uint64_t> cpu_ns;
+	std::atomic<uint64_t> window_start;
+
+	int calm_windows;
+	long cpus;
+
+	ulong transitions;
+	ulong lowered;
+	ulong raised;
+
+	double last_miss_rate;
+	double last_cpu_load;
+
+	static uint64_t now_ns();
+
+	void roll(uint64_t now);
+public:
+	Governor();
+
+	void set_enabled(bool enabled);
+	void report(bool late, uint64_t cpu_ns);
+
+	int get_level();
+	int get_complexity();
+	bool effects_allowed();
+	GovernorStats get_stats();
+};
\ No newline at end of file
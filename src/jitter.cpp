@@ -0,0 +1,241 @@
+#include <new>
+#include "jitter.h"
+
+JitterBuffer::JitterBuffer(){
+	head = nullptr;
+	tail = nullptr;
+	unused = nullptr;
+	capacity = 0;
+	fill = 0;
+	packets = 0;
+	underruns = 0;
+	status = 0;
+	aborted = false;
+	starved = true;
+}
+
+JitterBuffer::~JitterBuffer(){
+	Entry* entry;
+
+	reset();
+
+	while(unused){
+		entry = unused;
+		unused = entry -> next;
+
+		av_packet_free(&entry -> packet);
+
+		delete entry;
+	}
+}
+
+long JitterBuffer::duration(AVPacket* packet, long den){
+	if(packet -> duration <= 0 || den <= 0)
+		return 0;
+	return packet -> duration * 1'000'000'000 / den;
+}
+
+void JitterBuffer::release(Entry* entry){
+	av_packet_unref(entry -> packet);
+
+	entry -> next = unused;
+	unused = entry;
+}
+
+void JitterBuffer::set_capacity(long ms){
+	mutex.lock();
+	capacity = ms * 1'000'000;
+	cond.broadcast();
+	mutex.unlock();
+}
+
+long JitterBuffer::get_capacity(){
+	return capacity / 1'000'000;
+}
+
+int JitterBuffer::push(AVPacket* packet, long den, double time, ulong track){
+	Entry* entry;
+
+	mutex.lock();
+
+	/* always accept one packet so a tiny capacity still makes progress */
+	while(!aborted && head && (fill >= capacity || packets >= MAX_PACKETS))
+		cond.wait(mutex);
+	if(aborted){
+		mutex.unlock();
+
+		return AVERROR_EXIT;
+	}
+
+	entry = unused;
+
+	if(entry)
+		unused = entry -> next;
+	else{
+		entry = new (std::nothrow) Entry;
+
+		if(entry){
+			entry -> packet = av_packet_alloc();
+
+			if(!entry -> packet){
+				delete entry;
+
+				entry = nullptr;
+			}
+		}
+
+		if(!entry){
+			mutex.unlock();
+
+			return AVERROR(ENOMEM);
+		}
+	}
+
+	av_packet_move_ref(entry -> packet, packet);
+
+	entry -> next = nullptr;
+	entry -> den = den;
+	entry -> time = time;
+	entry -> track = track;
+
+	if(tail)
+		tail -> next = entry;
+	else
+		head = entry;
+	tail = entry;
+	fill += duration(entry -> packet, den);
+	packets++;
+
+	cond.broadcast();
+	mutex.unlock();
+
+	return 0;
+}
+
+int JitterBuffer::pop(AVPacket* packet, long& den, double& time, ulong& track, bool wait){
+	Entry* entry;
+	int ret;
+
+	mutex.lock();
+
+	if(!head && !status){
+		/* count each time the consumer catches up with the producer, not every poll */
+		if(!starved)
+			underruns++;
+		starved = true;
+	}
+
+	while(wait && !head && !status && !aborted)
+		cond.wait(mutex);
+	entry = head;
+
+	if(!entry){
+		ret = status;
+
+		if(!ret)
+			ret = aborted ? AVERROR_EXIT : AVERROR(EAGAIN);
+
+		mutex.unlock();
+
+		return ret;
+	}
+
+	head = entry -> next;
+
+	if(!head)
+		tail = nullptr;
+	fill -= duration(entry -> packet, entry -> den);
+	packets--;
+	starved = false;
+
+	av_packet_move_ref(packet, entry -> packet);
+
+	den = entry -> den;
+	time = entry -> time;
+	track = entry -> track;
+
+	release(entry);
+	cond.broadcast();
+	mutex.unlock();
+
+	return 0;
+}
+
+bool JitterBuffer::ready(){
+	bool ret;
+
+	mutex.lock();
+	ret = head || status;
+	mutex.unlock();
+
+	return ret;
+}
+
+bool JitterBuffer::full(){
+	bool ret;
+
+	mutex.lock();
+	ret = head && (fill >= capacity || packets >= MAX_PACKETS);
+	mutex.unlock();
+
+	return ret;
+}
+
+bool JitterBuffer::low(){
+	bool ret;
+
+	mutex.lock();
+	ret = fill <= capacity / 2 && packets <= MAX_PACKETS / 2;
+	mutex.unlock();
+
+	return ret;
+}
+
+void JitterBuffer::finish(int err){
+	mutex.lock();
+	status = err;
+	cond.broadcast();
+	mutex.unlock();
+}
+
+void JitterBuffer::abort(){
+	mutex.lock();
+	aborted = true;
+	cond.broadcast();
+	mutex.unlock();
+}
+
+void JitterBuffer::reset(){
+	Entry* entry;
+
+	mutex.lock();
+
+	while(head){
+		entry = head;
+		head = entry -> next;
+
+		release(entry);
+	}
+
+	tail = nullptr;
+	fill = 0;
+	packets = 0;
+	status = 0;
+	aborted = false;
+	starved = true;
+
+	mutex.unlock();
+}
+
+JitterStats JitterBuffer::get_stats(){
+	JitterStats stats;
+
+	mutex.lock();
+	stats.capacity = capacity / 1'000'000;
+	stats.fill = fill / 1'000'000;
+	stats.packets = packets;
+	stats.underruns = underruns;
+	mutex.unlock();
+
+	return stats;
+}
\ No newline at end of file
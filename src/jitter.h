@@ -0,0 +1,70 @@
+#pragma once
+#include <sys/types.h>
+#include "ffmpeg.h"
+#include "thread.h"
+
+struct JitterStats{
+	long capacity; /* ms */
+	long fill; /* ms */
+	ulong packets;
+	ulong underruns;
+};
+
+/* bounded fifo of packets between two stages of the player */
+class JitterBuffer{
+private:
+	enum{
+		/* bound for packets without a duration */
+		MAX_PACKETS = 2048
+	};
+
+	struct Entry{
+		Entry* next;
+		AVPacket* packet;
+
+		long den;
+		double time;
+		ulong track;
+	};
+
+	Entry* head;
+	Entry* tail;
+	Entry* unused;
+
+	Mutex mutex;
+	Cond cond;
+
+	long capacity; /* ns */
+	long fill; /* ns */
+	ulong packets;
+	ulong underruns;
+
+	int status; /* returned by pop once drained */
+
+	bool aborted;
+	bool starved;
+
+	static long duration(AVPacket* packet, long den);
+	void release(Entry* entry);
+public:
+	JitterBuffer();
+	~JitterBuffer();
+
+	void set_capacity(long ms);
+	long get_capacity();
+
+	/* track tags the input a packet came from */
+	int push(AVPacket* packet, long den, double time, ulong track);
+	int pop(AVPacket* packet, long& den, double& time, ulong& track, bool wait = false);
+	bool ready();
+	/* push would wait for room */
+	bool full();
+	/* down to half its capacity, time for the producer to fill it again */
+	bool low();
+
+	void finish(int status);
+	void abort();
+	void reset();
+
+	JitterStats get_stats();
+};
\ No newline at end of file
@@ -2,28 +2,44 @@
 #include "message.h"
 
 void MessageContext::async_cb(uv_async_t* async){
-	Message* msg, *next;
+	Message* msg;
 	MessageContext* ctx = (MessageContext*)async -> data;
 
-	ctx -> mutex.lock();
-	msg = ctx -> message_head;
-	ctx -> active = false;
-	ctx -> message_head = nullptr;
-	ctx -> mutex.unlock();
+	/* messages that become pending while draining get another callback */
+	ctx -> take();
 
-	while(msg){
-		for(int i = 0; i < 10000 && msg; i++){
-			next = msg -> next;
-			msg -> prev = nullptr;
-			msg -> next = nullptr;
-			msg -> received();
-			msg = next;
-		}
+	while((msg = ctx -> drain_head)){
+		ctx -> drain_head = msg -> next;
+
+		if(!ctx -> drain_head)
+			ctx -> drain_tail = nullptr;
+		msg -> next = nullptr;
+		msg -> received();
+	}
+}
+
+void MessageContext::take(){
+	Message* msg = pending_head.exchange(nullptr, std::memory_order_acquire);
+	Message *first = nullptr, *next;
 
-		ctx -> wait_mutex.lock();
-		ctx -> wait_cond.broadcast();
-		ctx -> wait_mutex.unlock();
+	/* the stack holds the newest message first */
+	while(msg){
+		next = msg -> next;
+		msg -> next = first;
+		first = msg;
+		msg = next;
 	}
+
+	if(!first)
+		return;
+	if(drain_tail)
+		drain_tail -> next = first;
+	else
+		drain_head = first;
+	drain_tail = first;
+
+	while(drain_tail -> next)
+		drain_tail = drain_tail -> next;
 }
 
 int MessageContext::inc(Message* message){
@@ -45,7 +61,7 @@ int MessageContext::inc(Message* message){
 			return err;
 		}
 
-		async = asyn;
+		async.store(asyn, std::memory_order_relaxed);
 	}
 
 	active_messages++;
@@ -54,95 +70,92 @@ int MessageContext::inc(Message* message){
 }
 
 void MessageContext::dec(Message* message){
-	if(message -> sending){
-		message -> sending = false;
-
-		mutex.lock();
-
-		if(message == message_head){
-			message_head = message -> next;
-
-			if(message_head)
-				message_head -> prev = nullptr;
-		}else if(message -> prev){
-			message -> prev -> next = message -> next;
-
-			if(message -> next)
-				message -> next -> prev = message -> prev;
-		}
-
-		mutex.unlock();
-
-		wakeup(message);
+	Message *msg, *prev = nullptr;
+	uv_async_t* asyn;
+
+	/* the player no longer commits, pull its message out of the drain queue if it is waiting there */
+	take();
+
+	for(msg = drain_head; msg; prev = msg, msg = msg -> next){
+		if(msg != message)
+			continue;
+		if(prev)
+			prev -> next = msg -> next;
+		else
+			drain_head = msg -> next;
+		if(drain_tail == msg)
+			drain_tail = prev;
+		msg -> next = nullptr;
+
+		break;
 	}
 
-	if(--active_messages)
+	asyn = async.load(std::memory_order_relaxed);
+
+	if(--active_messages){
+		/* the other messages taken above still need a callback */
+		if(drain_head)
+			uv_async_send(asyn);
 		return;
-	if(async){
-		mutex.lock();
+	}
 
-		uv_close((uv_handle_t*)async, nullptr);
+	if(asyn){
+		async.store(nullptr, std::memory_order_relaxed);
 
-		async = nullptr;
-		active = false;
-		mutex.unlock();
+		uv_close((uv_handle_t*)asyn, nullptr);
 	}
 }
 
 void MessageContext::send(Message* message){
-	mutex.lock();
-
-	if(async){
-		if(message_head)
-			message_head -> prev = message;
-		message -> next = message_head;
-		message_head = message;
-		message -> sending = true;
-
-		if(!active){
-			active = true;
-
-			uv_async_send(async);
-		}
-	}
-
-	mutex.unlock();
-}
+	Message* head = pending_head.load(std::memory_order_relaxed);
+	uv_async_t* asyn;
 
-void MessageContext::wait(Message* message){
-	wait_mutex.lock();
+	do
+		message -> next = head;
+	while(!pending_head.compare_exchange_weak(head, message, std::memory_order_release, std::memory_order_relaxed));
 
-	while(message -> sending)
-		wait_cond.wait(wait_mutex);
-	wait_mutex.unlock();
-}
+	/* the loop takes the whole stack at once, only the push onto an empty stack needs to wake it */
+	asyn = async.load(std::memory_order_relaxed);
 
-void MessageContext::wakeup(Message* message){
-	wait_mutex.lock();
-	wait_cond.broadcast();
-	wait_mutex.unlock();
+	if(!head && asyn)
+		uv_async_send(asyn);
 }
 
 ulong MessageContext::count(){
 	return active_messages;
 }
 
-MessageContext::MessageContext(uv_loop_t* l){
+MessageContext::MessageContext(uv_loop_t* l): async(nullptr), pending_head(nullptr){
 	loop = l;
+	drain_head = nullptr;
+	drain_tail = nullptr;
+	active_messages = 0;
 }
 
-Message::Message(MessageHandler* h, MessageContext* c){
+Message::Message(MessageHandler* h, MessageContext* c): head(0), tail(0), pending(false), dropped(0){
 	handler = h;
 	context = c;
+	events = nullptr;
+	size = 0;
 	initialized = false;
-	sending = false;
 	next = nullptr;
-	prev = nullptr;
 }
 
-int Message::init(){
+int Message::init(size_t depth){
 	if(initialized)
 		return 0;
+	if(!events){
+		size_t n = RESERVED_EVENTS * 2;
+
+		while(n < depth)
+			n <<= 1;
+		events = new (std::nothrow) MessageEvent[n];
+
+		if(!events)
+			return UV_ENOMEM;
+		size = n;
+	}
+
 	int err = context -> inc(this);
 
 	if(!err)
@@ -157,21 +170,56 @@ void Message::destroy(){
 	}
 }
 
-void Message::send(){
-	context -> send(this);
+MessageEvent* Message::reserve(bool control){
+	size_t t = tail.load(std::memory_order_relaxed),
+		h = head.load(std::memory_order_acquire);
+	size_t limit = control ? size : size - RESERVED_EVENTS;
+
+	if(!initialized || t - h >= limit){
+		dropped++;
+
+		return nullptr;
+	}
+
+	return &events[t & (size - 1)];
 }
 
-void Message::wait(){
-	if(!sending)
-		return;
-	context -> wait(this);
+void Message::commit(){
+	tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+	if(!pending.exchange(true))
+		context -> send(this);
+}
+
+size_t Message::capacity(){
+	return size ? size - RESERVED_EVENTS : 0;
+}
+
+ulong Message::get_dropped(){
+	return dropped;
 }
 
 void Message::received(){
-	handler -> handle_message();
-	sending = false;
+	size_t h;
+
+	/* cleared first so events committed while draining notify again */
+	pending = false;
+
+	while(initialized){
+		h = head.load(std::memory_order_relaxed);
+
+		if(h == tail.load(std::memory_order_acquire))
+			break;
+		handler -> handle_message(events[h & (size - 1)]);
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	if(initialized)
+		handler -> messages_drained();
 }
 
 Message::~Message(){
 	destroy();
+
+	delete[] events;
 }
\ No newline at end of file
@@ -1,34 +1,56 @@
 #pragma once
 #include <uv.h>
-#include "thread.h"
+#include <atomic>
+#include "ffmpeg.h"
+
+struct MessageEvent{
+	int type;
+	int code;
+
+	int64_t duration;
+
+	/* payload, owned by the event until the handler takes it */
+	AVBufferRef* buffer;
+	int offset;
+	int size;
+
+	MessageEvent(){
+		buffer = nullptr;
+		offset = 0;
+		size = 0;
+	}
+
+	~MessageEvent(){
+		av_buffer_unref(&buffer);
+	}
+};
 
 class MessageHandler{
 public:
-	virtual void handle_message() = 0;
+	virtual void handle_message(MessageEvent& event) = 0;
+	virtual void messages_drained(){}
 };
 
 class Message;
 class MessageContext{
 private:
-	uv_async_t* async;
+	std::atomic<uv_async_t*> async;
 	uv_loop_t* loop;
-	Message* message_head;
 
-	Mutex mutex;
-	Cond cond;
-	Mutex wait_mutex;
-	Cond wait_cond;
+	/* pushed by player threads without a lock, taken all at once by the event loop */
+	std::atomic<Message*> pending_head;
 
-	ulong active_messages;
+	/* only touched on the event loop */
+	Message* drain_head;
+	Message* drain_tail;
 
-	bool active;
+	ulong active_messages;
 
 	static void async_cb(uv_async_t* async);
 	int inc(Message* message);
 	void dec(Message* message);
 	void send(Message* message);
-	void wait(Message* message);
-	void wakeup(Message* message);
+	void take();
 
 	friend class Message;
 public:
@@ -37,15 +59,27 @@ public:
 	ulong count();
 };
 
+/* single producer (player thread), single consumer (event loop) ring of events */
 class Message{
 private:
+	enum{
+		/* slots only control events (ready, finish, error) can use */
+		RESERVED_EVENTS = 4
+	};
+
 	Message* next;
-	Message* prev;
 	MessageContext* context;
 	MessageHandler* handler;
 
+	MessageEvent* events;
+	size_t size;
+
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::atomic<bool> pending;
+	std::atomic<ulong> dropped;
+
 	bool initialized;
-	bool sending;
 
 	friend class MessageContext;
 
@@ -54,8 +88,12 @@ public:
 	Message(MessageHandler* handler, MessageContext* context);
 	~Message();
 
-	int init();
+	int init(size_t depth);
 	void destroy();
-	void send();
-	void wait();
+
+	MessageEvent* reserve(bool control);
+	void commit();
+
+	size_t capacity();
+	ulong get_dropped();
 };
\ No newline at end of file
@@ -0,0 +1,535 @@
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include "mixer.h"
+#include "dsp.h"
+
+MixInput::MixInput(int i, const std::string& u, bool f, float g): url(u){
+	id = i;
+	gain = g;
+	isfile = f;
+	channels = 0;
+	sample_rate = 0;
+	frames = 0;
+	head = 0;
+	tail = 0;
+	started = false;
+	aborted = false;
+	finished = false;
+	stream_index = -1;
+	format_ctx = nullptr;
+	decoderctx = nullptr;
+	filter_graph = nullptr;
+	filter_src = nullptr;
+	filter_sink = nullptr;
+	packet = nullptr;
+	frame = nullptr;
+}
+
+MixInput::~MixInput(){
+	stop();
+	close();
+}
+
+int MixInput::interrupt(void* p){
+	MixInput* input = (MixInput*)p;
+
+	return input -> aborted;
+}
+
+void MixInput::s_input_thread(void* p){
+	((MixInput*)p) -> input_thread();
+}
+
+int MixInput::start(int ch, int sr){
+	channels = ch;
+	sample_rate = sr;
+	frames = (size_t)sample_rate * BUFFER_MS / 1000;
+
+	try{
+		ring.resize(frames * channels);
+	}catch(std::bad_alloc& e){
+		return AVERROR(ENOMEM);
+	}
+
+	thread = Thread(s_input_thread, this);
+
+	if(thread.start())
+		return AVERROR(EAGAIN);
+	started = true;
+
+	return 0;
+}
+
+void MixInput::stop(){
+	mutex.lock();
+	aborted = true;
+	cond.signal();
+	mutex.unlock();
+
+	if(started)
+		thread.join();
+	started = false;
+}
+
+int MixInput::open(){
+	AVDictionary* options = nullptr;
+	AVStream* stream;
+	const AVCodec* decoder;
+
+	int err = AVERROR(ENOMEM);
+
+	packet = av_packet_alloc();
+	frame = av_frame_alloc();
+	format_ctx = avformat_alloc_context();
+
+	if(!packet || !frame || !format_ctx)
+		goto end;
+	format_ctx -> interrupt_callback.callback = interrupt;
+	format_ctx -> interrupt_callback.opaque = this;
+
+	if((err = av_dict_set(&options, "user_agent", "", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if((err = av_dict_set(&options, "reconnect", "1", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if((err = av_dict_set(&options, "icy", "0", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	format_ctx -> protocol_whitelist = isfile ? av_strdup("file,http,https,tcp,tls,crypto") : av_strdup("http,https,tcp,tls,crypto");
+
+	if(!format_ctx -> protocol_whitelist){
+		err = AVERROR(ENOMEM);
+
+		goto end;
+	}
+
+	if((err = avformat_open_input(&format_ctx, url.c_str(), nullptr, &options)) < 0)
+		goto end;
+	if((err = avformat_find_stream_info(format_ctx, nullptr)) < 0)
+		goto end;
+	if((err = av_find_best_stream(format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0)) < 0)
+		goto end;
+	stream_index = err;
+	stream = format_ctx -> streams[stream_index];
+	decoder = avcodec_find_decoder(stream -> codecpar -> codec_id);
+
+	if(!decoder){
+		err = AVERROR_DECODER_NOT_FOUND;
+
+		goto end;
+	}
+
+	decoderctx = avcodec_alloc_context3(decoder);
+
+	if(!decoderctx){
+		err = AVERROR(ENOMEM);
+
+		goto end;
+	}
+
+	if((err = avcodec_parameters_to_context(decoderctx, stream -> codecpar)) < 0)
+		goto end;
+	decoderctx -> pkt_timebase = stream -> time_base;
+	err = avcodec_open2(decoderctx, decoder, nullptr);
+
+	end:
+
+	av_dict_free(&options);
+
+	return err;
+}
+
+int MixInput::create_filters(){
+	int64_t channel_layouts[] = {av_get_default_channel_layout(channels), -1};
+	int sample_rates[] = {sample_rate, -1};
+	int channel_counts[] = {channels, -1};
+	int sample_fmts[] = {AV_SAMPLE_FMT_FLT, -1};
+
+	int64_t layout = frame -> channel_layout ? frame -> channel_layout : av_get_default_channel_layout(frame -> channels);
+
+	char filter_args[256];
+	int err;
+
+	snprintf(filter_args, sizeof(filter_args), "sample_rate=%d:sample_fmt=%d:channels=%d:channel_layout=0x%" PRIx64,
+												frame -> sample_rate, frame -> format, frame -> channels, layout);
+	filter_graph = avfilter_graph_alloc();
+
+	if(!filter_graph)
+		return AVERROR(ENOMEM);
+	filter_graph -> nb_threads = 1;
+
+	/* a direct link, the graph converts to the output format on its own */
+	if((err = avfilter_graph_create_filter(&filter_src, avfilter_get_by_name("abuffer"), nullptr, filter_args, nullptr, filter_graph)) < 0)
+		return err;
+	if((err = avfilter_graph_create_filter(&filter_sink, avfilter_get_by_name("abuffersink"), nullptr, nullptr, nullptr, filter_graph)) < 0)
+		return err;
+	if((err = av_opt_set_int(filter_sink, "all_channel_counts", 0, AV_OPT_SEARCH_CHILDREN)) < 0)
+		return err;
+	if((err = av_opt_set_int_list(filter_sink, "sample_fmts", sample_fmts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+		return err;
+	if((err = av_opt_set_int_list(filter_sink, "channel_layouts", channel_layouts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+		return err;
+	if((err = av_opt_set_int_list(filter_sink, "channel_counts", channel_counts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+		return err;
+	if((err = av_opt_set_int_list(filter_sink, "sample_rates", sample_rates, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+		return err;
+	if((err = avfilter_link(filter_src, 0, filter_sink, 0)) < 0)
+		return err;
+	return avfilter_graph_config(filter_graph, nullptr);
+}
+
+int MixInput::drain_filters(){
+	int err;
+
+	while(true){
+		err = av_buffersink_get_frame(filter_sink, frame);
+
+		if(err == AVERROR(EAGAIN) || err == AVERROR_EOF)
+			return 0;
+		if(err < 0)
+			return err;
+		err = push((float*)frame -> data[0], frame -> nb_samples);
+
+		av_frame_unref(frame);
+
+		if(err < 0)
+			return err;
+	}
+}
+
+int MixInput::decode(AVPacket* pkt){
+	int err = avcodec_send_packet(decoderctx, pkt);
+
+	if(err < 0)
+		return err;
+	while(true){
+		err = avcodec_receive_frame(decoderctx, frame);
+
+		if(err == AVERROR(EAGAIN))
+			return 0;
+		if(err == AVERROR_EOF){
+			/* flush what the resampler holds */
+			if(filter_graph && (err = av_buffersrc_add_frame(filter_src, nullptr)) < 0)
+				return err;
+			return filter_graph ? drain_filters() : 0;
+		}
+
+		if(err < 0)
+			return err;
+		if(!filter_graph && (err = create_filters()) < 0)
+			return err;
+		err = av_buffersrc_add_frame(filter_src, frame);
+
+		av_frame_unref(frame);
+
+		if(err < 0 || (err = drain_filters()) < 0)
+			return err;
+	}
+}
+
+int MixInput::push(const float* samples, size_t count){
+	size_t offset, n;
+
+	mutex.lock();
+
+	while(count){
+		/* decoding blocks here until the mix catches up */
+		while(!aborted && tail - head == frames)
+			cond.wait(mutex);
+		if(aborted)
+			break;
+		offset = tail % frames;
+		n = std::min(std::min(frames - (tail - head), frames - offset), count);
+
+		memcpy(ring.data() + offset * channels, samples, n * channels * sizeof(float));
+
+		tail += n;
+		samples += n * channels;
+		count -= n;
+	}
+
+	mutex.unlock();
+
+	return count ? AVERROR_EXIT : 0;
+}
+
+void MixInput::input_thread(){
+	int err = open();
+
+	while(!err && !aborted){
+		err = av_read_frame(format_ctx, packet);
+
+		if(err == AVERROR_EOF){
+			decode(nullptr);
+
+			break;
+		}
+
+		if(err < 0)
+			break;
+		if(packet -> stream_index == stream_index)
+			err = decode(packet);
+		av_packet_unref(packet);
+	}
+
+	/* errors end the input like eof, the mix plays out what was decoded */
+	mutex.lock();
+	finished = true;
+	mutex.unlock();
+}
+
+void MixInput::close(){
+	avfilter_graph_free(&filter_graph);
+	avcodec_free_context(&decoderctx);
+	avformat_close_input(&format_ctx);
+	av_packet_free(&packet);
+	av_frame_free(&frame);
+
+	filter_src = nullptr;
+	filter_sink = nullptr;
+}
+
+int MixInput::mix(float* samples, int count){
+	const DspKernels& kernels = dsp_kernels();
+	size_t offset, n;
+	int mixed = 0;
+
+	mutex.lock();
+
+	while(mixed < count && head != tail){
+		offset = head % frames;
+		n = std::min(std::min(tail - head, frames - offset), (size_t)(count - mixed));
+
+		kernels.mix(samples + (size_t)mixed * channels, ring.data() + offset * channels, n * channels, gain);
+
+		head += n;
+		mixed += n;
+	}
+
+	cond.signal();
+	mutex.unlock();
+
+	return mixed;
+}
+
+bool MixInput::matches(int ch, int rate){
+	return ch == channels && rate == sample_rate;
+}
+
+bool MixInput::done(){
+	bool ret;
+
+	mutex.lock();
+	ret = finished && head == tail;
+	mutex.unlock();
+
+	return ret;
+}
+
+Mixer::Mixer(): live(0){
+	next_id = 1;
+	duck_level = 1;
+	duck_ms = DEFAULT_DUCK_MS;
+	duck_gain = 1;
+	underruns = 0;
+}
+
+Mixer::~Mixer(){
+	clear();
+}
+
+int Mixer::add(const std::string& url, bool isfile, float gain, int channels, int sample_rate){
+	MixInput* input = nullptr;
+	int err, id;
+
+	if(channels <= 0 || sample_rate <= 0)
+		return AVERROR(EINVAL);
+	mutex.lock();
+	id = next_id++;
+	mutex.unlock();
+
+	try{
+		input = new MixInput(id, url, isfile, gain);
+	}catch(std::bad_alloc& e){
+		return AVERROR(ENOMEM);
+	}
+
+	if((err = input -> start(channels, sample_rate)) < 0){
+		delete input;
+
+		return err;
+	}
+
+	mutex.lock();
+
+	try{
+		inputs.push_back(input);
+	}catch(std::bad_alloc& e){
+		mutex.unlock();
+
+		delete input;
+
+		return AVERROR(ENOMEM);
+	}
+
+	live++;
+	mutex.unlock();
+
+	return id;
+}
+
+int Mixer::remove(int id){
+	MixInput* input = nullptr;
+
+	mutex.lock();
+
+	for(size_t i = 0; i < inputs.size(); i++){
+		if(inputs[i] -> id == id){
+			input = inputs[i];
+			inputs.erase(inputs.begin() + i);
+			live--;
+
+			break;
+		}
+	}
+
+	mutex.unlock();
+
+	if(!input)
+		return AVERROR(ENOENT);
+	/* joins the decode thread, outside the lock so the mix keeps going */
+	delete input;
+
+	return 0;
+}
+
+int Mixer::set_gain(int id, float gain){
+	int err = AVERROR(ENOENT);
+
+	mutex.lock();
+
+	for(MixInput* input : inputs){
+		if(input -> id == id){
+			input -> gain = gain;
+			err = 0;
+
+			break;
+		}
+	}
+
+	mutex.unlock();
+
+	return err;
+}
+
+void Mixer::set_ducking(float level, long ms){
+	mutex.lock();
+	duck_level = std::min(std::max(level, 0.0f), 1.0f);
+	duck_ms = ms > 0 ? ms : 0;
+	mutex.unlock();
+}
+
+void Mixer::clear(){
+	std::vector<MixInput*> list;
+
+	mutex.lock();
+	list.swap(inputs);
+	live = 0;
+	mutex.unlock();
+
+	for(MixInput* input : list)
+		delete input;
+}
+
+bool Mixer::active(){
+	/* stays active until the main source is back at full gain */
+	return live || duck_gain != 1;
+}
+
+int Mixer::process(float* samples, int count, int channels, int sample_rate){
+	const DspKernels& kernels = dsp_kernels();
+	std::vector<MixInput*> stale;
+	float target, step;
+	long ramp;
+
+	mutex.lock();
+
+	/* the output format changed since these were added, their samples no longer fit the frame */
+	for(size_t i = 0; i < inputs.size();){
+		if(inputs[i] -> matches(channels, sample_rate)){
+			i++;
+
+			continue;
+		}
+
+		try{
+			stale.push_back(inputs[i]);
+		}catch(std::bad_alloc& e){
+			mutex.unlock();
+
+			return AVERROR(ENOMEM);
+		}
+
+		inputs.erase(inputs.begin() + i);
+		live--;
+	}
+
+	target = inputs.empty() ? 1 : duck_level;
+
+	/* the main source is ducked first, the inputs go on top at their own gain */
+	if(duck_gain == target){
+		if(duck_gain != 1)
+			kernels.scale(samples, (size_t)count * channels, duck_gain);
+	}else{
+		ramp = (long)sample_rate * duck_ms / 1000;
+		step = ramp > 0 ? 1.0f / ramp : 1;
+
+		for(int i = 0; i < count; i++){
+			if(duck_gain < target)
+				duck_gain = std::min(duck_gain + step, target);
+			else if(duck_gain > target)
+				duck_gain = std::max(duck_gain - step, target);
+			for(int ch = 0; ch < channels; ch++)
+				samples[i * channels + ch] *= duck_gain;
+		}
+	}
+
+	for(size_t i = 0; i < inputs.size();){
+		MixInput* input = inputs[i];
+
+		if(input -> mix(samples, count) < count){
+			if(input -> done()){
+				/* its thread has exited, the join is immediate */
+				inputs.erase(inputs.begin() + i);
+				live--;
+
+				delete input;
+
+				continue;
+			}
+
+			underruns++;
+		}
+
+		i++;
+	}
+
+	mutex.unlock();
+
+	/* joins their decode threads, outside the lock like remove() */
+	for(MixInput* input : stale)
+		delete input;
+	return 0;
+}
+
+MixerStats Mixer::get_stats(){
+	MixerStats stats;
+
+	mutex.lock();
+	stats.inputs = inputs.size();
+	stats.duck = duck_gain;
+	stats.underruns = underruns;
+	mutex.unlock();
+
+	return stats;
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include "ffmpeg.h"
+#include "thread.h"
+
+struct MixerStats{
+	int inputs;
+	float duck; /* current gain of the main source */
+	ulong underruns; /* frames an input had nothing ready for */
+};
+
+/* an overlay source, decoded on its own thread into a ring of samples at the output format */
+class MixInput{
+private:
+	enum{
+		/* ms decoded ahead of the mix */
+		BUFFER_MS = 400
+	};
+
+	Thread thread;
+	Mutex mutex;
+	Cond cond;
+
+	std::string url;
+	bool isfile;
+
+	int channels;
+	int sample_rate;
+
+	std::vector<float> ring;
+	size_t frames; /* ring capacity */
+	size_t head; /* frames read */
+	size_t tail; /* frames written */
+
+	bool started;
+	bool aborted;
+	bool finished;
+
+	int stream_index;
+
+	AVFormatContext* format_ctx;
+	AVCodecContext* decoderctx;
+	AVFilterGraph* filter_graph;
+	AVFilterContext* filter_src;
+	AVFilterContext* filter_sink;
+	AVPacket* packet;
+	AVFrame* frame;
+
+	static int interrupt(void* p);
+	static void s_input_thread(void* p);
+	void input_thread();
+	int open();
+	int create_filters();
+	int drain_filters();
+	int decode(AVPacket* packet);
+	int push(const float* samples, size_t count);
+	void close();
+public:
+	int id;
+	float gain;
+
+	MixInput(int id, const std::string& url, bool isfile, float gain);
+	~MixInput();
+
+	int start(int channels, int sample_rate);
+	void stop();
+
+	/* whether the ring holds samples in this format, fixed by start() */
+	bool matches(int channels, int sample_rate);
+
+	/* adds up to count frames scaled by gain into samples, returns the frames mixed */
+	int mix(float* samples, int count);
+	bool done();
+};
+
+/* sums overlay inputs into the main source before it is encoded, ducking the main source under them */
+class Mixer{
+private:
+	enum{
+		DEFAULT_DUCK_MS = 250
+	};
+
+	std::vector<MixInput*> inputs;
+	Mutex mutex;
+
+	std::atomic<int> live; /* inputs that have not finished */
+
+	int next_id;
+
+	float duck_level;
+	long duck_ms;
+
+	/* only touched by the player thread */
+	float duck_gain;
+	ulong underruns;
+public:
+	Mixer();
+	~Mixer();
+
+	int add(const std::string& url, bool isfile, float gain, int channels, int sample_rate);
+	int remove(int id);
+	int set_gain(int id, float gain);
+	void set_ducking(float level, long ms);
+	void clear();
+
+	bool active();
+	int process(float* samples, int count, int channels, int sample_rate);
+
+	MixerStats get_stats();
+};
\ No newline at end of file
@@ -2,8 +2,31 @@
 #include <unistd.h>
 #include <opus/opus.h>
 #include "player.h"
+#include "alloc.h"
+
+enum{
+	/* ms of demuxed input the io stage may read ahead */
+	DEMUX_AHEAD = 1000,
+	/* size of pooled packet buffers, fits any opus packet */
+	POOL_BUFFER_SIZE = 8192,
+	/* encoded packets to wait before building a spare filter graph, keeps it off the first packets after a seek */
+	SPARE_GRAPH_DELAY = 25
+};
+
+PlayerContext::PlayerContext(): pool(POOL_BUFFER_SIZE){
+	list = nullptr;
+	pooled_players = 0;
+}
+
+int PlayerContext::add(Player* player){
+	if(player -> pooled){
+		mutex.lock();
+		pooled_players++;
+		mutex.unlock();
+
+		return 0;
+	}
 
-void PlayerContext::add(Player* player){
 	mutex.lock();
 
 	if(list)
@@ -13,9 +36,20 @@ void PlayerContext::add(Player* player){
 	list = player;
 
 	mutex.unlock();
+
+	return 0;
 }
 
 void PlayerContext::remove(Player* player){
+	if(player -> pooled){
+		mutex.lock();
+		pooled_players--;
+		cond.broadcast();
+		mutex.unlock();
+
+		return;
+	}
+
 	mutex.lock();
 
 	if(player == list || player -> prev){
@@ -37,6 +71,44 @@ void PlayerContext::remove(Player* player){
 	mutex.unlock();
 }
 
+int PlayerContext::set_workers(int threads, ulong tick, int io_threads){
+	int err = scheduler.start(threads, tick);
+
+	if(err)
+		return err;
+	if((err = io.start(io_threads)))
+		scheduler.stop();
+	return err;
+}
+
+bool PlayerContext::is_pooled(){
+	return scheduler.is_running();
+}
+
+SchedulerStats PlayerContext::get_scheduler_stats(){
+	SchedulerStats stats = scheduler.get_stats();
+
+	io.get_stats(stats);
+
+	return stats;
+}
+
+BufferPool* PlayerContext::get_pool(){
+	return &pool;
+}
+
+Governor* PlayerContext::get_governor(){
+	return &governor;
+}
+
+PacketCache* PlayerContext::get_cache(){
+	return &cache;
+}
+
+ProbeCache* PlayerContext::get_probe_cache(){
+	return &probes;
+}
+
 void PlayerContext::wait_threads(){
 	Player* player;
 	Thread thread;
@@ -59,77 +131,202 @@ void PlayerContext::wait_threads(){
 			break;
 		thread.join();
 	}
+
+	mutex.lock();
+
+	while(pooled_players)
+		cond.wait(mutex);
+	mutex.unlock();
+	scheduler.stop();
+	io.stop();
+}
+
+static uint64_t thread_cpu_ns(){
+	timespec now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+	return (uint64_t)now.tv_sec * 1'000'000'000 + now.tv_nsec;
+}
+
+static void detach_native(AVFormatContext* ctx){
+	delete (OpusDemuxer*)ctx -> opaque;
+
+	ctx -> opaque = nullptr;
+}
+
+/* also frees the native demuxer riding on the context */
+static void close_input(AVFormatContext** ctx){
+	if(*ctx)
+		detach_native(*ctx);
+	avformat_close_input(ctx);
 }
 
 int Player::decode_interrupt(void* p){
 	Player* player = (Player*)p;
 
-	return player -> destroyed;
+	return player -> destroyed || player -> reader_interrupt;
+}
+
+int Player::get_encode_buffer(AVCodecContext* ctx, AVPacket* pkt, int flags){
+	Player* player = (Player*)ctx -> opaque;
+	BufferPool* pool = player -> context -> get_pool();
+
+	if((size_t)pkt -> size + AV_INPUT_BUFFER_PADDING_SIZE <= pool -> get_size()){
+		pkt -> buf = pool -> get();
+
+		if(pkt -> buf){
+			pkt -> data = pkt -> buf -> data;
+
+			memset(pkt -> data + pkt -> size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+			return 0;
+		}
+	}
+
+	return avcodec_default_get_encode_buffer(ctx, pkt, flags);
 }
 
 void Player::s_player_thread(void* p){
 	Player* player = (Player*)p;
 
+	AllocCounter::track_thread();
 	player -> player_thread();
 }
 
+void Player::s_reader_thread(void* p){
+	Player* player = (Player*)p;
+
+	AllocCounter::track_thread();
+	player -> reader_thread();
+}
+
+void Player::s_demux_thread(void* p){
+	Player* player = (Player*)p;
+
+	AllocCounter::track_thread();
+	player -> demux_thread();
+}
+
+void Player::s_demux_job(void* p){
+	Player* player = (Player*)p;
+
+	player -> demux_ahead();
+}
+
+void Player::s_spare_job(void* p){
+	Player* player = (Player*)p;
+
+	player -> build_spare();
+}
+
+void Player::s_preopen_thread(void* p){
+	Player* player = (Player*)p;
+
+	player -> preopen_thread();
+}
+
+void Player::s_offload_step(void* p){
+	Player* player = (Player*)p;
+
+	player -> offload_step();
+}
+
+void Player::s_offload_done(void* p){
+	Player* player = (Player*)p;
+
+	player -> offload_done();
+}
+
+int Player::preopen_interrupt(void* p){
+	Player* player = (Player*)p;
+
+	return player -> destroyed || player -> preopen_abort;
+}
+
 bool Player::filters_neq(){
-	return volume.is_changed() || rate.is_changed() || tempo.is_changed() || tremolo.is_changed() || equalizer.is_changed();
+	bool want_rate = !native_stretch && rate.is_set(),
+		want_tempo = !native_stretch && tempo.is_set();
+	/* asetrate takes no commands, tempo changes go through update_filters */
+	return want_rate != graph_rate || want_tempo != graph_tempo || (graph_rate && rate.is_changed());
 }
 
 bool Player::filters_set(){
-	return volume.is_set() || rate.is_set() || tempo.is_set() || tremolo.is_set() || equalizer.is_set();
+	return volume.is_set() || rate.is_set() || tempo.is_set() || tremolo.is_set() || equalizer.is_set() || mixer.active();
 }
 
 void Player::filters_seteq(){
-	volume.reset_change();
 	rate.reset_change();
 	tempo.reset_change();
-	tremolo.reset_change();
-	equalizer.reset_change();
 }
 
-int Player::init_pipeline(){
+int Player::open_decoder(){
 	int err;
 
 	decoderctx = avcodec_alloc_context3(nullptr);
-	encoderctx = avcodec_alloc_context3(nullptr);
-
-	if(!decoderctx || !encoderctx){
-		err = AVERROR(ENOMEM);
-
-		goto end;
-	}
 
+	if(!decoderctx)
+		return AVERROR(ENOMEM);
 	if((err = avcodec_parameters_to_context(decoderctx, stream -> codecpar)) < 0)
-		goto end;
+		return err;
 	decoderctx -> pkt_timebase = stream -> time_base;
 	decoder = avcodec_find_decoder(decoderctx -> codec_id);
 	decoderctx -> request_sample_fmt = AV_SAMPLE_FMT_S16;
 
-	if((err = avcodec_open2(decoderctx, decoder, nullptr)) < 0)
+	last_pts = AV_NOPTS_VALUE;
+	last_tb = {0, 1};
+
+	return avcodec_open2(decoderctx, decoder, nullptr);
+}
+
+int Player::init_pipeline(){
+	int err;
+
+	if((err = open_decoder()) < 0)
 		goto end;
 	audio_out.channel_layout = av_get_default_channel_layout(audio_out.channels);
+	audio_out.fmt = AV_SAMPLE_FMT_FLT;
 
-	encoderctx -> bit_rate = bitrate;
-	encoderctx -> sample_rate = audio_out.sample_rate;
-	encoderctx -> channels = audio_out.channels;
-	encoderctx -> sample_fmt = AV_SAMPLE_FMT_FLT;
-	encoderctx -> channel_layout = audio_out.channel_layout;
-	encoderctx -> compression_level = 10;
+	if(encoder_id == AV_CODEC_ID_OPUS){
+		governed_level = context -> get_governor() -> get_level();
+
+		if((err = direct.open(audio_out.sample_rate, audio_out.channels, frame_size, bitrate, encoder_complexity(), signal)) < 0)
+			goto end;
+	}else{
+		encoderctx = avcodec_alloc_context3(nullptr);
+
+		if(!encoderctx){
+			err = AVERROR(ENOMEM);
+
+			goto end;
+		}
+
+		encoderctx -> bit_rate = bitrate;
+		encoderctx -> sample_rate = audio_out.sample_rate;
+		encoderctx -> channels = audio_out.channels;
+		encoderctx -> sample_fmt = AV_SAMPLE_FMT_FLT;
+		encoderctx -> channel_layout = audio_out.channel_layout;
+		encoderctx -> compression_level = complexity;
+
+		if(encoder -> capabilities & AV_CODEC_CAP_DR1){
+			/* encoded packets come from the context's pool instead of a fresh allocation each */
+			encoderctx -> opaque = this;
+			encoderctx -> get_encode_buffer = get_encode_buffer;
+		}
+
+		if((err = avcodec_open2(encoderctx, encoder, nullptr)) < 0)
+			goto end;
+	}
 
-	if((err = avcodec_open2(encoderctx, encoder, nullptr)) < 0)
-		goto end;
 	audio_in.channels = decoderctx -> channels;
 	audio_in.sample_rate = decoderctx -> sample_rate;
 	audio_in.fmt = decoderctx -> sample_fmt;
 	audio_in.channel_layout = 0;
 
-	audio_out.fmt = encoderctx -> sample_fmt;
-
-	last_pts = AV_NOPTS_VALUE;
-	last_tb = {0, 1};
-
+	effects.reset();
+	eq_bank.reset();
+	stretcher.reset();
+	stretch_has_data = false;
 	pipeline = true;
 
 	return 0;
@@ -138,58 +335,100 @@ int Player::init_pipeline(){
 
 	avcodec_free_context(&decoderctx);
 	avcodec_free_context(&encoderctx);
+	direct.close();
 
 	return err;
 }
 
 void Player::pipeline_destroy(){
+	discard_spare();
 	avfilter_graph_free(&filter_graph);
 	avcodec_free_context(&decoderctx);
 	avcodec_free_context(&encoderctx);
+	direct.close();
 
 	pipeline = false;
 }
 
-int Player::configure_filters(){
-	AVFilterInOut *outputs = nullptr, *inputs = nullptr;
+int Player::encoder_frame_size(){
+	return direct.is_open() ? direct.get_frame_size() : encoderctx -> frame_size;
+}
 
-	avfilter_graph_free(&filter_graph);
+int Player::encoder_complexity(){
+	int limit = context -> get_governor() -> get_complexity();
 
-	filter_src = nullptr;
-	filter_sink = nullptr;
+	return complexity < limit ? complexity : limit;
+}
+
+int Player::encoder_den(){
+	/* direct packets are timed in samples */
+	return pipeline && encoderctx ? encoderctx -> time_base.den : audio_out.sample_rate;
+}
+
+int Player::filter_chain(std::string& chain, std::string& key){
+	char format[160];
+	int ret = 0;
+
+	snprintf(format, sizeof(format), "%d:%d:%d:%" PRIx64 ">%d:%d:%d:%" PRIx64 "/%d",
+		audio_in.sample_rate, audio_in.fmt, audio_in.channels, audio_in.channel_layout,
+		audio_out.sample_rate, audio_out.fmt, audio_out.channels, audio_out.channel_layout, encoder_frame_size());
+	mutex.lock();
+
+	try{
+		chain.clear();
+
+		if(graph_rate)
+			chain += "," + rate.to_string(audio_in, audio_out);
+		if(graph_tempo)
+			chain += "," + tempo.to_string(audio_in, audio_out);
+		key = format + chain;
+	}catch(std::bad_alloc& e){
+		ret = AVERROR(ENOMEM);
+	}
+
+	mutex.unlock();
+
+	return ret;
+}
 
-	filter_graph = avfilter_graph_alloc();
+int Player::create_filters(const std::string& chain, const AudioFormat& in, const AudioFormat& out, int frame_size,
+							AVFilterGraph** graph, AVFilterContext** src, AVFilterContext** sink){
+	AVFilterInOut *outputs = nullptr, *inputs = nullptr;
+
+	*src = nullptr;
+	*sink = nullptr;
+	*graph = avfilter_graph_alloc();
 
-	if(!filter_graph)
+	if(!*graph)
 		return AVERROR(ENOMEM);
-	filter_graph -> nb_threads = 1;
+	(*graph) -> nb_threads = 1;
 
-	int64_t channel_layouts[] = {audio_out.channel_layout, -1};
-	int sample_rates[] = {audio_out.sample_rate, -1};
-	int channels[] = {audio_out.channels, -1};
-	int sample_fmts[] = {audio_out.fmt, -1};
+	int64_t channel_layouts[] = {out.channel_layout, -1};
+	int sample_rates[] = {out.sample_rate, -1};
+	int channels[] = {out.channels, -1};
+	int sample_fmts[] = {out.fmt, -1};
 
 	char filter_args[256];
 
 	snprintf(filter_args, sizeof(filter_args), "sample_rate=%d:sample_fmt=%d:channels=%d:channel_layout=0x%" PRIx64,
-												audio_in.sample_rate, audio_in.fmt, audio_in.channels, audio_in.channel_layout);
+												in.sample_rate, in.fmt, in.channels, in.channel_layout);
 	int ret;
 
-	if((ret = avfilter_graph_create_filter(&filter_src, avfilter_get_by_name("abuffer"), nullptr, filter_args, nullptr, filter_graph)) < 0)
+	if((ret = avfilter_graph_create_filter(src, avfilter_get_by_name("abuffer"), nullptr, filter_args, nullptr, *graph)) < 0)
 		goto failfilter;
-	if((ret = avfilter_graph_create_filter(&filter_sink, avfilter_get_by_name("abuffersink"), nullptr, nullptr, nullptr, filter_graph)) < 0)
+	if((ret = avfilter_graph_create_filter(sink, avfilter_get_by_name("abuffersink"), nullptr, nullptr, nullptr, *graph)) < 0)
 		goto failfilter;
-	if((ret = av_opt_set_int(filter_sink, "all_channel_counts", 0, AV_OPT_SEARCH_CHILDREN)) < 0)
+	if((ret = av_opt_set_int(*sink, "all_channel_counts", 0, AV_OPT_SEARCH_CHILDREN)) < 0)
 		goto failfilter;
-	if((ret = av_opt_set_int_list(filter_sink, "sample_fmts", sample_fmts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+	if((ret = av_opt_set_int_list(*sink, "sample_fmts", sample_fmts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
 		goto failfilter;
-	if((ret = av_opt_set_int_list(filter_sink, "channel_layouts", channel_layouts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+	if((ret = av_opt_set_int_list(*sink, "channel_layouts", channel_layouts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
 		goto failfilter;
-	if((ret = av_opt_set_int_list(filter_sink, "channel_counts", channels, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+	if((ret = av_opt_set_int_list(*sink, "channel_counts", channels, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
 		goto failfilter;
-	if((ret = av_opt_set_int_list(filter_sink, "sample_rates", sample_rates, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+	if((ret = av_opt_set_int_list(*sink, "sample_rates", sample_rates, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
 		goto failfilter;
-	if(filters_set()){
+	if(!chain.empty()){
 		outputs = avfilter_inout_alloc();
 		inputs = avfilter_inout_alloc();
 
@@ -200,12 +439,12 @@ int Player::configure_filters(){
 		}
 
 		outputs -> name = av_strdup("in");
-		outputs -> filter_ctx = filter_src;
+		outputs -> filter_ctx = *src;
 		outputs -> pad_idx = 0;
 		outputs -> next = nullptr;
 
 		inputs -> name = av_strdup("out");
-		inputs -> filter_ctx = filter_sink;
+		inputs -> filter_ctx = *sink;
 		inputs -> pad_idx = 0;
 		inputs -> next = nullptr;
 
@@ -215,37 +454,13 @@ int Player::configure_filters(){
 			goto failgraph;
 		}
 
-		mutex.lock();
-
-		ret = 0;
-
-		try{
-			std::string filter("");
-
-			if(rate.is_set())
-				filter += "," + rate.to_string(audio_in, audio_out);
-			if(tempo.is_set())
-				filter += "," + tempo.to_string(audio_in, audio_out);
-			if(tremolo.is_set())
-				filter += "," + tremolo.to_string(audio_in, audio_out);
-			if(volume.is_set())
-				filter += "," + volume.to_string(audio_in, audio_out);
-			if(equalizer.is_set())
-				filter += "," + equalizer.to_string(audio_in, audio_out);
-			ret = avfilter_graph_parse_ptr(filter_graph, filter.c_str() + 1, &inputs, &outputs, nullptr);
-		}catch(std::bad_alloc& e){
-			ret = AVERROR(ENOMEM);
-		}
-
-		mutex.unlock();
-
-		if(ret < 0)
+		if((ret = avfilter_graph_parse_ptr(*graph, chain.c_str() + 1, &inputs, &outputs, nullptr)) < 0)
 			goto failgraph;
-	}else if((ret = avfilter_link(filter_src, 0, filter_sink, 0)) < 0)
+	}else if((ret = avfilter_link(*src, 0, *sink, 0)) < 0)
 		goto failfilter;
-	if((ret = avfilter_graph_config(filter_graph, nullptr)) < 0)
+	if((ret = avfilter_graph_config(*graph, nullptr)) < 0)
 		goto failgraph;
-	av_buffersink_set_frame_size(filter_sink, encoderctx -> frame_size);
+	av_buffersink_set_frame_size(*sink, frame_size);
 
 	return 0;
 
@@ -256,121 +471,466 @@ int Player::configure_filters(){
 
 	failfilter:
 
-	avfilter_graph_free(&filter_graph);
+	avfilter_graph_free(graph);
+
+	*src = nullptr;
+	*sink = nullptr;
 
 	return ret;
 }
 
-int Player::read_packet(){
-	int err;
+int Player::configure_filters(){
+	std::string chain, key;
+	timespec start, end;
+	double ms;
+	bool hit = false;
+	int ret;
 
-	while(!b_stop){
-		if(encoder_has_data){
-			err = avcodec_receive_packet(encoderctx, packet);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	avfilter_graph_free(&filter_graph);
 
-			if(err == AVERROR(EAGAIN))
-				encoder_has_data = false;
-			else if(err)
-				return err;
-			else
-				break;
-		}
+	filter_src = nullptr;
+	filter_sink = nullptr;
 
-		if(filter_has_data){
-			err = av_buffersink_get_frame(filter_sink, frame);
+	graph_rate = !native_stretch && rate.is_set();
+	graph_tempo = !native_stretch && tempo.is_set();
+
+	if((ret = filter_chain(chain, key)) < 0)
+		return ret;
+	/* a build still queued is dropped, one already running is waited for */
+	context -> io.wait(&spare_job, false);
+
+	if(spare_graph && key == spare_key){
+		/* negotiated ahead of time and never fed */
+		filter_graph = spare_graph;
+		filter_src = spare_src;
+		filter_sink = spare_sink;
+		spare_graph = nullptr;
+		hit = true;
+	}else{
+		avfilter_graph_free(&spare_graph);
+
+		if((ret = create_filters(chain, audio_in, audio_out, encoder_frame_size(), &filter_graph, &filter_src, &filter_sink)) < 0)
+			return ret;
+	}
 
-			if(err == AVERROR(EAGAIN))
-				filter_has_data = false;
-			else if(err)
-				return err;
-			else{
-				err = avcodec_send_frame(encoderctx, frame);
+	spare_key.swap(key);
+	spare_countdown = pooled ? SPARE_GRAPH_DELAY : 0;
 
-				av_frame_unref(frame);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-				if(err) return err;
+	ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1'000'000.0;
 
-				encoder_has_data = true;
+	mutex.lock();
+	filter_stats.rebuilds++;
+	filter_stats.rebuild_time += ms;
+	filter_stats.rebuild_last = ms;
+
+	if(ms > filter_stats.rebuild_max)
+		filter_stats.rebuild_max = ms;
+	if(hit)
+		filter_stats.spare_hits++;
+	else
+		filter_stats.spare_misses++;
+	mutex.unlock();
 
-				continue;
-			}
-		}
+	return 0;
+}
 
-		if(decoder_has_data){
-			err = avcodec_receive_frame(decoderctx, frame);
+void Player::prepare_spare(){
+	std::string chain, key;
 
-			if(err == AVERROR(EAGAIN))
-				decoder_has_data = false;
-			else if(err)
-				return err;
-			else{
-				AVRational tb = {1, frame -> sample_rate};
+	if(spare_graph || filter_chain(chain, key) < 0 || key != spare_key)
+		return;
+	/* the job is idle, configure_filters waited for it */
+	spare_chain.swap(chain);
+	spare_in = audio_in;
+	spare_out = audio_out;
+	spare_frame_size = encoder_frame_size();
 
-				if(frame -> pts != AV_NOPTS_VALUE)
-					frame -> pts = av_rescale_q(frame -> pts, decoderctx -> pkt_timebase, tb);
-				else if(last_pts != AV_NOPTS_VALUE)
-					frame -> pts = av_rescale_q(last_pts, last_tb, tb);
-				if(frame -> pts != AV_NOPTS_VALUE){
-					last_pts = frame -> pts + frame -> nb_samples;
-					last_tb = tb;
-				}
+	context -> io.submit(&spare_job);
+}
 
-				bool channel_fmt_neq = false;
+void Player::build_spare(){
+	/* best effort, failing only costs the next rebuild its head start */
+	if(!spare_graph)
+		create_filters(spare_chain, spare_in, spare_out, spare_frame_size, &spare_graph, &spare_src, &spare_sink);
+}
 
-				if(frame -> channels != audio_in.channels){
-					channel_fmt_neq = true;
-				}else if(audio_in.channels == 1){
-					if(av_get_packed_sample_fmt((AVSampleFormat)frame -> format) != av_get_packed_sample_fmt((AVSampleFormat)audio_in.fmt))
-						channel_fmt_neq = true;
-				}else if(frame -> format != audio_in.fmt){
-					channel_fmt_neq = true;
-				}
+void Player::discard_spare(){
+	context -> io.wait(&spare_job, false);
+	avfilter_graph_free(&spare_graph);
 
-				if(channel_fmt_neq || frame -> sample_rate != audio_in.sample_rate || frame -> channel_layout != audio_in.channel_layout || filters_neq()){
-					audio_in.fmt = frame -> format;
-					audio_in.channels = frame -> channels;
-					audio_in.channel_layout = frame -> channel_layout;
-					audio_in.sample_rate = frame -> sample_rate;
+	spare_src = nullptr;
+	spare_sink = nullptr;
+	spare_countdown = 0;
+}
 
-					filters_seteq();
+int Player::update_filters(){
+	char value[32], response[64];
+	int ret;
 
-					err = configure_filters();
+	mutex.lock();
+	snprintf(value, sizeof(value), "%f", tempo.get());
+	mutex.unlock();
 
-					if(err)
-						return err;
-				}
+	if((ret = avfilter_graph_send_command(filter_graph, "atempo", "tempo", value, response, sizeof(response), 0)) < 0)
+		return ret;
+	tempo.reset_change();
 
-				if(filter_graph){
-					err = av_buffersrc_add_frame(filter_src, frame);
-					filter_has_data = true;
-				}else{
-					err = avcodec_send_frame(encoderctx, frame);
-					encoder_has_data = true;
+	mutex.lock();
+	filter_stats.commands++;
+	mutex.unlock();
 
-					if(!err)
-						av_frame_unref(frame);
-				}
+	return 0;
+}
 
-				if(err){
-					av_frame_unref(frame);
+int Player::apply_effects(AVFrame* frm){
+	float gain, depth, hz;
+	int err = 0;
 
-					return err;
-				}
+	/* the governor's last resort, volume stays */
+	bool optional = context -> get_governor() -> effects_allowed();
 
-				continue;
-			}
-		}
+	mutex.lock();
+	gain = volume.get();
+	tremolo.get(depth, hz);
 
-		err = av_read_frame(format_ctx, packet);
+	if(equalizer.is_changed()){
+		/* the bank crossfades from the old settings */
+		err = eq_bank.set(equalizer.get().data(), equalizer.get().size());
+		equalizer.reset_change();
+	}
 
-		if(err) return err;
+	mutex.unlock();
 
-		time = (double)packet -> pts / stream -> time_base.den;
-		time -= time_start;
+	if(err < 0)
+		return AVERROR(ENOMEM);
+	if(!optional)
+		depth = 0;
+	effects.update(gain, depth, hz, frm -> sample_rate);
 
-		bool destroy_pipeline = false;
+	if(effects.idle() && (!optional || eq_bank.idle()))
+		return 0;
+	if((err = av_frame_make_writable(frm)) < 0)
+		return err;
+	float* samples = (float*)frm -> data[0];
 
-		if(filters_set()){
+	if(effects.process(samples, frm -> nb_samples, frm -> channels, frm -> sample_rate) < 0)
+		return AVERROR(ENOMEM);
+	if(optional && eq_bank.process(samples, frm -> nb_samples, frm -> channels, frm -> sample_rate) < 0)
+		return AVERROR(ENOMEM);
+	return 0;
+}
+
+bool Player::stretching(){
+	return native_stretch && (rate.is_set() || tempo.is_set());
+}
+
+int Player::write_stretched(AVFrame* frm){
+	float speed, pace;
+	int err = 0;
+
+	mutex.lock();
+	speed = rate.get();
+	pace = tempo.get();
+	mutex.unlock();
+
+	if(speed <= 0 || pace <= 0)
+		err = AVERROR(EINVAL);
+	else if(stretcher.write((float*)frm -> data[0], frm -> nb_samples, frm -> channels, frm -> sample_rate, speed, pace) < 0)
+		err = AVERROR(ENOMEM);
+	av_frame_unref(frm);
+
+	return err;
+}
+
+int Player::read_stretched(AVFrame* frm){
+	int size = encoder_frame_size();
+	size_t bytes = (size_t)size * audio_out.channels * sizeof(float);
+
+	if(stretcher.available() < size)
+		return AVERROR(EAGAIN);
+	if(bytes != stretch_pool_size){
+		/* buffers still in flight free themselves once returned */
+		av_buffer_pool_uninit(&stretch_pool);
+
+		stretch_pool_size = 0;
+		stretch_pool = av_buffer_pool_init(bytes, nullptr);
+
+		if(!stretch_pool)
+			return AVERROR(ENOMEM);
+		stretch_pool_size = bytes;
+	}
+
+	frm -> buf[0] = av_buffer_pool_get(stretch_pool);
+
+	if(!frm -> buf[0])
+		return AVERROR(ENOMEM);
+	frm -> format = AV_SAMPLE_FMT_FLT;
+	frm -> channels = audio_out.channels;
+	frm -> channel_layout = audio_out.channel_layout;
+	frm -> sample_rate = audio_out.sample_rate;
+	frm -> nb_samples = size;
+	frm -> data[0] = frm -> buf[0] -> data;
+	frm -> extended_data = frm -> data;
+	frm -> linesize[0] = bytes;
+
+	stretcher.read((float*)frm -> data[0], size);
+
+	/* timing comes from the demuxed packets, the encoder only needs durations */
+	frm -> pts = AV_NOPTS_VALUE;
+
+	return 0;
+}
+
+int Player::send_frame(AVFrame* frm){
+	int err;
+
+	if((err = apply_effects(frm)) < 0){
+		av_frame_unref(frm);
+
+		return err;
+	}
+
+	/* overlays skip the main source's effects and share its encoder */
+	if(mixer.active()){
+		if((err = av_frame_make_writable(frm)) >= 0)
+			err = mixer.process((float*)frm -> data[0], frm -> nb_samples, frm -> channels, frm -> sample_rate);
+		if(err < 0){
+			av_frame_unref(frm);
+
+			return err;
+		}
+	}
+
+	if(direct.is_open()){
+		err = direct.encode(frm, packet, context -> get_pool());
+		direct_ready = !err;
+	}else
+		err = avcodec_send_frame(encoderctx, frm);
+	av_frame_unref(frm);
+
+	if(err) return err;
+
+	encoder_has_data = true;
+
+	return 0;
+}
+
+int Player::receive_packet(AVPacket* pkt){
+	if(!direct.is_open())
+		return avcodec_receive_packet(encoderctx, pkt);
+	/* the direct encoder writes its one packet per frame straight into pkt */
+	if(!direct_ready || !pkt -> buf)
+		return AVERROR(EAGAIN);
+	direct_ready = false;
+
+	return 0;
+}
+
+int Player::read_frame(AVPacket* pkt){
+	OpusDemuxer* native = (OpusDemuxer*)format_ctx -> opaque;
+	int64_t resume;
+	int err;
+
+	if(!native)
+		return av_read_frame(format_ctx, pkt);
+	err = native -> read(pkt);
+
+	if(!err)
+		native_packets++;
+	if(err != AVERROR_PATCHWELCOME && err != AVERROR_INVALIDDATA)
+		return err;
+	/* libavformat resyncs at the cue before where the native demuxer stopped and skips up to it */
+	resume = native -> get_time();
+	detach_native(format_ctx);
+
+	if(avformat_seek_file(format_ctx, stream -> index, INT64_MIN, resume, resume, 0) < 0)
+		return err;
+	while(!(err = av_read_frame(format_ctx, pkt)) && pkt -> pts != AV_NOPTS_VALUE && pkt -> pts + pkt -> duration <= resume)
+		av_packet_unref(pkt);
+	return err;
+}
+
+int Player::seek_input(int64_t time){
+	OpusDemuxer* native = (OpusDemuxer*)format_ctx -> opaque;
+	int err;
+
+	if(native){
+		err = native -> seek(time);
+
+		if(err >= 0 || err == AVERROR_EXIT)
+			return err;
+		detach_native(format_ctx);
+	}
+
+	return avformat_seek_file(format_ctx, stream -> index, time - 1, time, time + 1, 0);
+}
+
+int Player::demux(AVPacket* pkt){
+	long den;
+	double t;
+	ulong track;
+	int err;
+
+	if(!staged)
+		return read_frame(pkt);
+	if(!pooled)
+		return demuxed.pop(pkt, den, t, track, true);
+	/* never wait on a worker, EAGAIN parks the player until the io threads catch up */
+	err = demuxed.pop(pkt, den, t, track);
+
+	if((!err || err == AVERROR(EAGAIN)) && !demux_ended && demuxed.low())
+		context -> io.submit(&demux_job);
+	return err;
+}
+
+int Player::read_source_packet(){
+	int err;
+
+	while(!b_stop){
+		if(encoder_has_data){
+			err = receive_packet(packet);
+
+			if(err == AVERROR(EAGAIN))
+				encoder_has_data = false;
+			else if(err)
+				return err;
+			else{
+				if(spare_countdown && !--spare_countdown)
+					prepare_spare();
+				break;
+			}
+		}
+
+		if(stretch_has_data){
+			err = read_stretched(frame);
+
+			if(err == AVERROR(EAGAIN))
+				stretch_has_data = false;
+			else if(err)
+				return err;
+			else if((err = send_frame(frame)) < 0)
+				return err;
+			else
+				continue;
+		}
+
+		if(filter_has_data){
+			err = av_buffersink_get_frame(filter_sink, frame);
+
+			if(err == AVERROR(EAGAIN))
+				filter_has_data = false;
+			else if(err)
+				return err;
+			else{
+				bool stretch = stretching();
+
+				if(stretch != stretch_active){
+					/* samples held back by the old path are dropped */
+					stretcher.reset();
+					stretch_active = stretch;
+				}
+
+				/* the sink hands out packed float at the output format */
+				if(stretch){
+					if((err = write_stretched(frame)) < 0)
+						return err;
+					stretch_has_data = true;
+				}else if((err = send_frame(frame)) < 0)
+					return err;
+				continue;
+			}
+		}
+
+		if(decoder_has_data){
+			err = avcodec_receive_frame(decoderctx, frame);
+
+			/* eof only follows the flush before switching inputs */
+			if(err == AVERROR(EAGAIN) || err == AVERROR_EOF)
+				decoder_has_data = false;
+			else if(err)
+				return err;
+			else{
+				AVRational tb = {1, frame -> sample_rate};
+
+				if(frame -> pts != AV_NOPTS_VALUE)
+					frame -> pts = av_rescale_q(frame -> pts, decoderctx -> pkt_timebase, tb);
+				else if(last_pts != AV_NOPTS_VALUE)
+					frame -> pts = av_rescale_q(last_pts, last_tb, tb);
+				if(frame -> pts != AV_NOPTS_VALUE){
+					last_pts = frame -> pts + frame -> nb_samples;
+					last_tb = tb;
+				}
+
+				bool channel_fmt_neq = false;
+
+				if(frame -> channels != audio_in.channels){
+					channel_fmt_neq = true;
+				}else if(audio_in.channels == 1){
+					if(av_get_packed_sample_fmt((AVSampleFormat)frame -> format) != av_get_packed_sample_fmt((AVSampleFormat)audio_in.fmt))
+						channel_fmt_neq = true;
+				}else if(frame -> format != audio_in.fmt){
+					channel_fmt_neq = true;
+				}
+
+				bool rebuild = channel_fmt_neq || frame -> sample_rate != audio_in.sample_rate || frame -> channel_layout != audio_in.channel_layout || filters_neq();
+
+				/* same topology, only the tempo moved */
+				if(!rebuild && graph_tempo && tempo.is_changed() && update_filters() < 0)
+					rebuild = true;
+				if(rebuild){
+					audio_in.fmt = frame -> format;
+					audio_in.channels = frame -> channels;
+					audio_in.channel_layout = frame -> channel_layout;
+					audio_in.sample_rate = frame -> sample_rate;
+
+					filters_seteq();
+
+					err = configure_filters();
+
+					if(err)
+						return err;
+				}
+
+				if(filter_graph){
+					err = av_buffersrc_add_frame(filter_src, frame);
+					filter_has_data = true;
+				}else
+					err = send_frame(frame);
+
+				if(err){
+					av_frame_unref(frame);
+
+					return err;
+				}
+
+				continue;
+			}
+		}
+
+		err = demux(packet);
+
+		if(err == AVERROR_EOF && pipeline && !input_drained && has_next()){
+			/* the decoder's last frames play out before the next input takes over */
+			input_drained = true;
+
+			if((err = avcodec_send_packet(decoderctx, nullptr)) < 0)
+				return err;
+			decoder_has_data = true;
+
+			continue;
+		}
+
+		if(err) return err;
+
+		read_time = (double)packet -> pts / stream -> time_base.den;
+		read_time -= time_start;
+
+		bool destroy_pipeline = false;
+
+		if(filters_set()){
 			if(!pipeline && (err = init_pipeline()) < 0)
 				return err;
 		}else{
@@ -382,8 +942,9 @@ int Player::read_packet(){
 			if(encoder_id == AV_CODEC_ID_OPUS){
 				int sample_rate = 48000, /* opus is always 48KHz */
 					channels = opus_packet_get_nb_channels(packet -> data),
-					samples = opus_packet_get_samples_per_frame(packet -> data, sample_rate);
-				if(samples == OPUS_INVALID_PACKET)
+					/* all frames in the packet, the source may use any duration or pack several */
+					samples = opus_packet_get_nb_samples(packet -> data, packet -> size, sample_rate);
+				if(samples < 0)
 					return AVERROR_INVALIDDATA;
 				if(channels == audio_out.channels && sample_rate == audio_out.sample_rate)
 					packet -> duration = samples;
@@ -413,286 +974,1183 @@ int Player::read_packet(){
 	return 0;
 }
 
-void Player::run(){
-	AVDictionary* options = nullptr;
-	std::string local_url;
+int Player::read_input(){
+	PacketCache* cache = context -> get_cache();
+	uint64_t sample;
+	int err;
 
-	bool local_isfile;
+	if(cache_reader.is_open()){
+		err = cache_reader.read(packet, context -> get_pool(), sample);
 
-	int err = AVERROR(ENOMEM);
-	int stream_index;
+		if(!err)
+			read_time = (double)sample / audio_out.sample_rate;
+		return err;
+	}
 
-	timespec sleep, now;
+	if(cache_writer.is_open() && filters_set())
+		/* filtered output is not cached */
+		cache -> abort(cache_writer);
+	err = read_source_packet();
 
-	if(!frame)
-		frame = av_frame_alloc();
-	if(!packet)
-		packet = av_packet_alloc();
-	if(!frame || !packet)
-		goto end;
-	format_ctx = avformat_alloc_context();
+	if(err == AVERROR(EAGAIN))
+		/* picked up where it left off once the demux job has packets */
+		return err;
+	if(cache_writer.is_open()){
+		if(err == AVERROR_EOF)
+			cache -> commit(cache_writer);
+		else if(err || (packet -> size && cache_writer.write(packet) < 0))
+			cache -> abort(cache_writer);
+	}
 
-	if(!format_ctx)
-		goto end;
-	format_ctx -> interrupt_callback.callback = decode_interrupt;
-	format_ctx -> interrupt_callback.opaque = this;
+	return err;
+}
 
-	if((err = av_dict_set(&options, "user_agent", "", AV_DICT_MATCH_CASE)) < 0)
-		goto end;
-	if((err = av_dict_set(&options, "scan_all_pmts", "1", AV_DICT_MATCH_CASE)) < 0)
-		goto end;
-	if((err = av_dict_set(&options, "reconnect", "1", AV_DICT_MATCH_CASE)) < 0)
-		goto end;
-	if((err = av_dict_set(&options, "reconnect_on_network_error", "1", AV_DICT_MATCH_CASE)) < 0)
-		goto end;
-	if((err = av_dict_set(&options, "reconnect_delay_max", "2", AV_DICT_MATCH_CASE)) < 0)
-		goto end;
-	if((err = av_dict_set(&options, "icy", "0", AV_DICT_MATCH_CASE)) < 0)
-		goto end;
-	error.str.clear();
+int Player::read_packet(){
+	int err;
+
+	if(queue_changed)
+		start_preopen();
+	/* counted across calls, pooled players come back here from an io thread for every switch */
+	while(empty_inputs <= MAX_EMPTY_INPUTS){
+		if(!advance_wanted){
+			err = read_input();
+
+			if(err != AVERROR_EOF){
+				if(!err)
+					empty_inputs = 0;
+				return err;
+			}
+
+			if(pooled && !offloading){
+				/* opening the next input may hit the network, hand it to an io thread */
+				advance_wanted = true;
+
+				return AVERROR(EAGAIN);
+			}
+		}
+
+		advance_wanted = false;
+		empty_inputs++;
+
+		/* the next input takes over at the packet boundary */
+		if((err = advance()) < 0)
+			return err;
+	}
+
+	empty_inputs = 0;
+
+	return AVERROR_EOF;
+}
+
+bool Player::next_input(QueueEntry& entry){
+	if(loop == LOOP_TRACK || (queue.empty() && loop == LOOP_QUEUE)){
+		entry.url = url;
+		entry.isfile = isfile;
+		entry.id = current_id;
+
+		return !url.empty();
+	}
+
+	if(queue.empty())
+		return false;
+	entry = queue.front();
+
+	return true;
+}
+
+bool Player::has_next(){
+	bool ret;
 
 	mutex.lock();
-	local_url = std::move(url);
-	local_isfile = isfile;
+	ret = !queue.empty() || (loop != LOOP_NONE && !url.empty());
+	mutex.unlock();
+
+	return ret;
+}
+
+void Player::start_preopen(){
+	QueueEntry entry;
+	bool found = false;
+
+	queue_changed = false;
+	mutex.lock();
+
+	try{
+		found = next_input(entry);
+	}catch(std::bad_alloc& e){}
+
 	mutex.unlock();
 
-	format_ctx -> protocol_whitelist = isfile ? av_strdup("file,http,https,tcp,tls,crypto") : av_strdup("http,https,tcp,tls,crypto");
+	if(found && entry.id == current_id && (cache_reader.is_open() || cache_writer.is_open()))
+		/* a looping track comes back through the cache, the source is not needed again */
+		found = false;
+	if(preopening && found && preopen_entry.id == entry.id)
+		return;
+	discard_preopen();
+
+	if(!found)
+		return;
+	preopen_entry = std::move(entry);
+
+	if(pooled){
+		context -> io.submit(&preopen_job);
+		preopening = true;
+	}else if(!preopener.start())
+		preopening = true;
+}
+
+/* a preopen still waiting for an io thread is run here when its input is wanted, dropped otherwise */
+void Player::join_preopen(bool run){
+	if(pooled)
+		context -> io.wait(&preopen_job, run);
+	else
+		preopener.join();
+	preopening = false;
+}
+
+void Player::discard_preopen(){
+	if(!preopening)
+		return;
+	preopen_abort = true;
+	join_preopen(false);
+	preopen_abort = false;
+
+	close_input(&next_ctx);
+}
+
+void Player::preopen_thread(){
+	next_index = open_input(preopen_entry.url, preopen_entry.isfile, preopen_interrupt, &next_ctx);
+}
+
+int Player::advance(){
+	AVFormatContext* ctx = nullptr, *old;
+	QueueEntry entry;
+	int err, index = 0;
+	bool found = false, cached = false;
+
+	mutex.lock();
+
+	try{
+		found = next_input(entry);
+	}catch(std::bad_alloc& e){}
+
+	mutex.unlock();
+
+	if(!found)
+		return AVERROR_EOF;
+	if(entry.id == current_id){
+		/* a looping track that was played back or recorded from the cache plays from it again */
+		if(cache_reader.is_open()){
+			cache_reader.seek(0);
+			cached = true;
+		}else
+			cached = !open_cache();
+	}else
+		/* queued tracks are cached under their own url, a miss starts recording them */
+		cached = !open_cache(entry.url);
+
+	if(cached)
+		discard_preopen();
+	else if(preopening && preopen_entry.id == entry.id){
+		/* usually done long ago, otherwise waits for the rest of the probe */
+		join_preopen(true);
+		ctx = next_ctx;
+		index = next_index;
+		next_ctx = nullptr;
+	}else{
+		discard_preopen();
+		index = open_input(entry.url, entry.isfile, decode_interrupt, &ctx);
+	}
+
+	if(index < 0){
+		close_input(&ctx);
+		context -> get_cache() -> abort(cache_writer);
+
+		return index;
+	}
+
+	mutex.lock();
+
+	if(!queue.empty() && queue.front().id == entry.id)
+		queue.pop_front();
+	if(loop == LOOP_QUEUE && entry.id != current_id){
+		try{
+			queue.push_back({url, isfile, ++queue_ids});
+		}catch(std::bad_alloc& e){}
+	}
+
+	if(entry.id != current_id)
+		/* the key named the track being left */
+		cache_key.clear();
+	url.swap(entry.url);
+	isfile = entry.isfile;
+	current_id = entry.id;
+	mutex.unlock();
+
+	/* the demuxer stopped at eof, it starts over on the new input */
+	if(demuxing){
+		join_demuxer();
+		demuxed.reset();
+		demuxing = false;
+	}
+
+	if(!cached){
+		cache_reader.close();
+
+		if(pooled)
+			/* a pooled player never reads its input on the worker */
+			staged = true;
+	}
+
+	old = format_ctx;
+
+	/* js reads these under the mutex, the pacing side only once the reader is joined */
+	mutex.lock();
+	format_ctx = ctx;
+
+	if(ctx)
+		set_input(index);
+	else
+		stream = nullptr;
+	mutex.unlock();
+
+	close_input(&old);
+
+	/* the encoder, filters and secret box carry on, only the decoder follows the new stream */
+	if(cached)
+		err = 0;
+	else if(pipeline){
+		avcodec_free_context(&decoderctx);
+		err = open_decoder();
+	}else if(stream -> codecpar -> codec_id != encoder_id)
+		err = init_pipeline();
+	else
+		err = 0;
+	if(err < 0)
+		return err;
+	decoder_has_data = false;
+	input_drained = false;
+
+	if(staged && !cached){
+		if((err = start_demuxer()))
+			return AVERROR(err);
+		demuxing = true;
+	}
+
+	/* handed to the pacing side with the new input's first packet */
+	mutex.lock();
+
+	try{
+		next_durations.push_back(input_duration);
+	}catch(std::bad_alloc& e){}
+
+	mutex.unlock();
+
+	tracks_read++;
+	start_preopen();
+
+	return 0;
+}
+
+int Player::open_cache(){
+	std::string source;
+
+	mutex.lock();
+
+	try{
+		source = cache_key.empty() ? url : cache_key;
+	}catch(std::bad_alloc& e){}
+
+	mutex.unlock();
+
+	return open_cache(source);
+}
+
+int Player::open_cache(const std::string& source){
+	PacketCache* cache = context -> get_cache();
+	CacheFormat format;
+	std::string key;
+
+	if(!cache -> is_enabled() || encoder_id != AV_CODEC_ID_OPUS || filters_set())
+		return AVERROR(ENOENT);
+	format.channels = audio_out.channels;
+	format.sample_rate = audio_out.sample_rate;
+	format.bitrate = bitrate;
+	format.frame_size = frame_size;
+
+	try{
+		key = PacketCache::make_key(source, format);
+	}catch(std::bad_alloc& e){}
+
+	if(key.empty())
+		return AVERROR(ENOMEM);
+	if(!cache -> lookup(key, format, cache_reader)){
+		input_duration = (double)cache_reader.get_samples() / audio_out.sample_rate;
+		time_start = 0;
+
+		return 0;
+	}
+
+	/* record this playback so the next one can skip ffmpeg */
+	cache -> begin(key, format, cache_writer);
+
+	return AVERROR(ENOENT);
+}
+
+int Player::update_encoder(){
+	bool rebitrate = b_bitrate, retune = b_tuning;
+	int err, level = context -> get_governor() -> get_level();
+
+	if(level != governed_level && direct.is_open()){
+		/* the governor moved, only the live opus encoder follows it */
+		governed_level = level;
+		retune = true;
+	}
+
+	if(!rebitrate && !retune)
+		return 0;
+	b_bitrate = false;
+	b_tuning = false;
+
+	if(rebitrate)
+		/* packets at another bitrate don't belong in this entry */
+		context -> get_cache() -> abort(cache_writer);
+	if(!pipeline)
+		return 0;
+	if(direct.is_open()){
+		/* applied to the live encoder, no reset */
+		if(rebitrate && (err = direct.set_bitrate(bitrate)) < 0)
+			return err;
+		if(retune && ((err = direct.set_complexity(encoder_complexity())) < 0 || (err = direct.set_signal(signal)) < 0))
+			return err;
+		return 0;
+	}
+
+	avcodec_close(encoderctx);
+
+	encoderctx -> bit_rate = bitrate;
+	encoderctx -> compression_level = complexity;
+
+	return avcodec_open2(encoderctx, encoder, nullptr);
+}
+
+void Player::set_stages(){
+	if(pooled){
+		/* the io threads demux ahead, as far as buffer ahead asks for, decoding and encoding stay on the worker */
+		staged = !cache_reader.is_open();
+		buffered = false;
+		demuxed.set_capacity(buffer_ahead > DEMUX_AHEAD ? buffer_ahead : DEMUX_AHEAD);
+
+		return;
+	}
+
+	/* a staged pipeline always encodes on the reader thread */
+	staged = pipelined && !cache_reader.is_open();
+	buffered = buffer_ahead > 0 || staged;
+}
+
+int Player::start_demuxer(){
+	if(!pooled)
+		return demuxer.start();
+	demux_ended = false;
+	context -> io.submit(&demux_job);
+
+	return 0;
+}
+
+void Player::join_demuxer(){
+	if(pooled)
+		context -> io.wait(&demux_job, false);
+	else
+		demuxer.join();
+	demux_ended = false;
+}
+
+int Player::start_reader(){
+	int err;
+
+	/* a track played back from the cache has no input to demux */
+	if(staged && !demuxing && !cache_reader.is_open()){
+		if((err = start_demuxer()))
+			return AVERROR(err);
+		demuxing = true;
+	}
+
+	if(buffered && !reading){
+		if((err = reader.start()))
+			return AVERROR(err);
+		reading = true;
+	}
+
+	return 0;
+}
+
+void Player::stop_reader(bool interrupt){
+	if(!reading && !demuxing)
+		return;
+	/* only abort blocking io when the input is about to be closed */
+	reader_interrupt = interrupt;
+	jitter.abort();
+	demuxed.abort();
+
+	if(reading)
+		reader.join();
+	if(demuxing)
+		join_demuxer();
+	jitter.reset();
+	demuxed.reset();
+	reader_interrupt = false;
+	reading = false;
+	demuxing = false;
+
+	av_packet_unref(packet);
+	av_packet_unref(demux_packet);
+}
+
+void Player::reader_thread(){
+	int err;
+	long den;
+
+	do{
+		err = update_encoder();
+
+		if(err >= 0){
+			uint64_t cpu = thread_cpu_ns();
+
+			err = read_packet();
+			read_cpu += thread_cpu_ns() - cpu;
+		}
+
+		if(err >= 0 && !should_run())
+			err = AVERROR_EXIT;
+		if(err >= 0){
+			den = encoder_den();
+			err = jitter.push(packet, den, read_time, tracks_read);
+		}
+
+		if(err < 0)
+			jitter.finish(err);
+		mutex.lock();
+
+		if(buffering)
+			wake();
+		mutex.unlock();
+	}while(err >= 0);
+}
+
+void Player::demux_thread(){
+	int err;
+
+	do{
+		err = read_frame(demux_packet);
+
+		if(!err && !should_run())
+			err = AVERROR_EXIT;
+		if(!err)
+			err = demuxed.push(demux_packet, stream -> time_base.den, 0, 0);
+		if(err)
+			demuxed.finish(err);
+	}while(!err);
+}
+
+void Player::demux_ahead(){
+	int err = 0;
+
+	if(demux_ended)
+		return;
+	/* fill the buffer and return, the worker submits the job again when it runs low */
+	while(!err && !demuxed.full()){
+		err = read_frame(demux_packet);
+
+		if(!err && !should_run())
+			err = AVERROR_EXIT;
+		if(!err)
+			err = demuxed.push(demux_packet, stream -> time_base.den, 0, 0);
+		if(err){
+			demuxed.finish(err);
+			demux_ended = true;
+		}
+
+		mutex.lock();
+
+		if(buffering)
+			wake();
+		mutex.unlock();
+	}
+}
+
+int Player::probe_input(const std::string& u, bool f, int (*interrupt)(void*), AVFormatContext** ctx, const std::string& hint, bool fast, long size, long analyze){
+	AVDictionary* options = nullptr;
+	AVFormatContext* fmt;
+	AVCodecParameters* par;
+
+	/* the const qualifier differs between ffmpeg versions */
+	decltype(av_find_input_format("")) input_format = nullptr;
+
+	int err = AVERROR(ENOMEM);
+	int index;
+
+	*ctx = avformat_alloc_context();
+
+	if(!*ctx)
+		goto end;
+	fmt = *ctx;
+	fmt -> interrupt_callback.callback = interrupt;
+	fmt -> interrupt_callback.opaque = this;
+
+	if((err = av_dict_set(&options, "user_agent", "", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if((err = av_dict_set(&options, "scan_all_pmts", "1", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if((err = av_dict_set(&options, "reconnect", "1", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if((err = av_dict_set(&options, "reconnect_on_network_error", "1", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if((err = av_dict_set(&options, "reconnect_delay_max", "2", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if((err = av_dict_set(&options, "icy", "0", AV_DICT_MATCH_CASE)) < 0)
+		goto end;
+	if(fast){
+		size = size > 0 ? size : (long)FAST_PROBE_SIZE;
+		analyze = analyze > 0 ? analyze : (long)FAST_ANALYZE_MS;
+	}
+
+	if(size > 0 && (err = av_dict_set_int(&options, "probesize", size, 0)) < 0)
+		goto end;
+	if(analyze > 0 && (err = av_dict_set_int(&options, "analyzeduration", analyze * 1000, 0)) < 0)
+		goto end;
+	if(!hint.empty())
+		input_format = av_find_input_format(hint.c_str());
+	fmt -> protocol_whitelist = f ? av_strdup("file,http,https,tcp,tls,crypto") : av_strdup("http,https,tcp,tls,crypto");
+
+	if(!fmt -> protocol_whitelist){
+		err = AVERROR(ENOMEM);
+
+		goto end;
+	}
+
+	/* frees the context on failure */
+	err = avformat_open_input(ctx, u.c_str(), input_format, &options);
+
+	av_dict_free(&options);
+
+	if(err)
+		return err;
+	if(fast){
+		index = av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+
+		if(index >= 0){
+			par = fmt -> streams[index] -> codecpar;
+
+			/* webm, mp4 and mp3 headers carry everything the decoder needs */
+			if(par -> codec_id != AV_CODEC_ID_NONE && par -> sample_rate > 0 && par -> channels > 0){
+				for(int i = 0; i < (int)fmt -> nb_streams; i++)
+					fmt -> streams[i] -> discard = i == index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+				context -> get_probe_cache() -> report_skip();
+
+				return index;
+			}
+		}
+	}
+
+	for(int i = 0; i < fmt -> nb_streams; i++){
+		AVStream* stream = fmt -> streams[i];
+
+		if(stream -> codecpar -> codec_type != AVMEDIA_TYPE_AUDIO)
+			stream -> discard = AVDISCARD_ALL;
+	}
+
+	if((err = avformat_find_stream_info(fmt, nullptr)) < 0)
+		return err;
+	for(int i = 0; i < fmt -> nb_streams; i++){
+		AVStream* stream = fmt -> streams[i];
+
+		stream -> discard = AVDISCARD_ALL;
+	}
+
+	index = av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+
+	if(index >= 0)
+		fmt -> streams[index] -> discard = AVDISCARD_DEFAULT;
+	return index;
+
+	end:
+
+	av_dict_free(&options);
+
+	return err;
+}
+
+int Player::open_input(const std::string& u, bool f, int (*interrupt)(void*), AVFormatContext** ctx){
+	ProbeCache* probes = context -> get_probe_cache();
+	ProbeInfo info;
+	std::string key, hint;
+	bool fast, native, learned = false;
+	long size, analyze;
+	int index;
+
+	mutex.lock();
+	fast = fast_start;
+	native = native_demux;
+	size = probe_size;
+	analyze = analyze_duration;
+
+	try{
+		hint = format_hint;
+	}catch(std::bad_alloc& e){}
+
+	mutex.unlock();
+
+	try{
+		key = ProbeCache::make_key(u, f);
+
+		if(fast && hint.empty() && !key.empty() && probes -> lookup(key, info)){
+			hint = std::move(info.format);
+			learned = true;
+		}
+	}catch(std::bad_alloc& e){}
+
+	index = probe_input(u, f, interrupt, ctx, hint, fast, size, analyze);
+
+	if(index < 0 && learned && index != AVERROR_EXIT && !interrupt(this)){
+		/* the host may serve something else now, probe from scratch */
+		probes -> forget(key);
+		close_input(ctx);
+		index = probe_input(u, f, interrupt, ctx, std::string(), fast, size, analyze);
+	}
+
+	if(index >= 0 && !key.empty() && (*ctx) -> iformat){
+		try{
+			/* the first of the demuxer's names finds it again */
+			info.format = (*ctx) -> iformat -> name;
+			info.format.resize(info.format.find(',') == std::string::npos ? info.format.size() : info.format.find(','));
+			probes -> store(key, info);
+		}catch(std::bad_alloc& e){}
+	}
+
+	if(index >= 0 && native)
+		attach_native(*ctx, index);
+	return index;
+}
+
+void Player::attach_native(AVFormatContext* ctx, int index){
+	OpusDemuxer* native;
+
+	if(!OpusDemuxer::supported(ctx, ctx -> streams[index]))
+		return;
+	native = new (std::nothrow) OpusDemuxer();
+
+	if(!native)
+		return;
+	/* anything it does not handle stays with libavformat */
+	if(native -> open(ctx, ctx -> streams[index], context -> get_pool()) < 0){
+		delete native;
+
+		return;
+	}
+
+	ctx -> opaque = native;
+}
+
+void Player::set_input(int index){
+	stream = format_ctx -> streams[index];
+
+	if(stream -> duration != AV_NOPTS_VALUE)
+		input_duration = (double)stream -> duration / stream -> time_base.den;
+	else if(format_ctx -> duration != AV_NOPTS_VALUE)
+		input_duration = (double)format_ctx -> duration / AV_TIME_BASE;
+	else
+		/* not known without the stream info probe */
+		input_duration = 0;
+	if(format_ctx -> start_time != AV_NOPTS_VALUE)
+		time_start = (double)format_ctx -> start_time / AV_TIME_BASE;
+	else
+		time_start = 0;
+}
+
+int Player::open(){
+	std::string local_url;
+
+	bool local_isfile;
+
+	int err;
+
+	error.str.clear();
+
+	if(!frame)
+		frame = av_frame_alloc();
+	if(!packet)
+		packet = av_packet_alloc();
+	if(!ahead_packet)
+		ahead_packet = av_packet_alloc();
+	if(!demux_packet)
+		demux_packet = av_packet_alloc();
+	if(!frame || !packet || !ahead_packet || !demux_packet)
+		return AVERROR(ENOMEM);
+	input_drained = false;
+	advance_wanted = false;
+	empty_inputs = 0;
+
+	if(!open_cache()){
+		start_preopen();
+
+		return 0;
+	}
+
+	mutex.lock();
+	local_url = std::move(url);
+	local_isfile = isfile;
+	mutex.unlock();
+
+	err = open_input(local_url, local_isfile, decode_interrupt, &format_ctx);
+
+	mutex.lock();
+
+	if(url.empty())
+		url = std::move(local_url);
+	mutex.unlock();
+
+	if(err < 0){
+		switch(err){
+			case AVERROR(EINVAL):
+				error.str += "Invalid input file";
+
+				break;
+			case AVERROR(EIO):
+				error.str += "Could not open input file";
+
+				break;
+		}
+
+		return err;
+	}
+
+	set_input(err);
+
+	if(stream -> codecpar -> codec_id != encoder_id && (err = init_pipeline()) < 0)
+		return err;
+	audio_in.reset();
+	decoder_has_data = false;
+	encoder_has_data = false;
+	filter_has_data = false;
+	stretch_has_data = false;
+	direct_ready = false;
+
+	start_preopen();
+
+	return 0;
+}
+
+void Player::fail(int err){
+	if(error.str.empty()){
+		char errbuf[128];
+
+		av_strerror(err, errbuf, sizeof(errbuf));
+
+		error.str += errbuf;
+	}
+
+	error.code = err;
+
+	callback_wrap([&]{
+		callbacks -> error(this, error.str, error.code);
+
+		return 0;
+	}, false);
+}
+
+bool Player::blocking(){
+	switch(state){
+		case STATE_OPEN:
+			return true;
+		case STATE_READ:
+			/* packets come from the demux job, only seeking, reopening and moving to the next input block here */
+			return b_seek || advance_wanted || (cache_reader.is_open() && (filters_set() || b_bitrate));
+		default:
+			return false;
+	}
+}
+
+void Player::offload_step(){
+	int ret;
+
+	do
+		ret = run_step();
+	while(ret == STEP_CONTINUE && blocking());
+
+	offload_ret = ret;
+}
+
+void Player::offload_done(){
+	mutex.lock();
+	offloading = false;
+	offloaded = true;
+	wake();
+	mutex.unlock();
+}
+
+int Player::step(){
+	if(pooled){
+		bool busy;
+
+		mutex.lock();
+		busy = offloading;
+		mutex.unlock();
+
+		if(busy)
+			return STEP_WAIT;
+		if(offloaded){
+			/* the worker takes the player back where the io thread stopped */
+			offloaded = false;
+
+			if(offload_ret != STEP_CONTINUE)
+				return offload_ret;
+		}
+
+		if(blocking()){
+			/* opening, reading, seeking and reopening do network io, keep them off the workers */
+			mutex.lock();
+			offloading = true;
+			mutex.unlock();
+			context -> io.submit(&step_job);
+
+			return STEP_WAIT;
+		}
+	}
+
+	return run_step();
+}
+
+int Player::run_step(){
+	int err;
+
+	timespec now;
+
+	switch(state){
+		case STATE_IDLE:
+			if(destroyed)
+				return STEP_EXIT;
+			if(b_stop && !b_start)
+				return STEP_WAIT;
+			state = STATE_OPEN;
+
+			return STEP_CONTINUE;
+		case STATE_OPEN:
+			err = open();
+			set_stages();
+			state = STATE_CLOSE;
+
+			if(err){
+				fail(err);
+
+				return STEP_CONTINUE;
+			}
+
+			mutex.lock();
+			duration = input_duration;
+			next_durations.clear();
+			mutex.unlock();
+
+			tracks_emitted = tracks_read;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+			/* includes the wait for a worker or an io thread */
+			mutex.lock();
+			ready_time = (deadline.tv_sec - started.tv_sec) * 1e3 + (deadline.tv_nsec - started.tv_nsec) / 1e6;
+			mutex.unlock();
+			context -> get_probe_cache() -> report_ready(ready_time);
+			err = callback_wrap([&]{
+				return callbacks -> ready(this);
+			});
+
+			if(err)
+				return STEP_CONTINUE;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+			state = STATE_READ;
+
+			return STEP_CONTINUE;
+		case STATE_READ:
+			state = STATE_CLOSE;
+
+			if(!should_run())
+				return STEP_CONTINUE;
+			if(!buffered && (err = update_encoder()) < 0){
+				fail(err);
+
+				return STEP_CONTINUE;
+			}
+
+			if(cache_reader.is_open() && (filters_set() || b_bitrate)){
+				/* cached packets can't be changed, continue from the source */
+				stop_reader(false);
+				cache_reader.close();
+
+				/* the new encoder is opened with the current bitrate */
+				b_bitrate = false;
 
-	if(format_ctx -> protocol_whitelist)
-		err = avformat_open_input(&format_ctx, local_url.c_str(), nullptr, &options);
-	mutex.lock();
+				if((err = open()) < 0){
+					fail(err);
 
-	if(url.empty())
-		url = std::move(local_url);
-	mutex.unlock();
+					return STEP_CONTINUE;
+				}
 
-	av_dict_free(&options);
+				set_stages();
+				seek_to = time;
+				b_seek = true;
+			}
 
-	if(err){
-		switch(err){
-			case AVERROR(EINVAL):
-				error.str += "Invalid input file";
+			if(b_seek){
+				int64_t time;
 
-				break;
-			case AVERROR(EIO):
-				error.str += "Could not open input file";
+				/* the reader owns the demuxer and codecs until joined */
+				stop_reader(false);
 
-				break;
-			default:
-				goto end;
-		}
+				/* only uninterrupted playbacks are cached */
+				context -> get_cache() -> abort(cache_writer);
 
-		error.code = err;
+				if(cache_reader.is_open()){
+					cache_reader.seek(seek_to * audio_out.sample_rate);
+					err = 0;
+				}else{
+					time = (int64_t)((seek_to + time_start) * stream -> time_base.den);
+					err = seek_input(time);
+				}
 
-		goto err;
-	}
+				b_seek = false;
+				/* the input being left is read again from the seek point */
+				advance_wanted = false;
 
-	for(int i = 0; i < format_ctx -> nb_streams; i++){
-		AVStream* stream = format_ctx -> streams[i];
+				if(!should_run())
+					return STEP_CONTINUE;
+				if(!err){
+					err = callback_wrap([&]{
+						return callbacks -> seeked(this);
+					});
 
-		if(stream -> codecpar -> codec_type != AVMEDIA_TYPE_AUDIO)
-			stream -> discard = AVDISCARD_ALL;
-	}
+					if(err)
+						return STEP_CONTINUE;
+					if(pipeline)
+						avcodec_flush_buffers(decoderctx);
+					input_drained = false;
+					stretcher.reset();
+					stretch_has_data = false;
+					if(filter_graph && (err = configure_filters()) < 0){
+						fail(err);
+
+						return STEP_CONTINUE;
+					}
+				}
 
-	if((err = avformat_find_stream_info(format_ctx, nullptr)) < 0)
-		goto end;
-	for(int i = 0; i < format_ctx -> nb_streams; i++){
-		AVStream* stream = format_ctx -> streams[i];
+				if(offloading){
+					/* seeked on an io thread, reading goes back to the worker */
+					state = STATE_READ;
 
-		stream -> discard = AVDISCARD_ALL;
-	}
+					return STEP_CONTINUE;
+				}
+			}
 
-	stream_index = av_find_best_stream(format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+			if((err = start_reader()) < 0){
+				fail(err);
 
-	if(stream_index < 0){
-		err = stream_index;
+				return STEP_CONTINUE;
+			}
 
-		goto end;
-	}
+			if(buffered){
+				err = jitter.pop(ahead_packet, packet_den, time, out_track);
 
-	stream = format_ctx -> streams[stream_index];
-	stream -> discard = AVDISCARD_DEFAULT;
+				if(err == AVERROR(EAGAIN)){
+					mutex.lock();
+					buffering = true;
+					mutex.unlock();
 
-	if(stream -> duration != AV_NOPTS_VALUE)
-		duration = (double)stream -> duration / stream -> time_base.den;
-	else
-		duration = (double)format_ctx -> duration / AV_TIME_BASE;
-	if(format_ctx -> start_time != AV_NOPTS_VALUE)
-		time_start = (double)format_ctx -> start_time / AV_TIME_BASE;
-	else
-		time_start = 0;
-	if(stream -> codecpar -> codec_id != encoder_id && (err = init_pipeline()) < 0)
-		goto end;
-	audio_in.reset();
-	decoder_has_data = false;
-	encoder_has_data = false;
-	filter_has_data = false;
+					state = STATE_BUFFER;
 
-	err = callback_wrap([&]{
-		return callbacks -> ready(this);
-	});
+					return STEP_WAIT;
+				}
 
-	if(err)
-		return;
-	clock_gettime(CLOCK_MONOTONIC, &sleep);
+				out_packet = ahead_packet;
+			}else{
+				uint64_t cpu = thread_cpu_ns();
+
+				err = read_packet();
+				read_cpu += thread_cpu_ns() - cpu;
+				time = read_time;
+				packet_den = encoder_den();
+				out_packet = packet;
+				out_track = tracks_read;
+			}
+
+			if(!should_run())
+				return STEP_CONTINUE;
+			if(err == AVERROR(EAGAIN)){
+				if(advance_wanted){
+					/* step() hands the switch to the next input to an io thread */
+					state = STATE_READ;
 
-	while(should_run()){
-		if(b_bitrate){
-			b_bitrate = false;
+					return STEP_CONTINUE;
+				}
 
-			if(pipeline){
-				avcodec_close(encoderctx);
+				/* the demux job wakes the player once it has packets */
+				mutex.lock();
+				buffering = true;
+				mutex.unlock();
 
-				encoderctx -> bit_rate = bitrate;
+				state = STATE_BUFFER;
 
-				if((err = avcodec_open2(encoderctx, encoder, nullptr)) < 0)
-					goto end;
+				return STEP_WAIT;
 			}
-		}
 
-		if(b_seek){
-			int64_t time;
+			if(err < 0){
+				if(err == AVERROR_EOF){
+					err = callback_wrap([&]{
+						return callbacks -> finish(this);
+					});
 
-			time = (int64_t)((seek_to + time_start) * stream -> time_base.den);
-			err = avformat_seek_file(format_ctx, stream_index, time - 1, time, time + 1, 0);
-			b_seek = false;
+					if(err)
+						return STEP_CONTINUE;
+					state = STATE_FINISHED;
 
-			if(!should_run())
-				break;
-			if(!err){
-				err = callback_wrap([&]{
-					return callbacks -> seeked(this);
-				});
+					return STEP_WAIT;
+				}
 
-				if(err)
-					break;
-				if(pipeline)
-					avcodec_flush_buffers(decoderctx);
-				if(filter_graph && (err = configure_filters()) < 0)
-					goto end;
+				if(err != AVERROR_EXIT)
+					fail(err);
+				return STEP_CONTINUE;
 			}
-		}
 
-		err = read_packet();
+			if(b_pause){
+				state = STATE_PAUSED;
 
-		if(!should_run())
-			break;
-		if(err < 0){
-			if(err == AVERROR_EOF){
-				err = callback_wrap([&]{
-					return callbacks -> finish(this);
-				});
+				return STEP_WAIT;
+			}
 
-				if(err)
-					break;
-				wait_cond([&](){
-					return should_run() && !b_seek;
-				});
+			state = STATE_EMIT;
 
-				if(!should_run())
-					break;
-				continue;
-			}
+			return STEP_CONTINUE;
+		case STATE_FINISHED:
+			state = should_run() ? STATE_READ : STATE_CLOSE;
 
-			if(err == AVERROR_EXIT)
-				break;
-			goto end;
-		}
+			return STEP_CONTINUE;
+		case STATE_BUFFER:
+			mutex.lock();
+			buffering = false;
+			mutex.unlock();
 
-		if(b_pause){
-			wait_cond([&]{
-				return b_pause && should_run();
-			});
+			state = should_run() ? STATE_READ : STATE_CLOSE;
+
+			return STEP_CONTINUE;
+		case STATE_PAUSED:
+			state = STATE_CLOSE;
 
 			if(!should_run())
-				break;
+				return STEP_CONTINUE;
 			err = callback_wrap([&]{
 				return callbacks -> unpaused(this);
 			});
 
 			if(err)
-				break;
-			clock_gettime(CLOCK_MONOTONIC, &sleep);
-		}
+				return STEP_CONTINUE;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
 
-		long dur = packet -> duration,
-			den = pipeline ? encoderctx -> time_base.den : audio_out.sample_rate;
-		if(dur < 0)
-			dur = 0; /* should never happen but just in case */
-		if(den <= 0){
-			error.str += "Fatal error: den <= 0";
-			err = AVERROR_EXIT;
+			state = STATE_EMIT;
 
-			goto err;
-		}
+			return STEP_CONTINUE;
+		case STATE_EMIT:
+			state = STATE_CLOSE;
 
-		err = callback_wrap([&]{
-			return callbacks -> packet(this, packet);
-		});
+			if(out_track != tracks_emitted){
+				/* the first packet of a queued input goes out now */
+				mutex.lock();
 
-		av_packet_unref(packet);
+				for(; tracks_emitted != out_track; tracks_emitted++){
+					if(next_durations.empty())
+						continue;
+					duration = next_durations.front();
+					next_durations.pop_front();
+				}
 
-		if(err)
-			break;
-		sleep.tv_nsec += dur * 1'000'000'000 / den;
+				mutex.unlock();
 
-		if(sleep.tv_nsec > 1'000'000'000){
-			sleep.tv_sec += sleep.tv_nsec / 1'000'000'000;
-			sleep.tv_nsec %= 1'000'000'000;
-		}
+				err = callback_wrap([&]{
+					return callbacks -> next(this);
+				});
 
-		clock_gettime(CLOCK_MONOTONIC, &now);
+				if(err)
+					return STEP_CONTINUE;
+			}
 
-		if(now.tv_sec > sleep.tv_sec || (now.tv_sec == sleep.tv_sec && now.tv_nsec > sleep.tv_nsec)){
-			unsigned long time = (now.tv_sec - sleep.tv_sec) * 1'000'000'000 + now.tv_nsec - sleep.tv_nsec;
+			packet_duration = out_packet -> duration;
 
-			dropped_samples += time * den / 1'000'000'000;
-			sleep = now;
-		}else{
-			mutex.lock();
-			cond.wait(mutex, sleep);
-			mutex.unlock();
+			if(packet_duration < 0)
+				packet_duration = 0; /* should never happen but just in case */
+			if(packet_den <= 0){
+				error.str += "Fatal error: den <= 0";
+				fail(AVERROR_EXIT);
 
-			if(!should_run())
-				break;
-		}
+				return STEP_CONTINUE;
+			}
 
-		total_samples += dur;
-		total_packets++;
-		err = callback_wrap([&]{
-			return callbacks -> send_packet(this);
-		});
+			err = callback_wrap([&]{
+				return callbacks -> packet(this, out_packet);
+			});
 
-		if(err == AVERROR(EAGAIN))
-			dropped_samples += dur;
-		else if(err)
-			break;
-	}
+			av_packet_unref(out_packet);
 
-	return;
+			if(err)
+				return STEP_CONTINUE;
+			deadline.tv_nsec += packet_duration * 1'000'000'000 / packet_den;
 
-	end:
+			if(deadline.tv_nsec > 1'000'000'000){
+				deadline.tv_sec += deadline.tv_nsec / 1'000'000'000;
+				deadline.tv_nsec %= 1'000'000'000;
+			}
 
-	av_dict_free(&options);
+			state = STATE_SEND;
 
-	if(!err)
-		return;
-	else{
-		char errbuf[128];
+			clock_gettime(CLOCK_MONOTONIC, &now);
 
-		av_strerror(err, errbuf, sizeof(errbuf));
+			if(now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec > deadline.tv_nsec)){
+				unsigned long time = (now.tv_sec - deadline.tv_sec) * 1'000'000'000 + now.tv_nsec - deadline.tv_nsec;
 
-		error.str += errbuf;
-		error.code = err;
-	}
+				dropped_samples += time * packet_den / 1'000'000'000;
+				deadline = now;
+				context -> get_governor() -> report(true, read_cpu.exchange(0));
 
-	err:
+				return STEP_CONTINUE;
+			}
 
-	callback_wrap([&]{
-		callbacks -> error(this, error.str, error.code);
+			context -> get_governor() -> report(false, read_cpu.exchange(0));
 
-		return 0;
-	}, false);
+			return STEP_SLEEP;
+		case STATE_SEND:
+			state = STATE_CLOSE;
+
+			if(!should_run())
+				return STEP_CONTINUE;
+			total_samples += packet_duration;
+			total_packets++;
+			err = callback_wrap([&]{
+				return callbacks -> send_packet(this);
+			});
+
+			if(err == AVERROR(EAGAIN))
+				dropped_samples += packet_duration;
+			else if(err)
+				return STEP_CONTINUE;
+			state = STATE_READ;
+
+			return STEP_CONTINUE;
+		case STATE_CLOSE:
+		default:
+			cleanup();
+
+			b_stop = !b_start;
+			b_start = false;
+			state = STATE_IDLE;
+
+			return STEP_CONTINUE;
+	}
 }
 
 template<class T>
@@ -704,30 +2162,43 @@ int Player::callback_wrap(T t, bool run){
 }
 
 void Player::cleanup(){
-	avformat_close_input(&format_ctx);
+	stop_reader(true);
+	discard_preopen();
+	cache_reader.close();
+	context -> get_cache() -> abort(cache_writer);
+	close_input(&format_ctx);
 	pipeline_destroy();
 
 	if(packet)
 		av_packet_unref(packet);
+	if(ahead_packet)
+		av_packet_unref(ahead_packet);
 }
 
 void Player::player_thread(){
-	while(!destroyed){
-		if(b_stop && !b_start){
-			wait_cond([&]{
-				return !destroyed && b_stop && !b_start;
-			});
-		}
+	int ret;
 
-		if(destroyed)
-			break;
-		run();
-		cleanup();
+	while((ret = step()) != STEP_EXIT){
+		switch(ret){
+			case STEP_SLEEP:
+				mutex.lock();
+				cond.wait(mutex, deadline);
+				mutex.unlock();
+
+				break;
+			case STEP_WAIT:
+				wait_cond([&]{
+					return parked();
+				});
 
-		b_stop = !b_start;
-		b_start = false;
+				break;
+		}
 	}
 
+	exit();
+}
+
+void Player::exit(){
 	mutex.lock();
 	running = false;
 	mutex.unlock();
@@ -740,9 +2211,46 @@ bool Player::should_run(){
 	return !destroyed && !b_stop;
 }
 
+bool Player::parked(){
+	if(offloading)
+		return true;
+	switch(state){
+		case STATE_IDLE:
+			return !destroyed && b_stop && !b_start;
+		case STATE_PAUSED:
+			return b_pause && should_run();
+		case STATE_FINISHED:
+			return should_run() && !b_seek;
+		case STATE_BUFFER:
+			return should_run() && !b_seek && !(buffered ? jitter.ready() : demuxed.ready());
+		default:
+			return false;
+	}
+}
+
+void Player::park(){
+	mutex.lock();
+
+	/* recheck under the lock so a wakeup between step() and here is not lost */
+	if(parked())
+		queued = false;
+	else
+		context -> scheduler.schedule(this);
+	mutex.unlock();
+}
+
+void Player::wake(){
+	if(!pooled)
+		cond.signal();
+	else if(!queued){
+		queued = true;
+		context -> scheduler.schedule(this);
+	}
+}
+
 void Player::signal_cond(){
 	mutex.lock();
-	cond.signal();
+	wake();
 	mutex.unlock();
 }
 
@@ -755,7 +2263,7 @@ void Player::wait_cond(T t){
 	mutex.unlock();
 }
 
-Player::Player(PlayerContext* ctx, PlayerCallbacks* c, void* d): cond(CLOCK_MONOTONIC), thread(s_player_thread, this){
+Player::Player(PlayerContext* ctx, PlayerCallbacks* c, void* d): cond(CLOCK_MONOTONIC), thread(s_player_thread, this), reader(s_reader_thread, this), demuxer(s_demux_thread, this), preopener(s_preopen_thread, this), queue_changed(false), tracks_read(0){
 	context = ctx;
 	next = nullptr;
 	prev = nullptr;
@@ -768,11 +2276,62 @@ Player::Player(PlayerContext* ctx, PlayerCallbacks* c, void* d): cond(CLOCK_MONO
 	time = 0;
 	time_start = 0;
 	duration = 0;
+	input_duration = 0;
 	dropped_samples = 0;
 	total_samples = 0;
 	total_packets = 0;
 	destroyed = false;
 	running = false;
+	pooled = false;
+	queued = false;
+	offloading = false;
+	offloaded = false;
+	offload_ret = STEP_CONTINUE;
+	step_job = {nullptr, s_offload_step, s_offload_done, this, 0};
+	preopen_job = {nullptr, s_preopen_thread, nullptr, this, 0};
+
+	state = STATE_IDLE;
+	timer.next = nullptr;
+	timer.player = this;
+	timer.expires = 0;
+	timer.deadline = 0;
+	packet_duration = 0;
+	packet_den = 0;
+
+	buffer_ahead = 0;
+	buffered = false;
+	reading = false;
+	reader_interrupt = false;
+	buffering = false;
+	read_time = 0;
+
+	demuxed.set_capacity(DEMUX_AHEAD);
+	pipelined = false;
+	staged = false;
+	demuxing = false;
+	demux_job = {nullptr, s_demux_job, nullptr, this, 0};
+	demux_ended = false;
+
+	fast_start = false;
+	probe_size = 0;
+	analyze_duration = 0;
+	started = {0, 0};
+	ready_time = 0;
+	native_demux = false;
+	native_packets = 0;
+
+	loop = LOOP_NONE;
+	queue_ids = 0;
+	current_id = 0;
+	tracks_emitted = 0;
+	out_track = 0;
+	next_ctx = nullptr;
+	next_index = 0;
+	preopening = false;
+	preopen_abort = false;
+	input_drained = false;
+	advance_wanted = false;
+	empty_inputs = 0;
 
 	pipeline = false;
 
@@ -781,7 +2340,14 @@ Player::Player(PlayerContext* ctx, PlayerCallbacks* c, void* d): cond(CLOCK_MONO
 	b_pause = false;
 	b_seek = false;
 	b_bitrate = false;
+	b_tuning = false;
 	bitrate = 0;
+	frame_size = 960;
+	complexity = 10;
+	signal = OPUS_AUTO;
+	governed_level = 0;
+	read_cpu = 0;
+	direct_ready = false;
 	seek_to = 0;
 
 	format_ctx = nullptr;
@@ -790,18 +2356,45 @@ Player::Player(PlayerContext* ctx, PlayerCallbacks* c, void* d): cond(CLOCK_MONO
 	filter_sink = nullptr;
 	stream = nullptr;
 
+	graph_rate = false;
+	graph_tempo = false;
+
+	spare_job = {nullptr, s_spare_job, nullptr, this, 0};
+	spare_graph = nullptr;
+	spare_src = nullptr;
+	spare_sink = nullptr;
+	spare_countdown = 0;
+	spare_frame_size = 0;
+
+	memset(&filter_stats, 0, sizeof(filter_stats));
+	stretch_pool = nullptr;
+	stretch_pool_size = 0;
+	native_stretch = false;
+	stretch_active = false;
+	stretch_has_data = false;
+
 	decoderctx = nullptr;
 	encoderctx = nullptr;
 
 	frame = nullptr;
 	packet = nullptr;
+	ahead_packet = nullptr;
+	out_packet = nullptr;
+	demux_packet = nullptr;
 
 	audio_out.reset();
+	/* unset until setFormat, mix inputs are refused before then */
+	audio_out.channels = 0;
+	audio_out.sample_rate = 0;
 
 	error.str.reserve(256);
 }
 
 int Player::start(){
+	mutex.lock();
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	mutex.unlock();
+
 	if(running){
 		b_start = true;
 
@@ -810,6 +2403,20 @@ int Player::start(){
 		return 0;
 	}
 
+	pooled = context -> is_pooled();
+
+	if(pooled){
+		int err = context -> add(this);
+
+		if(err)
+			return err;
+		running = true;
+
+		signal_cond();
+
+		return 0;
+	}
+
 	int err = thread.start();
 
 	if(err)
@@ -827,15 +2434,89 @@ void Player::setURL(std::string _url, bool _isfile){
 	mutex.unlock();
 }
 
+void Player::setFastStart(bool fast){
+	mutex.lock();
+	fast_start = fast;
+	mutex.unlock();
+}
+
+void Player::setFormatHint(std::string format){
+	mutex.lock();
+	format_hint = format;
+	mutex.unlock();
+}
+
+void Player::setProbeLimits(long size, long analyze_ms){
+	mutex.lock();
+	probe_size = size > 0 ? size : 0;
+	analyze_duration = analyze_ms > 0 ? analyze_ms : 0;
+	mutex.unlock();
+}
+
+double Player::getReadyTime(){
+	double ms;
+
+	mutex.lock();
+	ms = ready_time;
+	mutex.unlock();
+
+	return ms;
+}
+
+void Player::enqueue(std::string u, bool f){
+	mutex.lock();
+
+	try{
+		queue.push_back({std::move(u), f, ++queue_ids});
+	}catch(std::bad_alloc& e){}
+
+	mutex.unlock();
+
+	queue_changed = true;
+}
+
+void Player::clearQueue(){
+	mutex.lock();
+	queue.clear();
+	mutex.unlock();
+
+	queue_changed = true;
+}
+
+void Player::setLoop(int mode){
+	mutex.lock();
+	loop = mode;
+	mutex.unlock();
+
+	queue_changed = true;
+}
+
+size_t Player::getQueueLength(){
+	size_t length;
+
+	mutex.lock();
+	length = queue.size();
+	mutex.unlock();
+
+	return length;
+}
+
+void Player::setCacheKey(std::string key){
+	mutex.lock();
+	cache_key = key;
+	mutex.unlock();
+}
+
 void Player::setOutputCodec(AVCodecID id){
 	encoder_id = id;
 	encoder = avcodec_find_encoder(encoder_id);
 }
 
-void Player::setFormat(int channels, int sample_rate, int brate){
+void Player::setFormat(int channels, int sample_rate, int brate, int frame_duration){
 	audio_out.channels = channels;
 	audio_out.sample_rate = sample_rate;
 	bitrate = brate;
+	frame_size = sample_rate * frame_duration / 1000;
 }
 
 double Player::getTime(){
@@ -845,7 +2526,13 @@ double Player::getTime(){
 }
 
 double Player::getDuration(){
-	return duration;
+	double d;
+
+	mutex.lock();
+	d = duration;
+	mutex.unlock();
+
+	return d;
 }
 
 long Player::getDroppedSamples(){
@@ -856,10 +2543,19 @@ long Player::getTotalSamples(){
 	return total_samples;
 }
 
+int Player::getFrameSize(){
+	return frame_size;
+}
+
 long Player::getTotalPackets(){
 	return total_packets;
 }
 
+JitterStats Player::getBufferStats(){
+	/* pooled players buffer ahead in the demux stage */
+	return pooled ? demuxed.get_stats() : jitter.get_stats();
+}
+
 void Player::setPaused(bool paused){
 	b_pause = paused;
 
@@ -868,12 +2564,14 @@ void Player::setPaused(bool paused){
 }
 
 void Player::seek(double time){
+	double d = getDuration();
+
 	seek_to = time;
 
 	if(seek_to < 0)
 		seek_to = 0;
-	else if(seek_to > duration)
-		seek_to = duration;
+	else if(seek_to > d)
+		seek_to = d;
 	b_seek = true;
 
 	signal_cond();
@@ -884,6 +2582,73 @@ void Player::setBitrate(int bt){
 	b_bitrate = true;
 }
 
+void Player::setComplexity(int c){
+	if(c < 0)
+		c = 0;
+	else if(c > 10)
+		c = 10;
+	complexity = c;
+	b_tuning = true;
+}
+
+void Player::setSignal(int s){
+	signal = s;
+	b_tuning = true;
+}
+
+void Player::setBufferAhead(long ms){
+	if(ms < 0)
+		ms = 0;
+	buffer_ahead = ms;
+	jitter.set_capacity(ms);
+}
+
+void Player::setPipelined(bool p){
+	pipelined = p;
+}
+
+FilterStats Player::getFilterStats(){
+	FilterStats stats;
+
+	mutex.lock();
+	stats = filter_stats;
+	mutex.unlock();
+
+	return stats;
+}
+
+void Player::setNativeStretch(bool n){
+	mutex.lock();
+	native_stretch = n;
+	mutex.unlock();
+}
+
+void Player::setNativeDemuxer(bool n){
+	mutex.lock();
+	native_demux = n;
+	mutex.unlock();
+}
+
+int Player::addMixInput(std::string u, bool f, float gain){
+	return mixer.add(u, f, gain, audio_out.channels, audio_out.sample_rate);
+}
+
+int Player::removeMixInput(int id){
+	return mixer.remove(id);
+}
+
+int Player::setMixInputGain(int id, float gain){
+	return mixer.set_gain(id, gain);
+}
+
+void Player::setDucking(float level, long ms){
+	mixer.set_ducking(level, ms);
+}
+
+MixerStats Player::getMixerStats(){
+	return mixer.get_stats();
+}
+
 void Player::setVolume(float v){
 	mutex.lock();
 	volume.set(v);
@@ -935,7 +2700,7 @@ void Player::destroy(){
 		destroyed = true;
 
 		if(running)
-			cond.signal();
+			wake();
 		else
 			free = true;
 	}
@@ -950,8 +2715,15 @@ bool Player::isCodecCopy(){
 	return !pipeline;
 }
 
+ulong Player::getNativePackets(){
+	return native_packets;
+}
+
 Player::~Player(){
 	cleanup();
 	av_packet_free(&packet);
+	av_packet_free(&ahead_packet);
+	av_packet_free(&demux_packet);
 	av_frame_free(&frame);
+	av_buffer_pool_uninit(&stretch_pool);
 }
\ No newline at end of file
@@ -1,7 +1,20 @@
 #pragma once
+#include <atomic>
+#include <deque>
 #include <string>
+#include <vector>
 #include "ffmpeg.h"
 #include "thread.h"
+#include "scheduler.h"
+#include "jitter.h"
+#include "pool.h"
+#include "cache.h"
+#include "dsp.h"
+#include "encoder.h"
+#include "governor.h"
+#include "mixer.h"
+#include "probe.h"
+#include "demuxer.h"
 
 class Player;
 struct PlayerCallbacks{
@@ -10,6 +23,7 @@ struct PlayerCallbacks{
 	int (*unpaused)(Player* player);
 	int (*packet)(Player* player, AVPacket* packet);
 	int (*send_packet)(Player* player);
+	int (*next)(Player* player); /* a queued input started */
 	int (*finish)(Player* player);
 	void (*error)(Player* player, const std::string& error, int code);
 };
@@ -65,15 +79,14 @@ public:
 	void set(float value){
 		new_value = value;
 	}
-};
 
-class VolumeFilter : public FloatFilter{
-public:
-	std::string to_string(AudioFormat in, AudioFormat out){
-		return "volume=" + std::to_string(value);
+	float get(){
+		return new_value;
 	}
 };
 
+class VolumeFilter : public FloatFilter{};
+
 class RateFilter : public FloatFilter{
 public:
 	std::string to_string(AudioFormat in, AudioFormat out){
@@ -126,54 +139,30 @@ public:
 		new_value.rate = rate;
 	}
 
-	std::string to_string(AudioFormat in, AudioFormat out){
-		return "tremolo=f=" + std::to_string(value.rate) + ":d=" + std::to_string(value.depth);
+	void get(float& depth, float& rate){
+		depth = new_value.depth;
+		rate = new_value.rate;
 	}
 };
 
-struct Equalizer{
-	double band;
-	double gain;
-};
-
 class EqualizerFilter : public Filter{
 protected:
-	std::string filter;
+	std::vector<Equalizer> bands;
 
-	bool b_set;
 	bool b_changed;
 public:
 	EqualizerFilter(){
-		b_set = false;
 		b_changed = false;
 	}
 
 	void set(Equalizer* eqs, size_t length){
-		filter.clear();
-
-		if(b_set || length)
+		if(!bands.empty() || length)
 			b_changed = true;
-		b_set = false;
-
-		if(!length)
-			return;
-		filter += "firequalizer=gain_entry='";
-
-		for(size_t i = 0; i < length; i++){
-			filter += "entry(" + std::to_string(eqs[i].band) + "," + std::to_string(eqs[i].gain);
-
-			if(i == length - 1)
-				filter += ")";
-			else
-				filter += ");";
-		}
-
-		filter += "'";
-		b_set = true;
+		bands.assign(eqs, eqs + length);
 	}
 
 	bool is_set(){
-		return b_set;
+		return !bands.empty();
 	}
 
 	bool is_changed(){
@@ -184,21 +173,53 @@ public:
 		b_changed = false;
 	}
 
-	std::string to_string(AudioFormat in, AudioFormat out){
-		return filter;
+	const std::vector<Equalizer>& get(){
+		return bands;
 	}
 };
 
+struct FilterStats{
+	ulong rebuilds;
+	ulong commands; /* parameter changes applied to a live graph */
+	ulong spare_hits; /* rebuilds served by the spare graph */
+	ulong spare_misses;
+
+	/* ms */
+	double rebuild_time;
+	double rebuild_last;
+	double rebuild_max;
+};
+
 class PlayerContext{
 private:
 	Player* list;
 	Mutex mutex;
+	Cond cond;
+
+	Scheduler scheduler;
+	IoPool io;
+	BufferPool pool;
+	PacketCache cache;
+	Governor governor;
+	ProbeCache probes;
 
-	void add(Player* player);
+	ulong pooled_players;
+
+	int add(Player* player);
 	void remove(Player* player);
 
 	friend class Player;
 public:
+	PlayerContext();
+
+	int set_workers(int threads, ulong tick, int io_threads);
+	bool is_pooled();
+	SchedulerStats get_scheduler_stats();
+	BufferPool* get_pool();
+	PacketCache* get_cache();
+	Governor* get_governor();
+	ProbeCache* get_probe_cache();
+
 	void wait_threads();
 };
 
@@ -216,7 +237,48 @@ private:
 		int code;
 	} error;
 
+	enum State{
+		STATE_IDLE = 0,
+		STATE_OPEN,
+		STATE_READ,
+		STATE_PAUSED,
+		STATE_EMIT,
+		STATE_SEND,
+		STATE_FINISHED,
+		STATE_BUFFER,
+		STATE_CLOSE
+	};
+
+	enum StepResult{
+		STEP_CONTINUE = 0, /* run the next step immediately */
+		STEP_SLEEP, /* run the next step at deadline */
+		STEP_WAIT, /* park until signalled */
+		STEP_EXIT /* player is done and can be freed */
+	};
+
+	enum{
+		/* queued inputs that end without a packet before the player gives up */
+		MAX_EMPTY_INPUTS = 16
+	};
+
+	enum{
+		/* fast start limits when none are given */
+		FAST_PROBE_SIZE = 64 * 1024,
+		FAST_ANALYZE_MS = 500
+	};
+
+	struct QueueEntry{
+		std::string url;
+		bool isfile;
+
+		ulong id;
+	};
+
 	Thread thread;
+	Thread reader;
+	Thread demuxer;
+	Thread preopener;
+	IoJob preopen_job; /* the preopen of pooled players, on the context's io threads */
 	Cond cond;
 	Mutex mutex;
 
@@ -227,6 +289,76 @@ private:
 	bool running;
 	bool destroyed;
 
+	bool pooled; /* driven by the context's scheduler instead of its own thread */
+	bool queued; /* in the scheduler's queue or being run by a worker */
+
+	/* steps that block on io run on the context's io threads so they never hold up a worker */
+	IoJob step_job;
+	bool offloading; /* queued or running on an io thread */
+	bool offloaded; /* finished and not taken back by a worker */
+	int offload_ret; /* what the last offloaded step returned */
+
+	int state;
+
+	TimerNode timer;
+	timespec deadline;
+	long packet_duration;
+	long packet_den;
+
+	/* decode ahead */
+	JitterBuffer jitter;
+	long buffer_ahead; /* ms, 0 reads each packet right before it is due */
+	bool buffered; /* buffer_ahead when the input was opened */
+	bool reading; /* reader thread started and not joined */
+	bool reader_interrupt;
+	bool buffering; /* pacing loop waiting for the reader */
+	double read_time;
+
+	/* staged pipeline, demux on its own thread ahead of decode and encode */
+	JitterBuffer demuxed;
+	bool pipelined;
+	bool staged; /* pipelined when the input was opened, always for pooled players */
+	bool demuxing; /* demux thread started and not joined */
+	IoJob demux_job; /* the demux stage of pooled players, run on the io threads whenever demuxed runs low */
+	std::atomic<bool> demux_ended; /* the demux job hit the end of the input or an error */
+
+	/* gapless queue, the next input is opened and probed while the current one plays */
+	std::deque<QueueEntry> queue;
+	int loop;
+	ulong queue_ids;
+	ulong current_id; /* entry the playing input came from */
+	std::atomic<bool> queue_changed;
+	std::atomic<ulong> tracks_read; /* inputs the reading side moved on to */
+	ulong tracks_emitted;
+	ulong out_track; /* input out_packet came from */
+	std::deque<double> next_durations; /* of inputs read but not played yet, oldest first */
+
+	QueueEntry preopen_entry;
+	AVFormatContext* next_ctx;
+	int next_index; /* stream index, or the error opening it */
+	bool preopening; /* preopen thread started and not joined */
+	bool preopen_abort;
+	bool input_drained; /* decoder flushed for the switch to the next input */
+	bool advance_wanted; /* a pooled player reached the end of its input, the next one is opened on an io thread */
+	int empty_inputs; /* inputs switched to since the last packet was read */
+
+	/* fast start */
+	bool fast_start; /* use learned formats and skip the stream info probe when the headers are enough */
+	std::string format_hint;
+	long probe_size; /* bytes, 0 for the default */
+	long analyze_duration; /* ms, 0 for the default */
+	timespec started; /* when start() was last called */
+	double ready_time; /* ms from the last start to ready */
+
+	/* webm and ogg opus are read without libavformat's demuxer once opened, opt in */
+	bool native_demux;
+	std::atomic<ulong> native_packets; /* read by it, for the tests */
+
+	/* packet cache */
+	std::string cache_key; /* identity of the source, defaults to the url */
+	CacheReader cache_reader; /* open when playing back from the cache */
+	CacheWriter cache_writer; /* open while recording a playback */
+
 	bool pipeline;
 
 	bool b_stop;
@@ -234,12 +366,19 @@ private:
 	bool b_pause;
 	bool b_seek;
 	bool b_bitrate;
+	bool b_tuning; /* complexity or signal changed */
 	int bitrate;
+	int frame_size; /* samples per encoded frame */
+	int complexity;
+	int signal;
+	int governed_level; /* governor level the encoder was last tuned for */
+	std::atomic<uint64_t> read_cpu; /* thread cpu ns spent reading since the last emit */
 	double seek_to;
 
 	double time;
 	double time_start;
-	double duration;
+	double duration; /* of the input being played */
+	double input_duration; /* of the input being read */
 	long dropped_samples;
 	long total_samples;
 	long total_packets;
@@ -249,6 +388,9 @@ private:
 	AVFormatContext* format_ctx;
 	AVStream* stream;
 	AVPacket* packet;
+	AVPacket* ahead_packet; /* popped from the jitter buffer */
+	AVPacket* out_packet; /* next packet to emit */
+	AVPacket* demux_packet;
 
 	AVFilterGraph* filter_graph;
 	AVFilterContext* filter_src;
@@ -264,8 +406,45 @@ private:
 
 	/* end filters */
 
+	/* tremolo, volume and the equalizer follow rate and tempo, so they always run natively on the graph's output */
+	AudioEffects effects;
+	EqualizerBank eq_bank;
+
+	/* graph topology */
+	bool graph_rate;
+	bool graph_tempo;
+
+	/* a negotiated, unused copy of the current graph, swapped in on the next rebuild with the same key */
+	IoJob spare_job; /* builds it on the io threads, pooled players only */
+	AVFilterGraph* spare_graph;
+	AVFilterContext* spare_src;
+	AVFilterContext* spare_sink;
+	std::string spare_key;
+	int spare_countdown;
+
+	/* what the spare job builds, only written while it is idle */
+	std::string spare_chain;
+	AudioFormat spare_in;
+	AudioFormat spare_out;
+	int spare_frame_size;
+
+	FilterStats filter_stats;
+
+	/* rate and tempo without the graph, opt in */
+	TimeStretch stretcher;
+	AVBufferPool* stretch_pool; /* output frames, one encoder frame each */
+	size_t stretch_pool_size;
+	bool native_stretch;
+	bool stretch_active;
+	bool stretch_has_data;
+
+	/* overlays summed into the output before it is encoded */
+	Mixer mixer;
+
 	AVCodecContext* decoderctx;
-	AVCodecContext* encoderctx;
+	AVCodecContext* encoderctx; /* codecs other than opus */
+	DirectEncoder direct; /* opus */
+	bool direct_ready; /* packet holds a freshly encoded packet */
 	AVFrame* frame;
 
 	AVCodecID encoder_id;
@@ -281,19 +460,82 @@ private:
 	AVRational last_tb;
 
 	static int decode_interrupt(void* p);
+	static int get_encode_buffer(AVCodecContext* ctx, AVPacket* pkt, int flags);
 	static void s_player_thread(void* p);
+	static void s_reader_thread(void* p);
+	static void s_demux_thread(void* p);
+	static void s_demux_job(void* p);
+	static void s_spare_job(void* p);
+	static void s_preopen_thread(void* p);
+	static void s_offload_step(void* p);
+	static void s_offload_done(void* p);
+	static int preopen_interrupt(void* p);
 
 	bool filters_neq();
 	bool filters_set();
 	void filters_seteq();
+	int open_decoder();
 	int init_pipeline();
 	void pipeline_destroy();
+	int filter_chain(std::string& chain, std::string& key);
+	static int create_filters(const std::string& chain, const AudioFormat& in, const AudioFormat& out, int frame_size,
+								AVFilterGraph** graph, AVFilterContext** src, AVFilterContext** sink);
 	int configure_filters();
+	void prepare_spare();
+	void build_spare();
+	void discard_spare();
+	int update_filters();
+	int apply_effects(AVFrame* frame);
+	bool stretching();
+	int write_stretched(AVFrame* frame);
+	int read_stretched(AVFrame* frame);
+	int send_frame(AVFrame* frame);
+	int receive_packet(AVPacket* packet);
+	int encoder_frame_size();
+	int encoder_den();
+	int encoder_complexity();
+	int read_frame(AVPacket* packet);
+	int seek_input(int64_t time);
+	int demux(AVPacket* packet);
+	int read_source_packet();
+	int read_input();
 	int read_packet();
-	void run();
+	bool next_input(QueueEntry& entry);
+	bool has_next();
+	void start_preopen();
+	void join_preopen(bool run);
+	void discard_preopen();
+	void preopen_thread();
+	int advance();
+	int open_cache();
+	int open_cache(const std::string& source);
+	int update_encoder();
+	void set_stages();
+	int start_demuxer();
+	void join_demuxer();
+	int start_reader();
+	void stop_reader(bool interrupt);
+	void reader_thread();
+	void demux_thread();
+	void demux_ahead();
+	int probe_input(const std::string& url, bool isfile, int (*interrupt)(void*), AVFormatContext** ctx, const std::string& hint, bool fast, long size, long analyze);
+	int open_input(const std::string& url, bool isfile, int (*interrupt)(void*), AVFormatContext** ctx);
+	void attach_native(AVFormatContext* ctx, int index);
+	void set_input(int index);
+	int open();
+	int step();
+	int run_step();
+	bool blocking();
+	void offload_step();
+	void offload_done();
+	void fail(int err);
 	void cleanup();
 	void player_thread();
+	void exit();
 	bool should_run();
+	bool parked();
+	void park();
+	void wake();
 
 	template<class T>
 	void wait_cond(T t);
@@ -305,7 +547,14 @@ private:
 	~Player();
 
 	friend class PlayerContext;
+	friend class Scheduler;
 public:
+	enum Loop{
+		LOOP_NONE = 0,
+		LOOP_TRACK, /* the current input repeats */
+		LOOP_QUEUE /* finished inputs go back to the end of the queue */
+	};
+
 	Mutex data_mutex;
 
 	void* data; /* user data ptr */
@@ -315,18 +564,43 @@ public:
 	int start();
 
 	void setURL(std::string url, bool isfile);
+	void setCacheKey(std::string key);
 	void setOutputCodec(AVCodecID codec);
-	void setFormat(int channels, int sample_rate, int bitrate);
+	void setFormat(int channels, int sample_rate, int bitrate, int frame_duration);
 
 	double getTime();
 	double getDuration();
 	long getDroppedSamples();
 	long getTotalSamples();
 	long getTotalPackets();
+	int getFrameSize();
+	JitterStats getBufferStats();
+	FilterStats getFilterStats();
 
 	void setPaused(bool paused);
 	void seek(double time);
 	void setBitrate(int bitrate);
+	void setComplexity(int complexity);
+	void setSignal(int signal);
+	void setBufferAhead(long ms);
+	void setPipelined(bool pipelined);
+	void setNativeStretch(bool native);
+	void setNativeDemuxer(bool native);
+	void setFastStart(bool fast);
+	void setFormatHint(std::string format);
+	void setProbeLimits(long size, long analyze_ms);
+	double getReadyTime();
+
+	void enqueue(std::string url, bool isfile);
+	void clearQueue();
+	void setLoop(int mode);
+	size_t getQueueLength();
+
+	int addMixInput(std::string url, bool isfile, float gain);
+	int removeMixInput(int id);
+	int setMixInputGain(int id, float gain);
+	void setDucking(float level, long ms);
+	MixerStats getMixerStats();
 
 	void setVolume(float volume);
 	void setRate(float rate);
@@ -338,4 +612,5 @@ public:
 	void destroy();
 
 	bool isCodecCopy();
+	ulong getNativePackets();
 };
\ No newline at end of file
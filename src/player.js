@@ -13,18 +13,64 @@ class Player extends EventEmitter{
 		if(bind_emitters){
 			this.ffplayer.onready = this.emit.bind(this, 'ready');
 			this.ffplayer.onpacket = this.emit.bind(this, 'packet');
+			this.ffplayer.onpackets = this.emit.bind(this, 'packets');
+			this.ffplayer.onnext = this.emit.bind(this, 'next');
 			this.ffplayer.onfinish = this.emit.bind(this, 'finish');
 			this.ffplayer.ondebug = this.emit.bind(this, 'debug');
 			this.ffplayer.onerror = this.emit.bind(this, 'onerror');
 		}
 	}
 
+	static setWorkerThreads(threads, tick, ioThreads){
+		return ffplayer.setWorkerThreads(threads, tick, ioThreads);
+	}
+
+	static getSchedulerStats(){
+		return ffplayer.getSchedulerStats();
+	}
+
+	static getBufferPoolStats(){
+		return ffplayer.getBufferPoolStats();
+	}
+
+	static getAllocationStats(){
+		return ffplayer.getAllocationStats();
+	}
+
+	static setPacketCache(dir, maxSize){
+		return ffplayer.setPacketCache(dir, maxSize);
+	}
+
+	static setMemoryCache(maxSize){
+		return ffplayer.setMemoryCache(maxSize);
+	}
+
+	static getPacketCacheStats(){
+		return ffplayer.getPacketCacheStats();
+	}
+
+	static setGovernor(enabled){
+		return ffplayer.setGovernor(enabled);
+	}
+
+	static getGovernorStats(){
+		return ffplayer.getGovernorStats();
+	}
+
+	static getProbeCacheStats(){
+		return ffplayer.getProbeCacheStats();
+	}
+
 	setURL(url, isfile = false){
 		return this.ffplayer.setURL(url, isfile);
 	}
 
-	setOutput(channels, sample_rate, bitrate){
-		return this.ffplayer.setOutput(channels, sample_rate, bitrate);
+	setCacheKey(key){
+		return this.ffplayer.setCacheKey(key);
+	}
+
+	setOutput(channels, sample_rate, bitrate, frame_duration){
+		return this.ffplayer.setOutput(channels, sample_rate, bitrate, frame_duration);
 	}
 
 	isPaused(){
@@ -45,6 +91,14 @@ class Player extends EventEmitter{
 		return this.ffplayer.setBitrate(bitrate);
 	}
 
+	setComplexity(complexity){
+		return this.ffplayer.setComplexity(complexity);
+	}
+
+	setSignal(signal){
+		return this.ffplayer.setSignal(signal);
+	}
+
 	setRate(rate){
 		return this.ffplayer.setRate(rate);
 	}
@@ -81,6 +135,102 @@ class Player extends EventEmitter{
 		return this.ffplayer.getTotalFrames();
 	}
 
+	setEventQueueDepth(depth){
+		return this.ffplayer.setEventQueueDepth(depth);
+	}
+
+	getEventsDropped(){
+		return this.ffplayer.getEventsDropped();
+	}
+
+	setBatchedPackets(count){
+		return this.ffplayer.setBatchedPackets(count);
+	}
+
+	setBufferAhead(ms){
+		return this.ffplayer.setBufferAhead(ms);
+	}
+
+	getBufferStats(){
+		return this.ffplayer.getBufferStats();
+	}
+
+	setPipelined(pipelined){
+		return this.ffplayer.setPipelined(pipelined);
+	}
+
+	setNativeStretch(native){
+		return this.ffplayer.setNativeStretch(native);
+	}
+
+	setNativeDemuxer(native){
+		return this.ffplayer.setNativeDemuxer(native);
+	}
+
+	getFilterStats(){
+		return this.ffplayer.getFilterStats();
+	}
+
+	enqueue(url, isfile = false){
+		return this.ffplayer.enqueue(url, isfile);
+	}
+
+	clearQueue(){
+		return this.ffplayer.clearQueue();
+	}
+
+	setLoop(mode){
+		return this.ffplayer.setLoop(mode);
+	}
+
+	getQueueLength(){
+		return this.ffplayer.getQueueLength();
+	}
+
+	addMixInput(url, isfile = false, gain = 1){
+		return this.ffplayer.addMixInput(url, isfile, gain);
+	}
+
+	removeMixInput(id){
+		return this.ffplayer.removeMixInput(id);
+	}
+
+	setMixInputGain(id, gain){
+		return this.ffplayer.setMixInputGain(id, gain);
+	}
+
+	setDucking(level, ms){
+		return this.ffplayer.setDucking(level, ms);
+	}
+
+	getMixerStats(){
+		return this.ffplayer.getMixerStats();
+	}
+
+	subscribe(source){
+		return this.ffplayer.subscribe(source.ffplayer);
+	}
+
+	unsubscribe(){
+		return this.ffplayer.unsubscribe();
+	}
+
+	setFastStart(fast){
+		return this.ffplayer.setFastStart(fast);
+	}
+
+	setFormatHint(format){
+		return this.ffplayer.setFormatHint(format);
+	}
+
+	setProbeLimits(probeSize, analyzeDuration){
+		return this.ffplayer.setProbeLimits(probeSize, analyzeDuration);
+	}
+
+	getReadyTime(){
+		return this.ffplayer.getReadyTime();
+	}
+
 	start(){
 		return this.ffplayer.start();
 	}
@@ -0,0 +1,41 @@
+#include "pool.h"
+
+AVBufferRef* BufferPool::alloc(void* opaque, size_t size){
+	BufferPool* pool = (BufferPool*)opaque;
+
+	pool -> allocations++;
+
+	return av_buffer_alloc(size);
+}
+
+BufferPool::BufferPool(size_t sz): allocations(0), requests(0){
+	size = sz;
+	pool = av_buffer_pool_init2(size, this, alloc, nullptr);
+}
+
+BufferPool::~BufferPool(){
+	/* buffers still referenced (e.g. by js) are freed when released */
+	av_buffer_pool_uninit(&pool);
+}
+
+AVBufferRef* BufferPool::get(){
+	if(!pool)
+		return nullptr;
+	requests++;
+
+	return av_buffer_pool_get(pool);
+}
+
+size_t BufferPool::get_size(){
+	return size;
+}
+
+ulong BufferPool::get_allocations(){
+	return allocations;
+}
+
+ulong BufferPool::get_reuses(){
+	ulong allocs = allocations, reqs = requests;
+
+	return reqs > allocs ? reqs - allocs : 0;
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+#include <atomic>
+#include <sys/types.h>
+#include "ffmpeg.h"
+
+/* refcounted fixed size buffers, returned to the pool when the last ref is dropped */
+class BufferPool{
+private:
+	AVBufferPool* pool;
+	size_t size;
+
+	std::atomic<ulong> allocations;
+	std::atomic<ulong> requests;
+
+	static AVBufferRef* alloc(void* opaque, size_t size);
+public:
+	BufferPool(size_t size);
+	~BufferPool();
+
+	AVBufferRef* get();
+
+	size_t get_size();
+	ulong get_allocations();
+	ulong get_reuses();
+};
\ No newline at end of file
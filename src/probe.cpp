@@ -0,0 +1,151 @@
+#include <ctype.h>
+#include <string.h>
+#include <new>
+#include "probe.h"
+
+ProbeCache::ProbeCache(){
+	hits = 0;
+	misses = 0;
+	skipped = 0;
+	opens = 0;
+	ready_time = 0;
+	ready_max = 0;
+}
+
+std::string ProbeCache::make_key(const std::string& url, bool isfile){
+	size_t start = url.find("://"), end, slash, dot;
+	std::string key, path;
+	bool found;
+
+	start = start == std::string::npos ? 0 : start + 3;
+	end = url.find_first_of("?#", start);
+	path = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+	slash = path.find('/');
+
+	/* local files share one host */
+	if(isfile || slash == std::string::npos)
+		key = isfile ? "file" : path;
+	else
+		key = path.substr(0, slash);
+	slash = path.rfind('/');
+	dot = path.rfind('.');
+	key += '/';
+
+	if(dot != std::string::npos && (slash == std::string::npos || dot > slash) && path.size() - dot - 1 <= MAX_EXTENSION){
+		for(size_t i = dot + 1; i < path.size(); i++)
+			key += (char)tolower(path[i]);
+		return key;
+	}
+
+	/* extensionless endpoints (e.g. /videoplayback) serve many formats, tell them apart by the query */
+	if(isfile || end == std::string::npos || url[end] != '?')
+		return std::string();
+	key += '?';
+	found = add_query(key, url, end + 1, "mime");
+
+	if(add_query(key, url, end + 1, "itag"))
+		found = true;
+	return found ? key : std::string();
+}
+
+bool ProbeCache::add_query(std::string& key, const std::string& url, size_t query, const char* name){
+	size_t len = strlen(name), pos = query, value, next;
+
+	while(pos < url.size() && url[pos] != '#'){
+		next = url.find_first_of("&#", pos);
+		next = next == std::string::npos ? url.size() : next;
+
+		if(next - pos > len && url[pos + len] == '=' && !url.compare(pos, len, name)){
+			value = pos + len + 1;
+
+			if(next - value > MAX_QUERY_VALUE)
+				return false;
+			key += name;
+			key += '=';
+			key.append(url, value, next - value);
+			key += '&';
+
+			return true;
+		}
+
+		if(next == url.size() || url[next] == '#')
+			break;
+		pos = next + 1;
+	}
+
+	return false;
+}
+
+bool ProbeCache::lookup(const std::string& key, ProbeInfo& info){
+	bool found = false;
+
+	mutex.lock();
+
+	auto it = entries.find(key);
+
+	try{
+		if(it != entries.end()){
+			info = it -> second;
+			found = true;
+		}
+	}catch(std::bad_alloc& e){}
+
+	if(found)
+		hits++;
+	else
+		misses++;
+	mutex.unlock();
+
+	return found;
+}
+
+void ProbeCache::store(const std::string& key, const ProbeInfo& info){
+	mutex.lock();
+
+	try{
+		/* hosts come and go, start over rather than track age */
+		if(entries.size() >= MAX_ENTRIES && !entries.count(key))
+			entries.clear();
+		entries[key] = info;
+	}catch(std::bad_alloc& e){}
+
+	mutex.unlock();
+}
+
+void ProbeCache::forget(const std::string& key){
+	mutex.lock();
+	entries.erase(key);
+	mutex.unlock();
+}
+
+void ProbeCache::report_skip(){
+	mutex.lock();
+	skipped++;
+	mutex.unlock();
+}
+
+void ProbeCache::report_ready(double ms){
+	mutex.lock();
+	opens++;
+	ready_time += ms;
+
+	if(ms > ready_max)
+		ready_max = ms;
+	mutex.unlock();
+}
+
+ProbeStats ProbeCache::get_stats(){
+	ProbeStats stats;
+
+	mutex.lock();
+	stats.entries = entries.size();
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.skipped = skipped;
+	stats.opens = opens;
+	stats.ready_time = ready_time;
+	stats.ready_max = ready_max;
+	mutex.unlock();
+
+	return stats;
+}
\ No newline at end of file
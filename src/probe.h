@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+#include "thread.h"
+
+/* what a previous open of a similar url learned */
+struct ProbeInfo{
+	std::string format; /* demuxer name */
+};
+
+struct ProbeStats{
+	ulong entries;
+	ulong hits;
+	ulong misses;
+	ulong skipped; /* opens that needed no stream info probe */
+
+	ulong opens;
+	double ready_time; /* ms, total from open to ready */
+	double ready_max;
+};
+
+/* stream info per host and file extension (or mime and itag query), so repeat opens can skip format probing */
+class ProbeCache{
+private:
+	enum{
+		MAX_ENTRIES = 1024,
+		/* longer extensions are not kept apart */
+		MAX_EXTENSION = 8,
+		MAX_QUERY_VALUE = 32
+	};
+
+	static bool add_query(std::string& key, const std::string& url, size_t query, const char* name);
+
+	std::unordered_map<std::string, ProbeInfo> entries;
+	Mutex mutex;
+
+	ulong hits;
+	ulong misses;
+	ulong skipped;
+
+	ulong opens;
+	double ready_time;
+	double ready_max;
+public:
+	ProbeCache();
+
+	/* empty when nothing in the url tells its format apart */
+	static std::string make_key(const std::string& url, bool isfile);
+
+	bool lookup(const std::string& key, ProbeInfo& info);
+	void store(const std::string& key, const ProbeInfo& info);
+	void forget(const std::string& key);
+
+	void report_skip();
+	void report_ready(double ms);
+
+	ProbeStats get_stats();
+};
\ No newline at end of file
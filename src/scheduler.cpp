@@ -0,0 +1,609 @@
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include "scheduler.h"
+#include "player.h"
+#include "alloc.h"
+
+enum{
+	/* max steps a player can take before yielding its worker */
+	MAX_STEPS = 64,
+	/* default tick size */
+	DEFAULT_TICK = 1'000'000,
+	/* default io threads per cpu, they mostly wait on the network */
+	IO_THREADS_PER_CPU = 4
+};
+
+TimingWheel::TimingWheel(){
+	memset(slots, 0, sizeof(slots));
+
+	ready_head = nullptr;
+	ready_tail = nullptr;
+	current = 0;
+	count = 0;
+
+	memset(levels, 0, sizeof(levels));
+}
+
+void TimingWheel::place(TimerNode* node){
+	uint64_t delta = node -> expires - current, expires = node -> expires;
+	int level;
+
+	for(level = 0; level < LEVELS - 1; level++)
+		if(delta < (1ul << (LEVEL_BITS * (level + 1))))
+			break;
+	if(delta >= (1ul << (LEVEL_BITS * LEVELS)))
+		/* out of range, park in the furthest slot and place again on cascade */
+		expires = current + (1ul << (LEVEL_BITS * LEVELS)) - 1;
+	TimerNode** slot = &slots[level][(expires >> (LEVEL_BITS * level)) & LEVEL_MASK];
+
+	node -> next = *slot;
+	*slot = node;
+	count++;
+	levels[level]++;
+}
+
+void TimingWheel::cascade(int level){
+	TimerNode** slot = &slots[level][(current >> (LEVEL_BITS * level)) & LEVEL_MASK];
+	TimerNode* node = *slot, *next;
+
+	*slot = nullptr;
+
+	while(node){
+		next = node -> next;
+		count--;
+		levels[level]--;
+		insert(node);
+		node = next;
+	}
+}
+
+void TimingWheel::sync(uint64_t tick){
+	if(!count && tick > current)
+		current = tick;
+}
+
+void TimingWheel::insert(TimerNode* node){
+	if(node -> expires > current){
+		place(node);
+
+		return;
+	}
+
+	node -> next = nullptr;
+
+	if(ready_tail)
+		ready_tail -> next = node;
+	else
+		ready_head = node;
+	ready_tail = node;
+}
+
+bool TimingWheel::advance(uint64_t tick){
+	while(current < tick){
+		if(!count){
+			current = tick;
+
+			break;
+		}
+
+		current++;
+
+		/* higher levels first so their timers can land in the slot about to expire */
+		for(int level = LEVELS - 1; level > 0; level--)
+			if(!(current & ((1ul << (LEVEL_BITS * level)) - 1)))
+				cascade(level);
+		cascade(0);
+	}
+
+	return has_ready();
+}
+
+bool TimingWheel::next_expiry(uint64_t& tick){
+	if(has_ready()){
+		tick = current;
+
+		return true;
+	}
+
+	if(!count)
+		return false;
+	/* the next cascade may bring down a timer due before anything in the lowest level */
+	uint64_t cascade = ((current >> LEVEL_BITS) + 1) << LEVEL_BITS;
+
+	tick = count > levels[0] ? cascade : UINT64_MAX;
+
+	for(uint64_t i = 1; i < LEVEL_SIZE && current + i < tick; i++){
+		if(slots[0][(current + i) & LEVEL_MASK]){
+			tick = current + i;
+
+			break;
+		}
+	}
+
+	if(tick == UINT64_MAX)
+		/* nothing in the lowest level, wake up at the next cascade */
+		tick = cascade;
+	return true;
+}
+
+TimerNode* TimingWheel::pop(){
+	TimerNode* node = ready_head;
+
+	if(node){
+		ready_head = node -> next;
+
+		if(!ready_head)
+			ready_tail = nullptr;
+		node -> next = nullptr;
+	}
+
+	return node;
+}
+
+bool TimingWheel::has_ready(){
+	return ready_head != nullptr;
+}
+
+void Scheduler::s_worker_thread(void* s){
+	Scheduler* scheduler = (Scheduler*)s;
+
+	AllocCounter::track_thread();
+	scheduler -> worker_thread();
+}
+
+uint64_t Scheduler::now_ns(){
+	timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1'000'000'000 + now.tv_nsec;
+}
+
+void Scheduler::worker_thread(){
+	TimerNode* node;
+
+	mutex.lock();
+
+	while(!stopping){
+		node = wheel.pop();
+
+		if(node){
+			if(wheel.has_ready() && idle_workers)
+				cond.signal();
+			account(node, now_ns());
+			mutex.unlock();
+			run(node -> player);
+			mutex.lock();
+
+			continue;
+		}
+
+		if(timer_waiting){
+			/* another worker is already sleeping on the next tick */
+			idle_workers++;
+			cond.wait(mutex);
+			idle_workers--;
+
+			continue;
+		}
+
+		wait_timer();
+	}
+
+	mutex.unlock();
+}
+
+void Scheduler::wait_timer(){
+	uint64_t expiry;
+
+	if(wheel.advance(now_ns() / tick))
+		return;
+	timer_waiting = true;
+
+	if(wheel.next_expiry(expiry)){
+		uint64_t ns = expiry * tick;
+		timespec deadline;
+
+		deadline.tv_sec = ns / 1'000'000'000;
+		deadline.tv_nsec = ns % 1'000'000'000;
+		timer_tick = expiry;
+		timer_cond.wait(mutex, deadline);
+	}else{
+		timer_tick = UINT64_MAX;
+		timer_cond.wait(mutex);
+	}
+
+	timer_waiting = false;
+
+	uint64_t now = now_ns();
+
+	/* one wakeup for every timer due in this bucket */
+	if(wheel.advance(now / tick)){
+		wakeups++;
+		window_wakeups++;
+	}
+
+	roll(now);
+}
+
+void Scheduler::roll(uint64_t now){
+	uint64_t elapsed = now - window_start;
+
+	if(elapsed < 1'000'000'000)
+		return;
+	double seconds = (double)elapsed / 1'000'000'000;
+
+	last_stats.wakeups_per_sec = window_wakeups / seconds;
+	last_stats.tasks_per_sec = window_tasks / seconds;
+	last_stats.lateness_avg = window_tasks ? window_lateness / window_tasks : 0;
+	last_stats.lateness_max = window_lateness_max;
+
+	window_start = now;
+	window_wakeups = 0;
+	window_tasks = 0;
+	window_lateness = 0;
+	window_lateness_max = 0;
+}
+
+void Scheduler::account(TimerNode* node, uint64_t now){
+	ulong lateness = now > node -> deadline ? now - node -> deadline : 0;
+
+	tasks++;
+	window_tasks++;
+	window_lateness += lateness;
+
+	if(lateness > window_lateness_max)
+		window_lateness_max = lateness;
+	roll(now);
+}
+
+void Scheduler::run(Player* player){
+	int ret, steps = 0;
+
+	do
+		ret = player -> step();
+	while(ret == Player::STEP_CONTINUE && ++steps < MAX_STEPS);
+
+	switch(ret){
+		case Player::STEP_CONTINUE:
+			schedule(player);
+
+			break;
+		case Player::STEP_SLEEP:
+			schedule(player, player -> deadline);
+
+			break;
+		case Player::STEP_WAIT:
+			player -> park();
+
+			break;
+		case Player::STEP_EXIT:
+			player -> exit();
+
+			break;
+	}
+}
+
+Scheduler::Scheduler(): timer_cond(CLOCK_MONOTONIC){
+	tick = DEFAULT_TICK;
+	idle_workers = 0;
+	timer_tick = UINT64_MAX;
+	running = false;
+	stopping = false;
+	timer_waiting = false;
+
+	wakeups = 0;
+	tasks = 0;
+	window_wakeups = 0;
+	window_tasks = 0;
+	window_lateness = 0;
+	window_lateness_max = 0;
+	window_start = 0;
+
+	memset(&last_stats, 0, sizeof(last_stats));
+}
+
+int Scheduler::start(int threads, ulong tick_ns){
+	int err = 0;
+
+	if(running)
+		return EALREADY;
+	if(tick_ns)
+		tick = tick_ns;
+	if(threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads <= 0)
+		threads = 1;
+	try{
+		workers.reserve(threads);
+	}catch(std::bad_alloc& e){
+		return ENOMEM;
+	}
+
+	window_start = now_ns();
+	wheel.sync(window_start / tick);
+
+	for(int i = 0; i < threads; i++){
+		workers.emplace_back(s_worker_thread, this);
+
+		err = workers.back().start();
+
+		if(err){
+			workers.pop_back();
+
+			break;
+		}
+	}
+
+	if(workers.empty())
+		return err;
+	running = true;
+
+	return 0;
+}
+
+void Scheduler::stop(){
+	if(!running)
+		return;
+	mutex.lock();
+	stopping = true;
+	cond.broadcast();
+	timer_cond.broadcast();
+	mutex.unlock();
+
+	for(Thread& worker : workers)
+		worker.join();
+	workers.clear();
+	running = false;
+}
+
+bool Scheduler::is_running(){
+	return running;
+}
+
+void Scheduler::schedule(Player* player){
+	timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	schedule(player, now);
+}
+
+void Scheduler::schedule(Player* player, const timespec& deadline){
+	TimerNode* node = &player -> timer;
+
+	node -> deadline = (uint64_t)deadline.tv_sec * 1'000'000'000 + deadline.tv_nsec;
+	node -> expires = (node -> deadline + tick - 1) / tick;
+
+	mutex.lock();
+	wheel.sync(now_ns() / tick);
+	wheel.insert(node);
+
+	if(wheel.has_ready()){
+		if(idle_workers)
+			cond.signal();
+		else if(timer_waiting)
+			timer_cond.signal();
+	}else if(timer_waiting){
+		/* the timer worker needs to wake up earlier */
+		if(node -> expires < timer_tick)
+			timer_cond.signal();
+	}else if(idle_workers){
+		cond.signal();
+	}
+
+	mutex.unlock();
+}
+
+SchedulerStats Scheduler::get_stats(){
+	SchedulerStats stats;
+
+	mutex.lock();
+	roll(now_ns());
+
+	stats = last_stats;
+	stats.workers = workers.size();
+	stats.tick = tick;
+	stats.wakeups = wakeups;
+	stats.tasks = tasks;
+
+	mutex.unlock();
+
+	return stats;
+}
+
+void IoPool::s_io_thread(void* p){
+	IoPool* pool = (IoPool*)p;
+
+	AllocCounter::track_thread();
+	pool -> io_thread();
+}
+
+void IoPool::io_thread(){
+	IoJob* job;
+	void (*done)(void*);
+	void* arg;
+
+	mutex.lock();
+
+	while(!stopping){
+		job = head;
+
+		if(!job){
+			cond.wait(mutex);
+
+			continue;
+		}
+
+		head = job -> next;
+
+		if(!head)
+			tail = nullptr;
+		job -> next = nullptr;
+		job -> state = JOB_RUNNING;
+		pending--;
+		mutex.unlock();
+		job -> func(job -> arg);
+		mutex.lock();
+
+		if(job -> state == JOB_RERUN){
+			job -> state = JOB_QUEUED;
+
+			if(tail)
+				tail -> next = job;
+			else
+				head = job;
+			tail = job;
+			jobs++;
+			pending++;
+			done_cond.broadcast();
+
+			continue;
+		}
+
+		done = job -> done;
+		arg = job -> arg;
+		job -> state = JOB_IDLE;
+		done_cond.broadcast();
+
+		if(done){
+			mutex.unlock();
+			done(arg);
+			mutex.lock();
+		}
+	}
+
+	mutex.unlock();
+}
+
+void IoPool::unlink(IoJob* job){
+	IoJob** link = &head;
+	IoJob* prev = nullptr;
+
+	while(*link != job){
+		prev = *link;
+		link = &prev -> next;
+	}
+
+	*link = job -> next;
+
+	if(tail == job)
+		tail = prev;
+	job -> next = nullptr;
+}
+
+IoPool::IoPool(){
+	head = nullptr;
+	tail = nullptr;
+	jobs = 0;
+	pending = 0;
+	running = false;
+	stopping = false;
+}
+
+int IoPool::start(int count){
+	int err = 0;
+
+	if(running)
+		return EALREADY;
+	if(count <= 0)
+		count = sysconf(_SC_NPROCESSORS_ONLN) * IO_THREADS_PER_CPU;
+	if(count <= 0)
+		count = IO_THREADS_PER_CPU;
+	try{
+		threads.reserve(count);
+	}catch(std::bad_alloc& e){
+		return ENOMEM;
+	}
+
+	for(int i = 0; i < count; i++){
+		threads.emplace_back(s_io_thread, this);
+
+		err = threads.back().start();
+
+		if(err){
+			threads.pop_back();
+
+			break;
+		}
+	}
+
+	if(threads.empty())
+		return err;
+	running = true;
+
+	return 0;
+}
+
+void IoPool::stop(){
+	if(!running)
+		return;
+	mutex.lock();
+	stopping = true;
+	cond.broadcast();
+	mutex.unlock();
+
+	for(Thread& thread : threads)
+		thread.join();
+	threads.clear();
+	running = false;
+}
+
+void IoPool::submit(IoJob* job){
+	mutex.lock();
+
+	if(job -> state != JOB_IDLE){
+		if(job -> state == JOB_RUNNING)
+			job -> state = JOB_RERUN;
+		mutex.unlock();
+
+		return;
+	}
+
+	job -> next = nullptr;
+	job -> state = JOB_QUEUED;
+
+	if(tail)
+		tail -> next = job;
+	else
+		head = job;
+	tail = job;
+	jobs++;
+	pending++;
+
+	cond.signal();
+	mutex.unlock();
+}
+
+void IoPool::wait(IoJob* job, bool run){
+	mutex.lock();
+
+	while(job -> state == JOB_RUNNING || job -> state == JOB_RERUN)
+		done_cond.wait(mutex);
+	if(job -> state == JOB_QUEUED){
+		/* every io thread may be waiting on jobs queued behind them, never wait for a queued one */
+		unlink(job);
+		job -> state = JOB_IDLE;
+		pending--;
+		mutex.unlock();
+
+		if(run){
+			job -> func(job -> arg);
+
+			if(job -> done)
+				job -> done(job -> arg);
+		}
+
+		return;
+	}
+
+	mutex.unlock();
+}
+
+void IoPool::get_stats(SchedulerStats& stats){
+	mutex.lock();
+	stats.io_threads = threads.size();
+	stats.io_jobs = jobs;
+	stats.io_pending = pending;
+	mutex.unlock();
+}
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+#include "thread.h"
+
+class Player;
+
+struct TimerNode{
+	TimerNode* next;
+	Player* player;
+
+	uint64_t expires; /* tick */
+	uint64_t deadline; /* ns */
+};
+
+struct SchedulerStats{
+	ulong workers;
+	ulong tick; /* ns */
+
+	ulong wakeups;
+	ulong tasks;
+
+	ulong io_threads;
+	ulong io_jobs; /* total jobs handed to the io threads */
+	ulong io_pending; /* jobs waiting for an io thread */
+
+	/* over the last full second */
+	double wakeups_per_sec;
+	double tasks_per_sec;
+	double lateness_avg; /* ns */
+	ulong lateness_max; /* ns */
+};
+
+/* hierarchical timing wheel, deadlines are grouped into tick sized buckets */
+class TimingWheel{
+private:
+	enum{
+		LEVEL_BITS = 6,
+		LEVEL_SIZE = 1 << LEVEL_BITS,
+		LEVEL_MASK = LEVEL_SIZE - 1,
+		LEVELS = 4
+	};
+
+	TimerNode* slots[LEVELS][LEVEL_SIZE];
+	TimerNode* ready_head;
+	TimerNode* ready_tail;
+
+	uint64_t current;
+	ulong count;
+	ulong levels[LEVELS]; /* timers in each level */
+
+	void place(TimerNode* node);
+	void cascade(int level);
+public:
+	TimingWheel();
+
+	void sync(uint64_t tick);
+	void insert(TimerNode* node);
+	bool advance(uint64_t tick);
+	bool next_expiry(uint64_t& tick);
+
+	TimerNode* pop();
+	bool has_ready();
+};
+
+/* work for the io threads, lives in whatever submits it */
+struct IoJob{
+	IoJob* next;
+
+	void (*func)(void* arg);
+	void (*done)(void* arg); /* after the pool let go of the job, the owner may free it from here on */
+	void* arg;
+
+	int state;
+};
+
+/* a fixed set of threads for work that blocks on io, so it never holds up a worker */
+class IoPool{
+private:
+	enum{
+		JOB_IDLE = 0,
+		JOB_QUEUED,
+		JOB_RUNNING,
+		JOB_RERUN /* submitted again while running, queued once it returns */
+	};
+
+	std::vector<Thread> threads;
+
+	Mutex mutex;
+	Cond cond;
+	Cond done_cond;
+
+	IoJob* head;
+	IoJob* tail;
+
+	ulong jobs;
+	ulong pending;
+
+	bool running;
+	bool stopping;
+
+	static void s_io_thread(void* p);
+
+	void io_thread();
+	void unlink(IoJob* job);
+public:
+	IoPool();
+
+	int start(int threads);
+	void stop();
+
+	/* a job already queued is not queued twice, a running one runs once more after it returns */
+	void submit(IoJob* job);
+	/* returns once the job is neither queued nor running, a job still queued is run on the caller or dropped */
+	void wait(IoJob* job, bool run);
+
+	void get_stats(SchedulerStats& stats);
+};
+
+class Scheduler{
+private:
+	TimingWheel wheel;
+
+	std::vector<Thread> workers;
+
+	Mutex mutex;
+	Cond cond;
+	Cond timer_cond;
+
+	ulong tick;
+	ulong idle_workers;
+
+	uint64_t timer_tick; /* tick the timer worker sleeps until */
+
+	bool running;
+	bool stopping;
+	bool timer_waiting;
+
+	/* stats */
+	ulong wakeups;
+	ulong tasks;
+
+	ulong window_wakeups;
+	ulong window_tasks;
+	ulong window_lateness_max;
+	double window_lateness;
+
+	uint64_t window_start;
+
+	SchedulerStats last_stats;
+
+	static void s_worker_thread(void* s);
+
+	uint64_t now_ns();
+	void worker_thread();
+	void wait_timer();
+	void roll(uint64_t now);
+	void account(TimerNode* node, uint64_t now);
+	void run(Player* player);
+public:
+	Scheduler();
+
+	int start(int threads, ulong tick);
+	void stop();
+	bool is_running();
+
+	void schedule(Player* player);
+	void schedule(Player* player, const timespec& deadline);
+
+	SchedulerStats get_stats();
+};
\ No newline at end of file
@@ -2,9 +2,11 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <sodium/crypto_secretbox.h>
+#include <sodium/crypto_aead_xchacha20poly1305.h>
 #include <sodium/randombytes.h>
 #include <arpa/inet.h>
 #include "wrapper.h"
+#include "alloc.h"
 
 PlayerCallbacks PlayerWrapper::callbacks = {
 	PlayerWrapper::player_ready,
@@ -12,18 +14,21 @@ PlayerCallbacks PlayerWrapper::callbacks = {
 	PlayerWrapper::player_seeked,
 	PlayerWrapper::player_packet,
 	PlayerWrapper::player_send_packet,
+	PlayerWrapper::player_next,
 	PlayerWrapper::player_finish,
 	PlayerWrapper::player_error
 };
 
 enum{
-	BUFFER_SIZE = 8192
+	DEFAULT_EVENT_DEPTH = 64,
+	ERROR_TEXT_SIZE = 256
 };
 
 enum MessageType{
 	MESSAGE_NONE = 0,
 	MESSAGE_READY,
 	MESSAGE_PACKET,
+	MESSAGE_NEXT,
 	MESSAGE_FINISH,
 	MESSAGE_ERROR
 };
@@ -52,7 +57,45 @@ Napi::Function PlayerWrapper::init(Napi::Env env){
 		InstanceMethod<&PlayerWrapper::getSecretBox>("getSecretBox"),
 		InstanceMethod<&PlayerWrapper::pipe>("pipe"),
 		InstanceMethod<&PlayerWrapper::isCodecCopy>("isCodecCopy"),
-		InstanceMethod<&PlayerWrapper::send>("send")
+		InstanceMethod<&PlayerWrapper::getNativePackets>("getNativePackets"),
+		InstanceMethod<&PlayerWrapper::send>("send"),
+		InstanceMethod<&PlayerWrapper::setEventQueueDepth>("setEventQueueDepth"),
+		InstanceMethod<&PlayerWrapper::getEventsDropped>("getEventsDropped"),
+		InstanceMethod<&PlayerWrapper::setBatchedPackets>("setBatchedPackets"),
+		InstanceMethod<&PlayerWrapper::setBufferAhead>("setBufferAhead"),
+		InstanceMethod<&PlayerWrapper::getBufferStats>("getBufferStats"),
+		InstanceMethod<&PlayerWrapper::setPipelined>("setPipelined"),
+		InstanceMethod<&PlayerWrapper::setNativeStretch>("setNativeStretch"),
+		InstanceMethod<&PlayerWrapper::setNativeDemuxer>("setNativeDemuxer"),
+		InstanceMethod<&PlayerWrapper::getFilterStats>("getFilterStats"),
+		InstanceMethod<&PlayerWrapper::addMixInput>("addMixInput"),
+		InstanceMethod<&PlayerWrapper::removeMixInput>("removeMixInput"),
+		InstanceMethod<&PlayerWrapper::setMixInputGain>("setMixInputGain"),
+		InstanceMethod<&PlayerWrapper::setDucking>("setDucking"),
+		InstanceMethod<&PlayerWrapper::getMixerStats>("getMixerStats"),
+		InstanceMethod<&PlayerWrapper::setComplexity>("setComplexity"),
+		InstanceMethod<&PlayerWrapper::setSignal>("setSignal"),
+		InstanceMethod<&PlayerWrapper::setCacheKey>("setCacheKey"),
+		InstanceMethod<&PlayerWrapper::enqueue>("enqueue"),
+		InstanceMethod<&PlayerWrapper::clearQueue>("clearQueue"),
+		InstanceMethod<&PlayerWrapper::setLoop>("setLoop"),
+		InstanceMethod<&PlayerWrapper::getQueueLength>("getQueueLength"),
+		InstanceMethod<&PlayerWrapper::subscribe>("subscribe"),
+		InstanceMethod<&PlayerWrapper::unsubscribe>("unsubscribe"),
+		InstanceMethod<&PlayerWrapper::setFastStart>("setFastStart"),
+		InstanceMethod<&PlayerWrapper::setFormatHint>("setFormatHint"),
+		InstanceMethod<&PlayerWrapper::setProbeLimits>("setProbeLimits"),
+		InstanceMethod<&PlayerWrapper::getReadyTime>("getReadyTime"),
+		StaticMethod<&PlayerWrapper::setWorkerThreads>("setWorkerThreads"),
+		StaticMethod<&PlayerWrapper::getSchedulerStats>("getSchedulerStats"),
+		StaticMethod<&PlayerWrapper::getBufferPoolStats>("getBufferPoolStats"),
+		StaticMethod<&PlayerWrapper::getAllocationStats>("getAllocationStats"),
+		StaticMethod<&PlayerWrapper::setPacketCache>("setPacketCache"),
+		StaticMethod<&PlayerWrapper::setMemoryCache>("setMemoryCache"),
+		StaticMethod<&PlayerWrapper::getPacketCacheStats>("getPacketCacheStats"),
+		StaticMethod<&PlayerWrapper::setGovernor>("setGovernor"),
+		StaticMethod<&PlayerWrapper::getGovernorStats>("getGovernorStats"),
+		StaticMethod<&PlayerWrapper::getProbeCacheStats>("getProbeCacheStats")
 	});
 
 	return constructor;
@@ -76,6 +119,8 @@ public:
 			return;
 		player.wait_threads();
 
+		this -> ~AddonContext();
+
 		free(this);
 	}
 
@@ -112,6 +157,192 @@ static AddonContext* create_context(Napi::Env env){
 	return context;
 }
 
+Napi::Value PlayerWrapper::setWorkerThreads(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+
+	int threads = 0, io_threads = 0;
+	ulong tick = 0;
+
+	if(info.Length() > 0 && !info[0].IsUndefined())
+		threads = info[0].As<Napi::Number>().Int32Value();
+	if(info.Length() > 1 && !info[1].IsUndefined())
+		tick = info[1].As<Napi::Number>().DoubleValue() * 1'000'000;
+	if(info.Length() > 2 && !info[2].IsUndefined())
+		io_threads = info[2].As<Napi::Number>().Int32Value();
+	int err = context -> player.set_workers(threads, tick, io_threads);
+
+	if(err){
+		std::string str("Could not start worker threads: ");
+
+		str += strerror(err);
+
+		throw Napi::Error::New(info.Env(), str);
+	}
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getSchedulerStats(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+	SchedulerStats stats = context -> player.get_scheduler_stats();
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	obj["workers"] = stats.workers;
+	obj["tick"] = stats.tick / 1'000'000.0;
+	obj["wakeups"] = stats.wakeups;
+	obj["tasks"] = stats.tasks;
+	obj["wakeupsPerSecond"] = stats.wakeups_per_sec;
+	obj["tasksPerSecond"] = stats.tasks_per_sec;
+	obj["latenessAverage"] = stats.lateness_avg / 1'000'000.0;
+	obj["latenessMax"] = stats.lateness_max / 1'000'000.0;
+	obj["ioThreads"] = stats.io_threads;
+	obj["ioJobs"] = stats.io_jobs;
+	obj["ioPending"] = stats.io_pending;
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::setPacketCache(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+
+	std::string dir;
+	size_t max_size = 0;
+
+	if(info.Length() > 0 && !info[0].IsUndefined() && !info[0].IsNull())
+		dir = info[0].As<Napi::String>();
+	if(info.Length() > 1 && !info[1].IsUndefined())
+		max_size = info[1].As<Napi::Number>().Int64Value();
+	int err = context -> player.get_cache() -> configure(dir, max_size);
+
+	if(err){
+		char buf[256];
+
+		av_strerror(err, buf, sizeof(buf));
+
+		std::string str("Could not open packet cache: ");
+
+		str += buf;
+
+		throw Napi::Error::New(info.Env(), str);
+	}
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::setMemoryCache(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+
+	size_t limit = 0;
+
+	if(info.Length() > 0 && !info[0].IsUndefined())
+		limit = info[0].As<Napi::Number>().Int64Value();
+	context -> player.get_cache() -> set_memory_limit(limit);
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getPacketCacheStats(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+	PacketCacheStats stats;
+
+	try{
+		stats = context -> player.get_cache() -> get_stats();
+	}catch(std::bad_alloc& e){
+		throw Napi::Error::New(info.Env(), "Out of memory");
+	}
+
+	Napi::Object obj = Napi::Object::New(info.Env());
+	Napi::Array entries = Napi::Array::New(info.Env(), stats.entries.size());
+
+	for(uint32_t i = 0; i < stats.entries.size(); i++){
+		Napi::Object entry = Napi::Object::New(info.Env());
+
+		entry["key"] = stats.entries[i].key;
+		entry["size"] = stats.entries[i].size;
+		entry["pins"] = stats.entries[i].pins;
+		entries[i] = entry;
+	}
+
+	obj["memorySize"] = stats.memory_size;
+	obj["memoryLimit"] = stats.memory_limit;
+	obj["hits"] = stats.hits;
+	obj["diskHits"] = stats.disk_hits;
+	obj["misses"] = stats.misses;
+	obj["entries"] = entries;
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::setGovernor(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+
+	context -> player.get_governor() -> set_enabled(info[0].As<Napi::Boolean>().Value());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getGovernorStats(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+	GovernorStats stats = context -> player.get_governor() -> get_stats();
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	obj["enabled"] = stats.enabled;
+	obj["level"] = stats.level;
+	obj["complexity"] = stats.complexity;
+	obj["effects"] = stats.effects;
+	obj["transitions"] = stats.transitions;
+	obj["lowered"] = stats.lowered;
+	obj["raised"] = stats.raised;
+	obj["missRate"] = stats.miss_rate;
+	obj["cpuLoad"] = stats.cpu_load;
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::getProbeCacheStats(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+	ProbeStats stats = context -> player.get_probe_cache() -> get_stats();
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	obj["entries"] = stats.entries;
+	obj["hits"] = stats.hits;
+	obj["misses"] = stats.misses;
+	obj["skipped"] = stats.skipped;
+	obj["opens"] = stats.opens;
+	obj["readyAverage"] = stats.opens ? stats.ready_time / stats.opens : 0;
+	obj["readyMax"] = stats.ready_max;
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::getBufferPoolStats(const Napi::CallbackInfo& info){
+	AddonContext* context = create_context(info.Env());
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	BufferPool* pool = context -> player.get_pool();
+
+	obj["size"] = pool -> get_size();
+	obj["allocations"] = pool -> get_allocations();
+	obj["reuses"] = pool -> get_reuses();
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::getAllocationStats(const Napi::CallbackInfo& info){
+	AllocStats stats;
+
+	if(!AllocCounter::get_stats(stats))
+		return info.Env().Null();
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	obj["allocations"] = stats.allocations;
+	obj["bytes"] = stats.bytes;
+
+	if(stats.split)
+		obj["libavAllocations"] = stats.libav;
+	return obj;
+}
+
 int PlayerWrapper::player_ready(Player* player){
 	int err = AVERROR_EXIT;
 
@@ -123,6 +354,7 @@ int PlayerWrapper::player_ready(Player* player){
 	if(wrapper){
 		wrapper -> packet_emitted = false;
 		err = wrapper -> send_message(MESSAGE_READY);
+		wrapper -> broadcast_message(MESSAGE_READY);
 	}
 
 	player -> data_mutex.unlock();
@@ -140,8 +372,13 @@ int PlayerWrapper::player_seeked(Player* player){
 
 	if(!wrapper)
 		err = AVERROR_EXIT;
-	else
+	else{
 		wrapper -> packet_emitted = false;
+
+		for(PlayerWrapper* subscriber : wrapper -> subscribers)
+			subscriber -> packet_emitted = false;
+	}
+
 	player -> data_mutex.unlock();
 
 	return err;
@@ -159,16 +396,11 @@ int PlayerWrapper::player_packet(Player* player, AVPacket* packet){
 		err = wrapper -> process_packet(packet);
 
 		if(err){
-			char buf[256];
-
-			av_strerror(err, buf, sizeof(buf));
-
-			wrapper -> error.clear();
-			wrapper -> error += buf;
-			wrapper -> error_code = err;
-			wrapper -> send_message(MESSAGE_ERROR);
+			wrapper -> report_error(err);
 
 			err = AVERROR_EXIT;
+		}else{
+			wrapper -> broadcast_packet();
 		}
 	}
 
@@ -186,27 +418,28 @@ int PlayerWrapper::player_send_packet(Player* player){
 	wrapper = (PlayerWrapper*)player -> data;
 
 	if(wrapper){
-		if(wrapper -> ext_send){
-			err = wrapper -> send_packet();
+		err = wrapper -> deliver_packet();
 
-			if(err){
-				char buf[256];
+		if(!err)
+			wrapper -> broadcast_send();
+	}
 
-				av_strerror(err, buf, sizeof(buf));
+	player -> data_mutex.unlock();
 
-				wrapper -> error.clear();
-				wrapper -> error += buf;
-				wrapper -> error_code = err;
-				wrapper -> send_message(MESSAGE_ERROR);
+	return err;
+}
 
-				err = AVERROR_EXIT;
-			}else if(!wrapper -> packet_emitted){
-				wrapper -> packet_emitted = true;
-				err = wrapper -> send_message(MESSAGE_PACKET);
-			}
-		}else{
-			err = wrapper -> send_message(MESSAGE_PACKET);
-		}
+int PlayerWrapper::player_next(Player* player){
+	int err = AVERROR_EXIT;
+
+	PlayerWrapper* wrapper;
+
+	player -> data_mutex.lock();
+	wrapper = (PlayerWrapper*)player -> data;
+
+	if(wrapper){
+		err = wrapper -> send_message(MESSAGE_NEXT);
+		wrapper -> broadcast_message(MESSAGE_NEXT);
 	}
 
 	player -> data_mutex.unlock();
@@ -225,6 +458,7 @@ int PlayerWrapper::player_finish(Player* player){
 	if(wrapper){
 		wrapper -> packet_emitted = false;
 		err = wrapper -> send_message(MESSAGE_FINISH);
+		wrapper -> broadcast_message(MESSAGE_FINISH);
 	}
 
 	player -> data_mutex.unlock();
@@ -239,42 +473,197 @@ void PlayerWrapper::player_error(Player* player, const std::string& error, int c
 	wrapper = (PlayerWrapper*)player -> data;
 
 	if(wrapper){
-		wrapper -> error.clear();
-		wrapper -> error += error;
-		wrapper -> error_code = code;
-		wrapper -> send_message(MESSAGE_ERROR);
+		wrapper -> send_error(error, code);
+
+		for(PlayerWrapper* subscriber : wrapper -> subscribers)
+			subscriber -> send_error(error, code);
 	}
 
 	player -> data_mutex.unlock();
 }
 
-int PlayerWrapper::send_message(int type){
-	Player* player = this -> player;
+void PlayerWrapper::report_error(int err){
+	char buf[256];
+
+	av_strerror(err, buf, sizeof(buf));
+	send_error(buf, err);
+}
 
-	bool sent = false;
+void PlayerWrapper::send_error(const std::string& str, int err){
+	error_mutex.lock();
 
-	message_type = type;
-	message.send();
-	mutex.lock();
-	player -> data_mutex.unlock();
-	message.wait();
+	/* every error event takes the next slot, so its text stays with it until js has it, further errors are dropped */
+	if(error_head - error_tail < ERROR_SLOTS){
+		size_t slot = error_head % ERROR_SLOTS;
+
+		try{
+			errors[slot].assign(str);
+		}catch(std::bad_alloc& e){
+			errors[slot].clear();
+		}
+
+		error_codes[slot] = err;
+		send_message(MESSAGE_ERROR);
+	}
+
+	error_mutex.unlock();
+}
+
+int PlayerWrapper::deliver_packet(){
+	int err;
+
+	if(!ext_send)
+		return send_message(MESSAGE_PACKET);
+	err = send_packet();
+
+	if(err){
+		report_error(err);
+
+		return AVERROR_EXIT;
+	}
+
+	if(!packet_emitted){
+		packet_emitted = true;
+
+		return send_message(MESSAGE_PACKET);
+	}
+
+	return 0;
+}
+
+void PlayerWrapper::broadcast_packet(){
+	int err;
+
+	/* the encoded packet is shared, only the rtp header and encryption are per subscriber */
+	for(PlayerWrapper* subscriber : subscribers){
+		if(subscriber -> subscriber_failed)
+			continue;
+		av_packet_unref(subscriber -> packet);
+
+		err = av_packet_ref(subscriber -> packet, packet);
+
+		if(!err)
+			err = subscriber -> seal_packet();
+		if(err){
+			subscriber -> subscriber_failed = true;
+			subscriber -> report_error(err);
+		}
+	}
+}
+
+void PlayerWrapper::broadcast_send(){
+	/* a failing subscriber is dropped, the source and other subscribers keep playing */
+	for(PlayerWrapper* subscriber : subscribers)
+		if(!subscriber -> subscriber_failed && subscriber -> deliver_packet())
+			subscriber -> subscriber_failed = true;
+}
+
+void PlayerWrapper::broadcast_message(int type){
+	for(PlayerWrapper* subscriber : subscribers){
+		subscriber -> packet_emitted = false;
+		subscriber -> source_finished = type == MESSAGE_FINISH;
+		subscriber -> send_message(type);
+	}
+}
+
+void PlayerWrapper::detach_subscribers(){
 	player -> data_mutex.lock();
-	mutex.unlock();
 
-	return player -> data ? 0 : AVERROR_EXIT;
+	/* the broadcast ends with the source, unless it already has */
+	for(PlayerWrapper* subscriber : subscribers){
+		if(!subscriber -> source_finished && !subscriber -> subscriber_failed)
+			subscriber -> send_message(MESSAGE_FINISH);
+		subscriber -> source = nullptr;
+	}
+
+	player -> data_mutex.unlock();
+
+	for(PlayerWrapper* subscriber : subscribers)
+		subscriber -> source_ref.Reset();
+	subscribers.clear();
+}
+
+int PlayerWrapper::send_message(int type){
+	MessageEvent* event = message.reserve(type != MESSAGE_PACKET);
+
+	if(!event)
+		return 0; /* counted as dropped, the player never waits on js */
+	event -> type = type;
+
+	switch(type){
+		case MESSAGE_PACKET:
+			av_buffer_unref(&event -> buffer);
+			event -> duration = packet -> duration;
+			secretbox.lock();
+
+			/*
+			 * unless the packet is still to be sent on the socket, its reference moves into the event,
+			 * so js can take the pooled buffer without a copy while this wrapper waits for the next packet
+			 */
+			if(secret_box.secret_key.size()){
+				event -> offset = 0;
+				event -> size = secret_box.message_size;
+
+				if(ext_send)
+					event -> buffer = av_buffer_ref(secret_box.buffer);
+				else{
+					event -> buffer = secret_box.buffer;
+					secret_box.buffer = nullptr;
+				}
+			}else if(packet -> buf){
+				event -> offset = packet -> data - packet -> buf -> data;
+				event -> size = packet -> size;
+
+				if(ext_send)
+					event -> buffer = av_buffer_ref(packet -> buf);
+				else{
+					event -> buffer = packet -> buf;
+					packet -> buf = nullptr;
+					av_packet_unref(packet);
+				}
+			}
+
+			secretbox.unlock();
+
+			if(!event -> buffer)
+				return 0;
+			break;
+		case MESSAGE_ERROR:
+			/* from send_error with error_mutex held, the slot is only taken once the event is */
+			event -> code = error_codes[error_head++ % ERROR_SLOTS];
+
+			break;
+	}
+
+	message.commit();
+
+	return 0;
 }
 
-void PlayerWrapper::handle_message(){
+void PlayerWrapper::handle_message(MessageEvent& event){
 	Napi::HandleScope scope(Env());
 
 	try{
-		switch(message_type){
+		if(event.type == MESSAGE_PACKET && batch_size > 1){
+			queue_packet(event);
+			av_buffer_unref(&event.buffer);
+
+			return;
+		}
+
+		flush_packets();
+
+		switch(event.type){
 			case MESSAGE_READY:
 				handle_ready();
 
 				break;
 			case MESSAGE_PACKET:
-				handle_packet();
+				handle_packet(event);
+
+				break;
+			case MESSAGE_NEXT:
+				handle_next();
 
 				break;
 			case MESSAGE_FINISH:
@@ -282,7 +671,7 @@ void PlayerWrapper::handle_message(){
 
 				break;
 			case MESSAGE_ERROR:
-				handle_error(error, error_code);
+				handle_error(event.code);
 
 				break;
 		}
@@ -293,6 +682,22 @@ void PlayerWrapper::handle_message(){
 			/* already throwing an exception */
 		}
 	}
+
+	av_buffer_unref(&event.buffer);
+}
+
+void PlayerWrapper::messages_drained(){
+	Napi::HandleScope scope(Env());
+
+	try{
+		flush_packets();
+	}catch(Napi::Error& e){
+		try{
+			e.ThrowAsJavaScriptException();
+		}catch(Napi::Error& e){
+			/* already throwing an exception */
+		}
+	}
 }
 
 PlayerWrapper::PlayerWrapper(const Napi::CallbackInfo& info):
@@ -301,8 +706,17 @@ PlayerWrapper::PlayerWrapper(const Napi::CallbackInfo& info):
 	message(this, &context -> message){
 	player = nullptr;
 	fd = -1;
+	event_depth = DEFAULT_EVENT_DEPTH;
+	batch_size = 0;
+	batch_bytes = 0;
 	ext_send = false;
 	packet_emitted = false;
+	error_head = 0;
+	error_tail = 0;
+	source = nullptr;
+	subscriber_failed = false;
+	source_finished = false;
+	started = false;
 
 	packet = av_packet_alloc();
 
@@ -310,7 +724,8 @@ PlayerWrapper::PlayerWrapper(const Napi::CallbackInfo& info):
 		/* if we're really out of memory, let node js handle it */
 		throw Napi::Error::New(Env(), "Out of memory");
 	try{
-		error.reserve(256);
+		for(std::string& error : errors)
+			error.reserve(ERROR_TEXT_SIZE);
 
 		player = new Player(&context -> player, &callbacks, this);
 	}catch(std::bad_alloc& e){
@@ -322,6 +737,9 @@ PlayerWrapper::PlayerWrapper(const Napi::CallbackInfo& info):
 	memset(secret_box.nonce_buffer, 0, sizeof(secret_box.nonce_buffer));
 	memset(secret_box.audio_nonce, 0, sizeof(secret_box.audio_nonce));
 
+	secret_box.buffer = nullptr;
+	secret_box.message_size = 0;
+
 	if(info.Length() > 0)
 		buffer = std::move(Napi::Reference<Napi::Uint8Array>(Napi::Persistent(info[0].As<Napi::Uint8Array>())));
 }
@@ -347,11 +765,28 @@ Napi::Value PlayerWrapper::setURL(const Napi::CallbackInfo& info){
 	return info.Env().Undefined();
 }
 
+Napi::Value PlayerWrapper::setCacheKey(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> setCacheKey(info[0].As<Napi::String>());
+
+	return info.Env().Undefined();
+}
+
 Napi::Value PlayerWrapper::setOutput(const Napi::CallbackInfo& info){
 	checkDestroyed(info.Env());
 
+	int frame_duration = 20, sample_rate = info[1].As<Napi::Number>().Int32Value();
+
+	/* the rates opus encodes at */
+	if(sample_rate != 8000 && sample_rate != 12000 && sample_rate != 16000 && sample_rate != 24000 && sample_rate != 48000)
+		throw Napi::Error::New(info.Env(), "Invalid sample rate");
+	if(info.Length() > 3 && !info[3].IsUndefined())
+		frame_duration = info[3].As<Napi::Number>().Int32Value();
+	if(frame_duration != 10 && frame_duration != 20 && frame_duration != 40 && frame_duration != 60)
+		throw Napi::Error::New(info.Env(), "Invalid frame duration");
 	player -> setOutputCodec(AV_CODEC_ID_OPUS);
-	player -> setFormat(info[0].As<Napi::Number>().Int32Value(), info[1].As<Napi::Number>().Int32Value(), info[2].As<Napi::Number>().Int32Value());
+	player -> setFormat(info[0].As<Napi::Number>().Int32Value(), sample_rate, info[2].As<Napi::Number>().Int32Value(), frame_duration);
 
 	return info.Env().Undefined();
 }
@@ -444,13 +879,17 @@ Napi::Value PlayerWrapper::getDuration(const Napi::CallbackInfo& info){
 Napi::Value PlayerWrapper::getFramesDropped(const Napi::CallbackInfo& info){
 	checkDestroyed(info.Env());
 
-	return Napi::Number::New(info.Env(), player -> getDroppedSamples() / 960);
+	int frame_size = player -> getFrameSize();
+
+	return Napi::Number::New(info.Env(), frame_size > 0 ? player -> getDroppedSamples() / frame_size : 0);
 }
 
 Napi::Value PlayerWrapper::getTotalFrames(const Napi::CallbackInfo& info){
 	checkDestroyed(info.Env());
 
-	return Napi::Number::New(info.Env(), player -> getTotalSamples() / 960);
+	int frame_size = player -> getFrameSize();
+
+	return Napi::Number::New(info.Env(), frame_size > 0 ? player -> getTotalSamples() / frame_size : 0);
 }
 
 Napi::Value PlayerWrapper::getTotalPackets(const Napi::CallbackInfo& info){
@@ -459,14 +898,321 @@ Napi::Value PlayerWrapper::getTotalPackets(const Napi::CallbackInfo& info){
 	return Napi::Number::New(info.Env(), player -> getTotalPackets());
 }
 
+Napi::Value PlayerWrapper::setBufferAhead(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> setBufferAhead(info[0].As<Napi::Number>().Int64Value());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getBufferStats(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	JitterStats stats = player -> getBufferStats();
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	obj["capacity"] = stats.capacity;
+	obj["fill"] = stats.fill;
+	obj["packets"] = stats.packets;
+	obj["underruns"] = stats.underruns;
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::setPipelined(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> setPipelined(info[0].As<Napi::Boolean>().Value());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::setNativeStretch(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> setNativeStretch(info[0].As<Napi::Boolean>().Value());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::setNativeDemuxer(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> setNativeDemuxer(info[0].As<Napi::Boolean>().Value());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getFilterStats(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	FilterStats stats = player -> getFilterStats();
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	obj["rebuilds"] = stats.rebuilds;
+	obj["commands"] = stats.commands;
+	obj["rebuildTime"] = stats.rebuilds ? stats.rebuild_time / stats.rebuilds : 0;
+	obj["rebuildLast"] = stats.rebuild_last;
+	obj["rebuildMax"] = stats.rebuild_max;
+	obj["spareHits"] = stats.spare_hits;
+	obj["spareMisses"] = stats.spare_misses;
+	obj["spareHitRate"] = stats.rebuilds ? (double)stats.spare_hits / stats.rebuilds : 0;
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::addMixInput(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	bool isfile = false;
+	float gain = 1;
+
+	if(info.Length() > 1 && info[1].As<Napi::Boolean>().Value())
+		isfile = true;
+	if(info.Length() > 2 && !info[2].IsUndefined())
+		gain = info[2].As<Napi::Number>().FloatValue();
+	int id = player -> addMixInput(info[0].As<Napi::String>(), isfile, gain);
+
+	if(id < 0){
+		char buf[256];
+
+		av_strerror(id, buf, sizeof(buf));
+
+		throw Napi::Error::New(info.Env(), std::string("Could not add mix input: ") + buf);
+	}
+
+	return Napi::Number::New(info.Env(), id);
+}
+
+Napi::Value PlayerWrapper::removeMixInput(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	return Napi::Boolean::New(info.Env(), !player -> removeMixInput(info[0].As<Napi::Number>().Int32Value()));
+}
+
+Napi::Value PlayerWrapper::setMixInputGain(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	return Napi::Boolean::New(info.Env(), !player -> setMixInputGain(info[0].As<Napi::Number>().Int32Value(), info[1].As<Napi::Number>().FloatValue()));
+}
+
+Napi::Value PlayerWrapper::setDucking(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	long ms = 250;
+
+	if(info.Length() > 1 && !info[1].IsUndefined())
+		ms = info[1].As<Napi::Number>().Int64Value();
+	player -> setDucking(info[0].As<Napi::Number>().FloatValue(), ms);
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getMixerStats(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	MixerStats stats = player -> getMixerStats();
+	Napi::Object obj = Napi::Object::New(info.Env());
+
+	obj["inputs"] = stats.inputs;
+	obj["duck"] = stats.duck;
+	obj["underruns"] = stats.underruns;
+
+	return obj;
+}
+
+Napi::Value PlayerWrapper::setComplexity(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> setComplexity(info[0].As<Napi::Number>().Int32Value());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::setSignal(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	std::string type = info[0].As<Napi::String>().Utf8Value();
+	int signal;
+
+	if(type == "auto")
+		signal = OPUS_AUTO;
+	else if(type == "music")
+		signal = OPUS_SIGNAL_MUSIC;
+	else if(type == "voice")
+		signal = OPUS_SIGNAL_VOICE;
+	else
+		throw Napi::Error::New(info.Env(), "Unknown signal type");
+	player -> setSignal(signal);
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::enqueue(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	bool isfile = false;
+
+	if(info.Length() > 1 && info[1].As<Napi::Boolean>().Value())
+		isfile = true;
+	player -> enqueue(info[0].As<Napi::String>(), isfile);
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::clearQueue(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> clearQueue();
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::setLoop(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	std::string mode = info[0].As<Napi::String>().Utf8Value();
+	int loop;
+
+	if(mode == "none")
+		loop = Player::LOOP_NONE;
+	else if(mode == "track")
+		loop = Player::LOOP_TRACK;
+	else if(mode == "queue")
+		loop = Player::LOOP_QUEUE;
+	else
+		throw Napi::Error::New(info.Env(), "Unknown loop mode");
+	player -> setLoop(loop);
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getQueueLength(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	return Napi::Number::New(info.Env(), player -> getQueueLength());
+}
+
+Napi::Value PlayerWrapper::setFastStart(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	player -> setFastStart(info[0].As<Napi::Boolean>().Value());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::setFormatHint(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	std::string format;
+
+	if(info.Length() > 0 && !info[0].IsUndefined() && !info[0].IsNull()){
+		format = info[0].As<Napi::String>().Utf8Value();
+
+		if(!av_find_input_format(format.c_str()))
+			throw Napi::Error::New(info.Env(), "Unknown format");
+	}
+
+	player -> setFormatHint(format);
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::setProbeLimits(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	long size = 0, analyze = 0;
+
+	if(info.Length() > 0 && !info[0].IsUndefined())
+		size = info[0].As<Napi::Number>().Int64Value();
+	if(info.Length() > 1 && !info[1].IsUndefined())
+		analyze = info[1].As<Napi::Number>().Int64Value();
+	player -> setProbeLimits(size, analyze);
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getReadyTime(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	return Napi::Number::New(info.Env(), player -> getReadyTime());
+}
+
+Napi::Value PlayerWrapper::subscribe(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	PlayerWrapper* target = PlayerWrapper::Unwrap(info[0].As<Napi::Object>());
+
+	if(!target || !target -> player)
+		throw Napi::Error::New(info.Env(), "Invalid broadcast source");
+	if(target == this || target -> source || subscribers.size())
+		throw Napi::Error::New(info.Env(), "Broadcasts cannot be chained");
+	if(started)
+		throw Napi::Error::New(info.Env(), "Player has already been started");
+	if(source)
+		do_unsubscribe();
+	if(message.init(event_depth))
+		throw Napi::Error::New(info.Env(), "Failed to create uv_async_t");
+	target -> player -> data_mutex.lock();
+
+	try{
+		target -> subscribers.push_back(this);
+	}catch(std::bad_alloc& e){
+		target -> player -> data_mutex.unlock();
+
+		throw Napi::Error::New(info.Env(), "Out of memory");
+	}
+
+	source = target;
+	subscriber_failed = false;
+	source_finished = false;
+	packet_emitted = false;
+	target -> player -> data_mutex.unlock();
+
+	/* keeps the source alive for as long as this subscriber listens to it */
+	source_ref = Napi::Persistent(info[0].As<Napi::Object>());
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::unsubscribe(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	if(source)
+		do_unsubscribe();
+	return info.Env().Undefined();
+}
+
+void PlayerWrapper::do_unsubscribe(){
+	Player* source_player = source -> player;
+
+	source_player -> data_mutex.lock();
+
+	for(size_t i = 0; i < source -> subscribers.size(); i++){
+		if(source -> subscribers[i] == this){
+			source -> subscribers.erase(source -> subscribers.begin() + i);
+
+			break;
+		}
+	}
+
+	source = nullptr;
+	source_player -> data_mutex.unlock();
+	source_ref.Reset();
+}
+
 Napi::Value PlayerWrapper::start(const Napi::CallbackInfo& info){
 	checkDestroyed(info.Env());
 
-	int err = message.init();
+	if(source)
+		throw Napi::Error::New(info.Env(), "Player is subscribed to a broadcast");
+	int err = message.init(event_depth);
 
 	if(err)
 		throw Napi::Error::New(info.Env(), "Failed to create uv_async_t");
 	err = player -> start();
+	started = !err;
 
 	if(err){
 		std::string str("Could not start thread: ");
@@ -500,6 +1246,8 @@ Napi::Value PlayerWrapper::setSecretBox(const Napi::CallbackInfo& info){
 	Napi::Number mode = info[1].As<Napi::Number>();
 	Napi::Number ssrc = info[2].As<Napi::Number>();
 
+	if(mode.Int32Value() == SecretBox::AEAD_AES256_GCM_RTPSIZE && !crypto_aead_aes256gcm_is_available())
+		throw Napi::Error::New(info.Env(), "AES-256-GCM is not supported on this CPU");
 	secretbox.lock();
 
 	try{
@@ -507,13 +1255,12 @@ Napi::Value PlayerWrapper::setSecretBox(const Napi::CallbackInfo& info){
 			secret_box.secret_key.resize(32);
 		else
 			secret_box.secret_key.resize(key.ByteLength());
-		if(!secret_box.buffer.size())
-			secret_box.buffer.resize(BUFFER_SIZE);
 		memcpy(secret_box.secret_key.data(), key.Data(), key.ByteLength());
 
-		secret_box.buffer[0] = 0x80;
-		secret_box.buffer[1] = 0x78;
 		secret_box.mode = mode.Int32Value();
+
+		if(secret_box.mode == SecretBox::AEAD_AES256_GCM_RTPSIZE)
+			crypto_aead_aes256gcm_beforenm(&secret_box.aes_state, secret_box.secret_key.data());
 		secret_box.ssrc = ssrc.Int32Value();
 		secret_box.sequence = 0;
 		secret_box.timestamp = 0;
@@ -672,6 +1419,44 @@ Napi::Value PlayerWrapper::isCodecCopy(const Napi::CallbackInfo& info){
 	return Napi::Boolean::New(info.Env(), player -> isCodecCopy());
 }
 
+Napi::Value PlayerWrapper::getNativePackets(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	return Napi::Number::New(info.Env(), player -> getNativePackets());
+}
+
+Napi::Value PlayerWrapper::setEventQueueDepth(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	int depth = info[0].As<Napi::Number>().Int32Value();
+
+	if(depth <= 0)
+		throw Napi::RangeError::New(info.Env(), "Invalid event queue depth");
+	event_depth = depth;
+
+	return info.Env().Undefined();
+}
+
+Napi::Value PlayerWrapper::getEventsDropped(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	return Napi::Number::New(info.Env(), message.get_dropped());
+}
+
+Napi::Value PlayerWrapper::setBatchedPackets(const Napi::CallbackInfo& info){
+	checkDestroyed(info.Env());
+
+	int count = 0;
+
+	if(info.Length() && !info[0].IsUndefined())
+		count = info[0].As<Napi::Number>().Int32Value();
+	batch_size = count > 1 ? count : 0;
+
+	if(!batch_size)
+		flush_packets();
+	return info.Env().Undefined();
+}
+
 Napi::Value PlayerWrapper::send(const Napi::CallbackInfo& info){
 	return info.Env().Undefined();
 }
@@ -682,12 +1467,12 @@ static void write(void* data, T value){
 }
 
 template<typename T>
-static void write(std::vector<uint8_t>& data, T value, int offset){
-	write(data.data() + offset, value);
+static void write(uint8_t* data, T value, int offset){
+	write(data + offset, value);
 }
 
 template<typename T>
-static void write_offset(std::vector<uint8_t>& data, T value, int& offset){
+static void write_offset(uint8_t* data, T value, int& offset){
 	write(data, value, offset);
 
 	offset += sizeof(T);
@@ -697,45 +1482,61 @@ int PlayerWrapper::process_packet(AVPacket* player_packet){
 	av_packet_unref(packet);
 	av_packet_move_ref(packet, player_packet);
 
+	return seal_packet();
+}
+
+int PlayerWrapper::seal_packet(){
 	if(!secret_box.secret_key.size())
-		return 0;
-	if(packet -> size > crypto_secretbox_MESSAGEBYTES_MAX)
+		return av_packet_make_refcounted(packet);
+	if((size_t)packet -> size > crypto_secretbox_MESSAGEBYTES_MAX)
 		return AVERROR_EXIT; /* should never happen */
+	static_assert(crypto_aead_aes256gcm_ABYTES == crypto_secretbox_MACBYTES && crypto_aead_xchacha20poly1305_ietf_ABYTES == crypto_secretbox_MACBYTES, "tag size mismatch");
+
 	int offset = 2,
 		len,
 		msg_length = packet -> size + crypto_secretbox_MACBYTES;
-	int err = 0;
-	uint8_t* nonce;
+	uint8_t* nonce, *data;
+
+	/* a fresh buffer every packet, the previous one may still be referenced by js */
+	AVBufferRef* buf = context -> player.get_pool() -> get();
+
+	if(!buf)
+		return AVERROR(ENOMEM);
+	data = buf -> data;
+	data[0] = 0x80;
+	data[1] = 0x78;
 
 	secretbox.lock();
 
 	secret_box.sequence++;
 	secret_box.timestamp += packet -> duration;
 
-	write_offset(secret_box.buffer, htons(secret_box.sequence), offset);
-	write_offset(secret_box.buffer, htonl(secret_box.timestamp), offset);
-	write_offset(secret_box.buffer, htonl(secret_box.ssrc), offset);
+	write_offset(data, htons(secret_box.sequence), offset);
+	write_offset(data, htonl(secret_box.timestamp), offset);
+	write_offset(data, htonl(secret_box.ssrc), offset);
 
 	switch(secret_box.mode){
+		case SecretBox::AEAD_AES256_GCM_RTPSIZE:
+		case SecretBox::AEAD_XCHACHA20_POLY1305_RTPSIZE:
 		case SecretBox::LITE:
 			len = 4;
 			secret_box.nonce++;
 			nonce = secret_box.nonce_buffer;
 
-			if(len + msg_length + offset > secret_box.buffer.size())
+			if((size_t)(len + msg_length + offset) > buf -> size)
 				goto fail;
 			write(secret_box.nonce_buffer, htonl(secret_box.nonce));
-			write(secret_box.buffer, htonl(secret_box.nonce), offset + msg_length);
+			write(data, htonl(secret_box.nonce), offset + msg_length);
 
 			break;
 		case SecretBox::SUFFIX:
 			len = 24;
 			nonce = secret_box.random_bytes;
 
-			if(len + msg_length + offset > secret_box.buffer.size())
+			if((size_t)(len + msg_length + offset) > buf -> size)
 				goto fail;
 			randombytes_buf(secret_box.random_bytes, sizeof(secret_box.random_bytes));
-			write(secret_box.buffer, secret_box.random_bytes, offset + msg_length);
+			memcpy(data + offset + msg_length, secret_box.random_bytes, len);
 
 			break;
 		case SecretBox::DEFAULT:
@@ -743,23 +1544,43 @@ int PlayerWrapper::process_packet(AVPacket* player_packet){
 			len = 0;
 			nonce = secret_box.audio_nonce;
 
-			if(len + msg_length + offset > secret_box.buffer.size())
+			if((size_t)(len + msg_length + offset) > buf -> size)
 				goto fail;
-			memcpy(secret_box.audio_nonce, secret_box.buffer.data(), offset);
+			memcpy(secret_box.audio_nonce, data, offset);
 
 			break;
 	}
 
-	crypto_secretbox_easy(secret_box.buffer.data() + offset, packet -> data, packet -> size, nonce, secret_box.secret_key.data());
+	switch(secret_box.mode){
+		case SecretBox::AEAD_AES256_GCM_RTPSIZE:
+			/* the rtp header is authenticated but sent in the clear */
+			crypto_aead_aes256gcm_encrypt_afternm(data + offset, nullptr, packet -> data, packet -> size, data, offset, nullptr, nonce, &secret_box.aes_state);
 
+			break;
+		case SecretBox::AEAD_XCHACHA20_POLY1305_RTPSIZE:
+			crypto_aead_xchacha20poly1305_ietf_encrypt(data + offset, nullptr, packet -> data, packet -> size, data, offset, nullptr, nonce, secret_box.secret_key.data());
+
+			break;
+		default:
+			crypto_secretbox_easy(data + offset, packet -> data, packet -> size, nonce, secret_box.secret_key.data());
+
+			break;
+	}
+
+	av_buffer_unref(&secret_box.buffer);
+
+	secret_box.buffer = buf;
 	secret_box.message_size = offset + msg_length + len;
 
 	secretbox.unlock();
 
-	return err;
+	return 0;
 
 	fail:
 
+	secretbox.unlock();
+	av_buffer_unref(&buf);
+
 	return AVERROR_BUFFER_TOO_SMALL;
 }
 
@@ -770,7 +1591,7 @@ int PlayerWrapper::send_packet(){
 
 	secretbox.lock();
 
-	if(fd >= 0 && ::send(fd, secret_box.buffer.data(), secret_box.message_size, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+	if(fd >= 0 && secret_box.buffer && ::send(fd, secret_box.buffer -> data, secret_box.message_size, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
 		err = AVERROR(errno);
 	secretbox.unlock();
 
@@ -778,47 +1599,132 @@ int PlayerWrapper::send_packet(){
 }
 
 void PlayerWrapper::handle_ready(){
-	self.Get("onready").As<Napi::Function>().Call(self.Value(), {});
+	self.Get("onready").As<Napi::Function>().Call(self.Value(), {Napi::Number::New(Env(), (source ? source -> player : player) -> getReadyTime())});
 }
 
-void PlayerWrapper::handle_packet(){
-	void* data;
-	int size;
+static void release_buffer(Napi::Env env, void* data, AVBufferRef* buffer){
+	av_buffer_unref(&buffer);
+}
 
-	Napi::Uint8Array array;
+void PlayerWrapper::handle_packet(MessageEvent& event){
+	int size = event.size;
 
-	if(secret_box.secret_key.size()){
-		data = secret_box.buffer.data();
-		size = secret_box.message_size;
-	}else{
-		data = packet -> data;
-		size = packet -> size;
-	}
+	Napi::Uint8Array array;
 
 	if(!buffer.IsEmpty()){
 		array = buffer.Value();
 
-		if(size > array.ByteLength())
+		if((size_t)size > array.ByteLength())
 			size = array.ByteLength();
+		memcpy(array.Data(), event.buffer -> data + event.offset, size);
 	}else{
-		array = Napi::Uint8Array::New(Env(), size);
+		Napi::ArrayBuffer data;
+
+		/*
+		 * only hand the buffer to js without a copy when nothing else references it,
+		 * demuxed packets can be slices of a block or page shared with other packets
+		 */
+		if(av_buffer_is_writable(event.buffer)){
+			try{
+				/* expose just this packet, the buffer goes back to the pool when collected */
+				data = Napi::ArrayBuffer::New(Env(), event.buffer -> data + event.offset, size, release_buffer, event.buffer);
+				/* owned by the array buffer from here on */
+				event.buffer = nullptr;
+				array = Napi::Uint8Array::New(Env(), size, data, 0);
+			}catch(Napi::Error& e){
+				/* external buffers not allowed, anything after that is a real error */
+				if(!event.buffer)
+					throw;
+			}
+		}
+
+		if(event.buffer){
+			array = Napi::Uint8Array::New(Env(), size);
+
+			memcpy(array.Data(), event.buffer -> data + event.offset, size);
+		}
 	}
 
-	int64_t duration = packet -> duration;
+	self.Get("onpacket").As<Napi::Function>().Call(self.Value(), {array, Napi::Number::New(Env(), size), Napi::Number::New(Env(), event.duration)});
+}
 
-	memcpy(array.Data(), data, size);
-	av_packet_unref(packet);
+void PlayerWrapper::queue_packet(MessageEvent& event){
+	try{
+		batch.push_back({event.buffer, event.offset, event.size, event.duration});
+	}catch(std::bad_alloc& e){
+		/* deliver it on its own, after the packets before it */
+		flush_packets();
+		handle_packet(event);
 
-	self.Get("onpacket").As<Napi::Function>().Call(self.Value(), {array, Napi::Number::New(Env(), size), Napi::Number::New(Env(), duration)});
+		return;
+	}
+
+	/* the batch holds the reference until the drain ends, no copy yet */
+	event.buffer = nullptr;
+	batch_bytes += event.size;
+
+	if(batch.size() >= batch_size)
+		flush_packets();
+}
+
+void PlayerWrapper::flush_packets(){
+	size_t count = batch.size(), offset = 0;
+
+	if(!count)
+		return;
+	Napi::Uint8Array array = Napi::Uint8Array::New(Env(), batch_bytes);
+	Napi::Uint32Array offsets = Napi::Uint32Array::New(Env(), count + 1);
+	Napi::Uint32Array durations = Napi::Uint32Array::New(Env(), count);
+
+	for(size_t i = 0; i < count; i++){
+		BatchedPacket& packet = batch[i];
+
+		memcpy(array.Data() + offset, packet.buffer -> data + packet.offset, packet.size);
+
+		offsets[i] = offset;
+		durations[i] = packet.duration;
+		offset += packet.size;
+	}
+
+	offsets[count] = offset;
+
+	clear_packets();
+
+	self.Get("onpackets").As<Napi::Function>().Call(self.Value(), {array, offsets, durations});
+}
+
+void PlayerWrapper::clear_packets(){
+	for(BatchedPacket& packet : batch)
+		av_buffer_unref(&packet.buffer);
+	batch.clear();
+	batch_bytes = 0;
+}
+
+void PlayerWrapper::handle_next(){
+	self.Get("onnext").As<Napi::Function>().Call(self.Value(), {});
 }
 
 void PlayerWrapper::handle_finish(){
 	self.Get("onfinish").As<Napi::Function>().Call(self.Value(), {});
 }
 
-void PlayerWrapper::handle_error(std::string& str, int err_code){
+void PlayerWrapper::handle_error(int err_code){
+	std::string str;
+
 	bool retry;
 
+	error_mutex.lock();
+
+	/* error events arrive in the order their slots were taken */
+	try{
+		str = errors[error_tail % ERROR_SLOTS];
+	}catch(std::bad_alloc& e){
+		/* report the code without the text */
+	}
+
+	error_tail++;
+	error_mutex.unlock();
+
 	switch(err_code){
 		case AVERROR_HTTP_BAD_REQUEST:
 		case AVERROR_HTTP_UNAUTHORIZED:
@@ -845,24 +1751,28 @@ void PlayerWrapper::handle_error(std::string& str, int err_code){
 void PlayerWrapper::do_destroy(){
 	if(!player)
 		return;
+	if(source)
+		do_unsubscribe();
+	detach_subscribers();
 	player -> data_mutex.lock();
 	player -> data = nullptr;
 	message.destroy();
 	player -> data_mutex.unlock();
 	player -> destroy();
-	mutex.lock();
-	mutex.unlock();
 	player = nullptr;
 
 	if(fd != -1)
 		close(fd);
 
 	std::vector<uint8_t>().swap(secret_box.secret_key);
-	std::vector<uint8_t>().swap(secret_box.buffer);
+	av_buffer_unref(&secret_box.buffer);
 
 	av_packet_free(&packet);
 
 	self.Reset();
 	buffer.Reset();
+
+	clear_packets();
+	std::vector<BatchedPacket>().swap(batch);
 	context -> closed();
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include <napi.h>
 #include <vector>
+#include <sodium/crypto_aead_aes256gcm.h>
 #include "ffmpeg.h"
 
 class PlayerWrapper;
@@ -8,6 +9,7 @@ class PlayerWrapper;
 #include "player.h"
 #include "message.h"
 #include "thread.h"
+#include "pool.h"
 
 class AddonContext;
 class PlayerWrapper : public Napi::ObjectWrap<PlayerWrapper>, public MessageHandler{
@@ -17,11 +19,16 @@ private:
 			NONE = 0,
 			LITE,
 			SUFFIX,
-			DEFAULT
+			DEFAULT,
+			AEAD_AES256_GCM_RTPSIZE,
+			AEAD_XCHACHA20_POLY1305_RTPSIZE
 		};
 
 		std::vector<uint8_t> secret_key;
-		std::vector<uint8_t> buffer;
+		AVBufferRef* buffer;
+
+		/* expanded key for aes256-gcm */
+		crypto_aead_aes256gcm_state aes_state;
 
 		uint8_t nonce_buffer[24];
 		uint8_t random_bytes[24];
@@ -45,15 +52,22 @@ private:
 	void checkDestroyed(Napi::Env env);
 
 	void handle_ready();
-	void handle_packet();
+	void handle_packet(MessageEvent& event);
+	void queue_packet(MessageEvent& event);
+	void flush_packets();
+	void clear_packets();
+	void handle_next();
 	void handle_finish();
-	void handle_error(std::string& str, int err_code);
+	void handle_error(int err_code);
 	void do_destroy();
+	void report_error(int err);
+	void send_error(const std::string& str, int err);
 
 	static int player_ready(Player* player);
 	static int player_seeked(Player* player);
 	static int player_packet(Player* player, AVPacket* packet);
 	static int player_send_packet(Player* player);
+	static int player_next(Player* player);
 	static int player_finish(Player* player);
 	static void player_error(Player* player, const std::string& error, int code);
 
@@ -63,36 +77,97 @@ private:
 
 	int fd;
 
-	std::string error;
-	int error_code;
+	enum{
+		/* error events js has not handled yet */
+		ERROR_SLOTS = 4
+	};
+
+	/* text and code per pending error event, preallocated so the ring never allocates */
+	std::string errors[ERROR_SLOTS];
+	int error_codes[ERROR_SLOTS];
+	size_t error_head;
+	size_t error_tail;
 
 	bool ext_send;
 	bool packet_emitted;
 
 	AVPacket* packet;
 
-	Mutex mutex;
 	Mutex secretbox;
+	Mutex error_mutex;
 	AddonContext* context;
 	Message message;
 
-	int message_type;
+	size_t event_depth;
+
+	struct BatchedPacket{
+		AVBufferRef* buffer;
+		int offset;
+		int size;
+
+		int64_t duration;
+	};
+
+	/* batched packet delivery, max packets per onpackets call, 0 when disabled, only touched on the event loop */
+	size_t batch_size;
+
+	/* packets taken from the ring in the current drain, copied into js once when it ends */
+	std::vector<BatchedPacket> batch;
+	size_t batch_bytes;
+
+	/* broadcast fan out, subscribers are fed by the source's thread and never run their own player */
+	PlayerWrapper* source;
+	Napi::ObjectReference source_ref;
+	std::vector<PlayerWrapper*> subscribers;
+
+	bool subscriber_failed;
+	bool source_finished;
+	bool started;
 
 	int process_packet(AVPacket* packet);
+	int seal_packet();
 	int send_packet();
+	int deliver_packet();
+	void broadcast_packet();
+	void broadcast_send();
+	void broadcast_message(int type);
+	void detach_subscribers();
+	void do_unsubscribe();
 	int send_message(int type);
-	void handle_message();
+	void handle_message(MessageEvent& event);
+	void messages_drained();
 
 	friend class Message;
 public:
 	static Napi::Function init(Napi::Env env);
 
+	static Napi::Value setWorkerThreads(const Napi::CallbackInfo& info);
+
+	static Napi::Value getSchedulerStats(const Napi::CallbackInfo& info);
+
+	static Napi::Value getBufferPoolStats(const Napi::CallbackInfo& info);
+	static Napi::Value getAllocationStats(const Napi::CallbackInfo& info);
+
+	static Napi::Value setPacketCache(const Napi::CallbackInfo& info);
+
+	static Napi::Value setMemoryCache(const Napi::CallbackInfo& info);
+
+	static Napi::Value getPacketCacheStats(const Napi::CallbackInfo& info);
+
+	static Napi::Value setGovernor(const Napi::CallbackInfo& info);
+
+	static Napi::Value getGovernorStats(const Napi::CallbackInfo& info);
+
+	static Napi::Value getProbeCacheStats(const Napi::CallbackInfo& info);
+
 	PlayerWrapper(const Napi::CallbackInfo& info);
 
 	~PlayerWrapper();
 
 	Napi::Value setURL(const Napi::CallbackInfo& info);
 
+	Napi::Value setCacheKey(const Napi::CallbackInfo& info);
+
 	Napi::Value setOutput(const Napi::CallbackInfo& info);
 
 	Napi::Value setPaused(const Napi::CallbackInfo& info);
@@ -137,5 +212,59 @@ public:
 
 	Napi::Value isCodecCopy(const Napi::CallbackInfo& info);
 
+	Napi::Value getNativePackets(const Napi::CallbackInfo& info);
+
 	Napi::Value send(const Napi::CallbackInfo& info);
+
+	Napi::Value setEventQueueDepth(const Napi::CallbackInfo& info);
+
+	Napi::Value getEventsDropped(const Napi::CallbackInfo& info);
+
+	Napi::Value setBatchedPackets(const Napi::CallbackInfo& info);
+
+	Napi::Value setBufferAhead(const Napi::CallbackInfo& info);
+
+	Napi::Value getBufferStats(const Napi::CallbackInfo& info);
+
+	Napi::Value setPipelined(const Napi::CallbackInfo& info);
+
+	Napi::Value setNativeStretch(const Napi::CallbackInfo& info);
+
+	Napi::Value setNativeDemuxer(const Napi::CallbackInfo& info);
+
+	Napi::Value getFilterStats(const Napi::CallbackInfo& info);
+
+	Napi::Value addMixInput(const Napi::CallbackInfo& info);
+
+	Napi::Value removeMixInput(const Napi::CallbackInfo& info);
+
+	Napi::Value setMixInputGain(const Napi::CallbackInfo& info);
+
+	Napi::Value setDucking(const Napi::CallbackInfo& info);
+
+	Napi::Value getMixerStats(const Napi::CallbackInfo& info);
+
+	Napi::Value setComplexity(const Napi::CallbackInfo& info);
+
+	Napi::Value setSignal(const Napi::CallbackInfo& info);
+
+	Napi::Value enqueue(const Napi::CallbackInfo& info);
+
+	Napi::Value clearQueue(const Napi::CallbackInfo& info);
+
+	Napi::Value setLoop(const Napi::CallbackInfo& info);
+
+	Napi::Value getQueueLength(const Napi::CallbackInfo& info);
+
+	Napi::Value subscribe(const Napi::CallbackInfo& info);
+
+	Napi::Value unsubscribe(const Napi::CallbackInfo& info);
+
+	Napi::Value setFastStart(const Napi::CallbackInfo& info);
+
+	Napi::Value setFormatHint(const Napi::CallbackInfo& info);
+
+	Napi::Value setProbeLimits(const Napi::CallbackInfo& info);
+
+	Napi::Value getReadyTime(const Napi::CallbackInfo& info);
 };
\ No newline at end of file
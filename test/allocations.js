@@ -0,0 +1,141 @@
+// counts heap allocations per packet on the player threads once warmed up, on the codec copy, transcode and native stretch paths
+// anything sange allocates per packet fails the test, including what it allocates through libavutil (av_malloc, av_buffer_alloc, av_packet_alloc)
+// allocations by libav's decoder and filters are counted apart, the codec copy path must not make any and the decoding paths must stay within LIBAV_BUDGET
+// needs a debug build (npm run debug)
+// usage: npm run test:alloc -- <opus webm or ogg file, at least 20 seconds long>
+const path = require('path');
+const child_process = require('child_process');
+
+const hook = path.join(__dirname, '..', 'build', 'Debug', 'libsange_alloc.so');
+
+if(!process.env.LD_PRELOAD){
+	// the hook has to be in place before libav is loaded, rerun with it preloaded
+	const result = child_process.spawnSync(process.execPath, process.argv.slice(1), {
+		stdio: 'inherit',
+		env: {...process.env, LD_PRELOAD: hook}
+	});
+
+	process.exit(result.status);
+}
+
+const Player = require('..');
+
+const WARMUP_PACKETS = 250;
+const PACKETS = 500;
+
+// libav allocations per packet allowed when decoding, none of them can be pooled away from outside libav:
+// every buffer a pool hands out still allocates its AVBuffer and AVBufferRef, and each filter allocates a frame for every frame it passes on
+// decoder, buffer source, resampler, format and sink come to about a dozen, rebuilding a graph costs hundreds
+const LIBAV_BUDGET = 16;
+
+const PATHS = [
+	{name: 'codec copy', transcode: false},
+	{name: 'transcode', transcode: true, setup: (player) => player.setVolume(0.5)},
+	// frames come out of the stretcher instead of the decoder
+	{name: 'native stretch', transcode: true, setup: (player) => {
+		player.setNativeStretch(true);
+		player.setTempo(1.25);
+	}}
+];
+
+function measure(file, path){
+	return new Promise((resolve, reject) => {
+		// packets are copied into this buffer, so pooled buffers come back right away instead of on gc
+		const player = new Player(Buffer.alloc(8192));
+		const marks = [];
+
+		let packets = 0;
+
+		player.setURL(file, true);
+		player.setOutput(2, 48000, 64000, 20);
+
+		if(path.setup)
+			path.setup(player);
+		player.on('packet', () => {
+			packets++;
+
+			if(packets == WARMUP_PACKETS || packets == WARMUP_PACKETS + PACKETS)
+				marks.push({allocs: Player.getAllocationStats(), pool: Player.getBufferPoolStats()});
+			if(packets < WARMUP_PACKETS + PACKETS)
+				return;
+			const codecCopy = player.ffplayer.isCodecCopy();
+
+			player.destroy();
+			resolve({marks, codecCopy});
+		});
+
+		player.on('finish', () => {
+			player.destroy();
+			reject(new Error('input ended after ' + packets + ' packets, ' + (WARMUP_PACKETS + PACKETS) + ' needed'));
+		});
+
+		player.on('onerror', (error) => {
+			player.destroy();
+			reject(error);
+		});
+
+		player.start();
+	});
+}
+
+async function run(file){
+	const stats = Player.getAllocationStats();
+
+	let failed = false;
+
+	if(!stats)
+		throw new Error('allocation hook not loaded, is ' + hook + ' built?');
+	if(stats.libavAllocations === undefined)
+		throw new Error('libavutil is not a shared library, its allocations cannot be told apart');
+	for(const path of PATHS){
+		const {marks, codecCopy} = await measure(file, path);
+		const [start, end] = marks;
+
+		const allocs = end.allocs.allocations - start.allocs.allocations;
+		const libav = end.allocs.libavAllocations - start.allocs.libavAllocations;
+		const own = allocs - libav;
+		const buffers = end.pool.allocations - start.pool.allocations;
+
+		console.log(path.name + ': ' + (own / PACKETS).toFixed(2) + ' allocations per packet, ' +
+			(libav / PACKETS).toFixed(2) + ' libav allocations per packet, ' + buffers + ' new pool buffers');
+
+		if(codecCopy == path.transcode){
+			console.log('  FAIL: expected the ' + path.name + ' path, is the input opus?');
+			failed = true;
+		}
+
+		if(buffers){
+			console.log('  FAIL: packet buffers allocated after warm-up');
+			failed = true;
+		}
+
+		if(own){
+			console.log('  FAIL: ' + own + ' allocations over ' + PACKETS + ' packets after warm-up, expected none');
+			failed = true;
+		}
+
+		if(!path.transcode && libav){
+			console.log('  FAIL: ' + libav + ' libav allocations over ' + PACKETS + ' packets after warm-up, expected none without decoding');
+			failed = true;
+		}
+
+		if(path.transcode && libav > LIBAV_BUDGET * PACKETS){
+			console.log('  FAIL: ' + (libav / PACKETS).toFixed(2) + ' libav allocations per packet after warm-up, over the budget of ' + LIBAV_BUDGET);
+			failed = true;
+		}
+	}
+
+	return failed;
+}
+
+if(process.argv.length < 3){
+	console.log('usage: node test/allocations.js <file>');
+	process.exit(2);
+}
+
+run(path.resolve(process.argv[2])).then((failed) => {
+	process.exit(failed ? 1 : 0);
+}).catch((error) => {
+	console.error(error);
+	process.exit(1);
+});
\ No newline at end of file
@@ -0,0 +1,412 @@
+// plays generated webm and ogg opus files through the native demuxer on the codec copy path and checks every packet
+// covers block lacing, packets joined across ogg pages, and seeks on the webm cues and by bisecting the ogg pages
+// usage: npm run test:demuxer
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+const Player = require('..');
+
+const PRE_SKIP = 312;
+const FRAME_MS = 20;
+
+// one 20 ms celt frame, stereo, the rest is filler the codec copy path never decodes
+function opusPacket(index, size){
+	const packet = Buffer.alloc(size);
+
+	packet[0] = 0xfc;
+	packet[1] = index >> 8;
+	packet[2] = index & 0xff;
+
+	for(let i = 3; i < size; i++)
+		packet[i] = (index * 7 + i) & 0xff;
+	return packet;
+}
+
+function opusHead(){
+	const head = Buffer.alloc(19);
+
+	head.write('OpusHead', 0);
+	head[8] = 1;
+	head[9] = 2;
+	head.writeUInt16LE(PRE_SKIP, 10);
+	head.writeUInt32LE(48000, 12);
+
+	return head;
+}
+
+// ebml
+function ebmlId(id){
+	const length = id > 0xffffff ? 4 : id > 0xffff ? 3 : id > 0xff ? 2 : 1;
+	const bytes = Buffer.alloc(length);
+
+	bytes.writeUIntBE(id, 0, length);
+
+	return bytes;
+}
+
+function ebmlSize(size){
+	let length = 1;
+
+	while(size >= 2 ** (7 * length) - 1)
+		length++;
+	const bytes = Buffer.alloc(length);
+
+	bytes.writeUIntBE(size, 0, length);
+	bytes[0] |= 0x80 >> (length - 1);
+
+	return bytes;
+}
+
+function element(id, ...children){
+	const payload = Buffer.concat(children);
+
+	return Buffer.concat([ebmlId(id), ebmlSize(payload.length), payload]);
+}
+
+function uint(id, value, length = 0){
+	if(!length)
+		for(length = 1; length < 6 && value >= 2 ** (8 * length); length++);
+	const bytes = Buffer.alloc(length);
+
+	if(length == 8)
+		bytes.writeBigUInt64BE(BigInt(value));
+	else
+		bytes.writeUIntBE(value, 0, length);
+	return element(id, bytes);
+}
+
+function float(id, value){
+	const bytes = Buffer.alloc(8);
+
+	bytes.writeDoubleBE(value);
+
+	return element(id, bytes);
+}
+
+function string(id, value){
+	return element(id, Buffer.from(value));
+}
+
+const LACING_NONE = 0, LACING_XIPH = 1, LACING_FIXED = 2, LACING_EBML = 3;
+
+function blockBody(time, keyframe, lacing, frames){
+	const header = Buffer.alloc(4);
+	const parts = [header];
+
+	header[0] = 0x81; // track 1
+	header.writeInt16BE(time, 1);
+	header[3] = (keyframe ? 0x80 : 0) | lacing << 1;
+
+	if(lacing != LACING_NONE)
+		parts.push(Buffer.from([frames.length - 1]));
+	if(lacing == LACING_XIPH){
+		for(const frame of frames.slice(0, -1)){
+			const sizes = [];
+
+			let size = frame.length;
+
+			for(; size >= 255; size -= 255)
+				sizes.push(255);
+			sizes.push(size);
+			parts.push(Buffer.from(sizes));
+		}
+	}else if(lacing == LACING_EBML){
+		parts.push(ebmlSize(frames[0].length));
+
+		// the sizes after the first are signed differences, stored with a bias
+		for(let i = 1; i < frames.length - 1; i++){
+			const difference = frames[i].length - frames[i - 1].length;
+
+			let length = 1;
+
+			while(Math.abs(difference) >= 2 ** (7 * length - 1) - 1)
+				length++;
+			const bytes = Buffer.alloc(length);
+
+			bytes.writeUIntBE(difference + 2 ** (7 * length - 1) - 1, 0, length);
+			bytes[0] |= 0x80 >> (length - 1);
+			parts.push(bytes);
+		}
+	}
+
+	return Buffer.concat(parts.concat(frames));
+}
+
+// 3 one second clusters, every lacing in each, the last block in a group with padding to discard
+function makeWebm(file){
+	const CLUSTERS = 3, PER_CLUSTER = 1000 / FRAME_MS;
+	const packets = [];
+	const clusters = [];
+	const sizes = [
+		[LACING_NONE, [40]],
+		[LACING_XIPH, [300, 255, 12, 510]],
+		[LACING_EBML, [100, 7, 180, 60]],
+		[LACING_FIXED, [32, 32, 32]],
+		[LACING_NONE, [254]]
+	];
+
+	for(let c = 0; c < CLUSTERS; c++){
+		const blocks = [];
+
+		let index = 0, kind = 0;
+
+		while(index < PER_CLUSTER){
+			const [lacing, lengths] = sizes[kind++ % sizes.length];
+			const count = Math.min(lengths.length, PER_CLUSTER - index);
+			const frames = lengths.slice(0, count).map((size, i) => opusPacket(packets.length + i, size));
+			const last = c == CLUSTERS - 1 && index + count == PER_CLUSTER;
+			const useLacing = count == 1 ? LACING_NONE : lacing;
+
+			if(last)
+				blocks.push(element(0xa0, element(0xa1, blockBody(index * FRAME_MS, false, useLacing, frames)), uint(0x75a2, 2000000)));
+			else
+				blocks.push(element(0xa3, blockBody(index * FRAME_MS, true, useLacing, frames)));
+			packets.push(...frames);
+			index += count;
+		}
+
+		clusters.push(element(0x1f43b675, uint(0xe7, c * 1000), ...blocks));
+	}
+
+	const info = element(0x1549a966, uint(0x2ad7b1, 1000000), float(0x4489, CLUSTERS * 1000), string(0x4d80, 'sange'), string(0x5741, 'sange'));
+	const tracks = element(0x1654ae6b, element(0xae,
+		uint(0xd7, 1), uint(0x73c5, 1), uint(0x83, 2), string(0x86, 'A_OPUS'), element(0x63a2, opusHead()),
+		uint(0x56aa, 6500000), uint(0x56bb, 80000000),
+		element(0xe1, float(0xb5, 48000), uint(0x9f, 2))
+	));
+
+	// cluster positions are fixed width, so the cues are the same size once they are known
+	const cues = (positions) => element(0x1c53bb6b, ...positions.map((position, c) =>
+		element(0xbb, uint(0xb3, c * 1000), element(0xb7, uint(0xf7, 1), uint(0xf1, position, 8)))
+	));
+
+	const positions = [];
+
+	let position = info.length + tracks.length + cues(clusters.map(() => 0)).length;
+
+	for(const cluster of clusters){
+		positions.push(position);
+		position += cluster.length;
+	}
+
+	const header = element(0x1a45dfa3, uint(0x4286, 1), uint(0x42f7, 1), uint(0x42f2, 4), uint(0x42f3, 8),
+		string(0x4282, 'webm'), uint(0x4287, 4), uint(0x4285, 2));
+	const segment = element(0x18538067, info, tracks, cues(positions), ...clusters);
+
+	fs.writeFileSync(file, Buffer.concat([header, segment]));
+
+	return packets;
+}
+
+// ogg
+const CRC_TABLE = new Uint32Array(256).map((value, i) => {
+	let r = i << 24;
+
+	for(let bit = 0; bit < 8; bit++)
+		r = r & 0x80000000 ? (r << 1) ^ 0x04c11db7 : r << 1;
+	return r >>> 0;
+});
+
+function oggPage(flags, granule, sequence, segments, data){
+	const header = Buffer.alloc(27);
+
+	header.write('OggS', 0);
+	header[5] = flags;
+	header.writeBigInt64LE(BigInt(granule), 6);
+	header.writeUInt32LE(0x53414e47, 14);
+	header.writeUInt32LE(sequence, 18);
+	header[26] = segments.length;
+
+	const page = Buffer.concat([header, Buffer.from(segments), data]);
+
+	let crc = 0;
+
+	for(const byte of page)
+		crc = ((crc << 8) ^ CRC_TABLE[((crc >>> 24) ^ byte) & 0xff]) >>> 0;
+	page.writeUInt32LE(crc, 22);
+
+	return page;
+}
+
+function lacing(size){
+	const segments = [];
+
+	for(; size >= 255; size -= 255)
+		segments.push(255);
+	segments.push(size);
+
+	return segments;
+}
+
+// 300 packets on pages of up to 8, big enough that seeks bisect, with one packet split across two pages
+function makeOgg(file){
+	const COUNT = 300, SPLIT = 43, TRIM = 100;
+	const packets = [];
+	const pages = [];
+	const tags = Buffer.alloc(8 + 4 + 5 + 4);
+
+	tags.write('OpusTags', 0);
+	tags.writeUInt32LE(5, 8);
+	tags.write('sange', 12);
+
+	pages.push(oggPage(0x02, 0, 0, lacing(19), opusHead()));
+	pages.push(oggPage(0, 0, 1, lacing(tags.length), tags));
+
+	for(let i = 0; i < COUNT; i++)
+		packets.push(opusPacket(i, i == SPLIT ? 600 : i == 45 ? 510 : i < 60 ? 20 + i % 80 : 300 + (i * 37) % 700));
+	let i = 0, carry = null;
+
+	while(i < COUNT){
+		const segments = [], data = [];
+
+		let flags = 0;
+
+		if(carry){
+			// the rest of the split packet
+			flags |= 0x01;
+			segments.push(...lacing(carry.length));
+			data.push(carry);
+			carry = null;
+			i++;
+		}
+
+		for(let n = 0; n < 8 && i < COUNT; n++){
+			if(i == SPLIT && !flags){
+				// its first 510 bytes end this page, two full segments continue on the next
+				segments.push(255, 255);
+				data.push(packets[i].subarray(0, 510));
+				carry = packets[i].subarray(510);
+
+				break;
+			}
+
+			segments.push(...lacing(packets[i].length));
+			data.push(packets[i]);
+			i++;
+		}
+
+		const last = i == COUNT;
+
+		// the granule is the end of the last packet completed on the page, the last page ends early
+		pages.push(oggPage(last ? 0x04 : flags, i * 960 - (last ? TRIM : 0), pages.length, segments, Buffer.concat(data)));
+	}
+
+	fs.writeFileSync(file, Buffer.concat(pages));
+
+	return packets;
+}
+
+function play(file, seek){
+	return new Promise((resolve, reject) => {
+		const player = new Player();
+		const received = [];
+
+		let seekedAt = -1, nativeAtSeek = 0;
+
+		player.setNativeDemuxer(true);
+		player.setURL(file, true);
+		player.setOutput(2, 48000, 64000, FRAME_MS);
+
+		player.on('packet', (array) => {
+			received.push(Buffer.from(array));
+
+			if(seek && received.length == seek.after){
+				nativeAtSeek = player.ffplayer.getNativePackets();
+				seekedAt = received.length;
+				player.seek(seek.time);
+			}
+		});
+
+		player.on('finish', () => {
+			const result = {received, seekedAt, nativeAtSeek, native: player.ffplayer.getNativePackets(), codecCopy: player.ffplayer.isCodecCopy()};
+
+			player.destroy();
+			resolve(result);
+		});
+
+		player.on('onerror', (error) => {
+			player.destroy();
+			reject(error);
+		});
+
+		player.start();
+	});
+}
+
+function index(packet){
+	return packet[1] << 8 | packet[2];
+}
+
+async function check(name, expected, file, seek){
+	const {received, seekedAt, nativeAtSeek, native, codecCopy} = await play(file, seek);
+	const failures = [];
+
+	if(!codecCopy)
+		failures.push('expected the codec copy path');
+	if(!seek){
+		if(received.length != expected.length)
+			failures.push(received.length + ' packets, expected ' + expected.length);
+		for(let i = 0; i < Math.min(received.length, expected.length) && failures.length < 4; i++)
+			if(!received[i].equals(expected[i]))
+				failures.push('packet ' + i + ' differs, ' + received[i].length + ' bytes, expected ' + expected[i].length);
+		if(native != expected.length)
+			failures.push(native + ' packets read natively, expected all ' + expected.length);
+	}else{
+		const target = seek.time * 1000 / FRAME_MS;
+
+		// packets already on their way when seeking are delivered first, the jump is where the indices stop following
+		let landing = seekedAt;
+
+		while(landing < received.length && index(received[landing]) == index(received[landing - 1]) + 1)
+			landing++;
+		if(landing == received.length)
+			failures.push('no jump after seeking');
+		else{
+			const first = index(received[landing]);
+
+			if(first < target - 2 || first > target)
+				failures.push('landed on packet ' + first + ', expected ' + target);
+			for(let i = landing; i < received.length && failures.length < 4; i++){
+				const want = expected[first + i - landing];
+
+				if(!want || !received[i].equals(want))
+					failures.push('packet ' + i + ' after the seek differs');
+			}
+			if(native - nativeAtSeek < received.length - landing)
+				failures.push('libavformat took over after the seek');
+		}
+	}
+
+	console.log(name + ': ' + received.length + ' packets, ' + native + ' read natively' + (failures.length ? '' : ', ok'));
+
+	for(const failure of failures)
+		console.log('  FAIL: ' + failure);
+	return failures.length > 0;
+}
+
+async function run(){
+	const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'sange-demuxer-'));
+	const webm = path.join(dir, 'laced.webm'), ogg = path.join(dir, 'paged.ogg');
+	const webmPackets = makeWebm(webm), oggPackets = makeOgg(ogg);
+
+	let failed = false;
+
+	try{
+		failed = await check('webm lacing', webmPackets, webm) || failed;
+		failed = await check('webm cue seek', webmPackets, webm, {after: 20, time: 2.5}) || failed;
+		failed = await check('ogg pages', oggPackets, ogg) || failed;
+		failed = await check('ogg bisect seek', oggPackets, ogg, {after: 60, time: 4}) || failed;
+	}finally{
+		fs.rmSync(dir, {recursive: true, force: true});
+	}
+
+	return failed;
+}
+
+run().then((failed) => {
+	process.exit(failed ? 1 : 0);
+}).catch((error) => {
+	console.error(error);
+	process.exit(1);
+});